@@ -0,0 +1,57 @@
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef CNN_COUNT_ALLOCATIONS
+
+static thread_local size_t allocationCount = 0;
+
+size_t GetAllocationCount()
+{
+    return allocationCount;
+}
+
+void* operator new(size_t size)
+{
+    allocationCount++;
+
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+#else
+
+size_t GetAllocationCount()
+{
+    return 0;
+}
+
+#endif
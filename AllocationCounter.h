@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+* When CNN_COUNT_ALLOCATIONS is defined, the global operator new is replaced by a version that counts every heap allocation.
+* Only the AllocationTest project defines it, which checks that the training and inference loops do not allocate any memory after they are warmed up.
+*/
+
+/*
+* Returns the amount of heap allocations done through operator new by the calling thread since it started,
+* or 0 when the allocations are not counted. The count is per thread, so background work does not show up in the training loop.
+*/
+size_t GetAllocationCount();
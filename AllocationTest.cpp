@@ -0,0 +1,87 @@
+#include "NeuralNetwork.h"
+#include "AllocationCounter.h"
+
+#include <iostream>
+#include <format>
+#include <random>
+#include <vector>
+
+/*
+* Checks that the training steps of Fit, Predict and PredictBatch do not allocate any heap memory once they are warmed up.
+* Built by the AllocationTest project, which defines CNN_COUNT_ALLOCATIONS so every allocation through operator new is counted.
+* Uses random samples, so it does not need the data set. Returns 0 when no allocations were found, and 1 otherwise.
+*/
+
+#ifndef CNN_COUNT_ALLOCATIONS
+#error The allocation test has to be built with CNN_COUNT_ALLOCATIONS defined
+#endif
+
+static void RandomSamples(size_t amount, size_t size, std::mt19937& generator, std::vector<std::vector<float>>& samples, std::vector<size_t>& labels)
+{
+    std::uniform_real_distribution<float> value(0.f, 1.f);
+    std::uniform_int_distribution<size_t> label(0, 9);
+
+    samples.assign(amount, std::vector<float>(size));
+    labels.resize(amount);
+
+    for (size_t n = 0; n < amount; n++) {
+        for (auto& v : samples[n])
+            v = value(generator);
+
+        labels[n] = label(generator);
+    }
+}
+
+int main()
+{
+    std::mt19937 generator(1);
+    std::vector<std::vector<float>> trainInput, validationInput;
+    std::vector<size_t> trainLabels, validationLabels;
+
+    RandomSamples(200, 12 * 12, generator, trainInput, trainLabels);
+    RandomSamples(50, 12 * 12, generator, validationInput, validationLabels);
+
+    NeuralNetwork model;
+    model.AddLayer(new Input(12, 12, 1));
+    model.AddLayer(new Convolution(4, 3, 0, 1, "relu"));
+    model.AddLayer(new MaxPooling(2));
+    model.AddLayer(new FullyConnected(32, "linear"));
+    model.AddLayer(new BatchNorm("relu"));
+    model.AddLayer(new FullyConnected(10, "softmax"));
+
+    model.Create(1E-3f);
+    model.SetVerbose(false);
+
+    bool passed = true;
+
+    auto check = [&passed](const char* name, size_t allocations) {
+        std::cout << std::format("{} - {} heap allocations\n", name, allocations);
+        passed = passed && allocations == 0;
+    };
+
+    model.Fit(2, trainInput, trainLabels, validationInput, validationLabels);
+    check("Training steps", model.StepAllocations());
+
+    //The first prediction of a batch size warms up, after it predicting allocates nothing.
+    model.Predict(validationInput[0]);
+
+    size_t before = GetAllocationCount();
+    for (const auto& sample : validationInput)
+        model.Predict(sample);
+    check("Predict", GetAllocationCount() - before);
+
+    std::vector<float> batch;
+    for (size_t n = 0; n < 8; n++)
+        batch.insert(batch.end(), validationInput[n].begin(), validationInput[n].end());
+
+    model.PredictBatch(batch.data(), 8);
+
+    before = GetAllocationCount();
+    for (size_t i = 0; i < 10; i++)
+        model.PredictBatch(batch.data(), 8);
+    check("PredictBatch", GetAllocationCount() - before);
+
+    std::cout << (passed ? "Passed\n" : "Failed\n");
+
+    return passed ? 0 : 1;
+}
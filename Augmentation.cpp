@@ -0,0 +1,254 @@
+#include "Augmentation.h"
+
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <numbers>
+#include <cmath>
+
+namespace {
+    //Mixes the bits of the value, so neighbouring sample indices get unrelated seeds.
+    uint64_t SplitMix(uint64_t value)
+    {
+        value += 0x9E3779B97F4A7C15;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+        return value ^ (value >> 31);
+    }
+}
+
+AugmentationPipeline::AugmentationPipeline(const SampleSet& inputs, size_t width, size_t height, size_t channels, const AugmentationSettings& settings, size_t threads, size_t capacity) :
+    inputs(inputs), width(width), height(height), channels(channels), sampleSize(width * height * channels), capacity(std::max<size_t>(capacity, 1)), settings(settings),
+    slots(this->capacity * sampleSize, 0.f), slotSequence(this->capacity)
+{
+    if (settings.elasticAlpha > 0.f) {
+        const size_t radius = static_cast<size_t>(std::ceil(2.f * settings.elasticSigma));
+        float sum = 0.f;
+
+        for (size_t i = 0; i <= 2 * radius; i++) {
+            const float x = static_cast<float>(i) - static_cast<float>(radius);
+            kernel.push_back(std::exp(-x * x / (2.f * settings.elasticSigma * settings.elasticSigma)));
+            sum += kernel.back();
+        }
+
+        for (auto& weight : kernel)
+            weight /= sum;
+    }
+
+    threadCount = threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+    scratch.resize(threadCount);
+    for (auto& buffers : scratch) {
+        buffers.sourceX.resize(width * height);
+        buffers.sourceY.resize(width * height);
+        buffers.blurred.resize(width * height);
+    }
+
+    for (size_t worker = 0; worker < threadCount; worker++)
+        workers.emplace_back(&AugmentationPipeline::Run, this, worker);
+}
+
+AugmentationPipeline::~AugmentationPipeline()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+
+    started.notify_all();
+
+    //Wakes up the workers that wait for a free slot.
+    consumed.fetch_add(1);
+    consumed.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void AugmentationPipeline::Start(size_t epoch, size_t firstIndex, size_t stride, size_t count)
+{
+    if (count != 0 && firstIndex + (count - 1) * stride >= inputs.size()) {
+        std::cout << "Error AugmentationPipeline::Start(), the samples of the epoch are outside of the data set\n";
+        exit(1);
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        this->epoch = epoch;
+        this->firstIndex = firstIndex;
+        this->stride = stride;
+        this->count = count;
+        firstSequence = consumed.load();
+        generation++;
+    }
+
+    started.notify_all();
+}
+
+void AugmentationPipeline::Next(std::span<float> destination)
+{
+    const size_t sequence = consumed.load(std::memory_order_relaxed);
+    auto& ready = slotSequence[sequence % capacity];
+
+    for (size_t value = ready.load(std::memory_order_acquire); value != sequence + 1; value = ready.load(std::memory_order_acquire))
+        ready.wait(value);
+
+    const float* slot = slots.data() + (sequence % capacity) * sampleSize;
+    std::copy(slot, slot + sampleSize, destination.begin());
+
+    consumed.store(sequence + 1, std::memory_order_release);
+    consumed.notify_all();
+}
+
+/*
+* Worker w augments the steps w, w + threadCount, ... of every epoch. A step is only written when its slot has been taken by Next,
+* so the workers are at most capacity samples ahead of the training loop.
+*/
+void AugmentationPipeline::Run(size_t worker)
+{
+    size_t seenGeneration = 0;
+
+    while (true) {
+        size_t epoch, firstIndex, stride, count, firstSequence;
+
+        {
+            std::unique_lock lock(mutex);
+            started.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+
+            if (stopping)
+                return;
+
+            seenGeneration = generation;
+            epoch = this->epoch;
+            firstIndex = this->firstIndex;
+            stride = this->stride;
+            count = this->count;
+            firstSequence = this->firstSequence;
+        }
+
+        for (size_t step = worker; step < count; step += threadCount) {
+            const size_t sequence = firstSequence + step;
+
+            for (size_t done = consumed.load(std::memory_order_acquire); sequence >= done + capacity; done = consumed.load(std::memory_order_acquire)) {
+                if (stopping)
+                    return;
+
+                consumed.wait(done);
+            }
+
+            if (stopping)
+                return;
+
+            const size_t n = firstIndex + step * stride;
+
+            Augment(inputs[n], slots.data() + (sequence % capacity) * sampleSize, SplitMix(SplitMix(settings.seed ^ epoch) ^ n), scratch[worker]);
+
+            slotSequence[sequence % capacity].store(sequence + 1, std::memory_order_release);
+            slotSequence[sequence % capacity].notify_one();
+        }
+    }
+}
+
+/*
+* All transformations are combined into a single mapping from output to input coordinates, which is sampled bilinearly once.
+* The mapping is computed in separate passes over contiguous buffers. The inner loops have no branches, the borders of the image are handled
+* by the loop bounds or by clamped indices with a weight of 0.
+*/
+void AugmentationPipeline::Augment(std::span<const float> input, float* output, uint64_t seed, Scratch& scratch) const
+{
+    std::mt19937_64 generator(seed);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+
+    const size_t planeSize = width * height;
+    float* sourceX = scratch.sourceX.data();
+    float* sourceY = scratch.sourceY.data();
+
+    //The elastic displacement field, random displacements smoothed by a separable gaussian.
+    if (settings.elasticAlpha > 0.f) {
+        const size_t radius = kernel.size() / 2;
+        float* blurred = scratch.blurred.data();
+
+        for (float* field : { sourceX, sourceY }) {
+            for (size_t i = 0; i < planeSize; i++)
+                field[i] = uniform(generator);
+
+            std::fill(blurred, blurred + planeSize, 0.f);
+
+            for (size_t y = 0; y < height; y++) {
+                for (size_t k = 0; k < kernel.size(); k++) {
+                    const ptrdiff_t offset = static_cast<ptrdiff_t>(k) - static_cast<ptrdiff_t>(radius);
+                    const size_t begin = static_cast<size_t>(std::max<ptrdiff_t>(0, -offset));
+                    const size_t end = static_cast<size_t>(std::min<ptrdiff_t>(width, static_cast<ptrdiff_t>(width) - offset));
+
+                    for (size_t x = begin; x < end; x++)
+                        blurred[y * width + x] += kernel[k] * field[y * width + x + offset];
+                }
+            }
+
+            std::fill(field, field + planeSize, 0.f);
+
+            for (size_t y = 0; y < height; y++) {
+                //The rows of the kernel that fall inside of the image, row y + k - radius is read.
+                const size_t begin = radius > y ? radius - y : 0;
+                const size_t end = std::min(kernel.size(), height + radius - y);
+
+                for (size_t k = begin; k < end; k++) {
+                    const size_t sourceRow = y + k - radius;
+                    const float weight = kernel[k] * settings.elasticAlpha;
+
+                    for (size_t x = 0; x < width; x++)
+                        field[y * width + x] += weight * blurred[sourceRow * width + x];
+                }
+            }
+        }
+    }
+    else {
+        std::fill(sourceX, sourceX + planeSize, 0.f);
+        std::fill(sourceY, sourceY + planeSize, 0.f);
+    }
+
+    //The rotation around the center of the image and the shift.
+    const float angle = uniform(generator) * settings.maxRotation * std::numbers::pi_v<float> / 180.f;
+    const float cosine = std::cos(angle), sine = std::sin(angle);
+    const float shiftX = uniform(generator) * settings.maxShift, shiftY = uniform(generator) * settings.maxShift;
+    const float centerX = static_cast<float>(width - 1) * 0.5f, centerY = static_cast<float>(height - 1) * 0.5f;
+
+    for (size_t y = 0; y < height; y++) {
+        const float v = static_cast<float>(y) - centerY;
+
+        for (size_t x = 0; x < width; x++) {
+            const float u = static_cast<float>(x) - centerX;
+
+            sourceX[y * width + x] += cosine * u - sine * v + centerX - shiftX;
+            sourceY[y * width + x] += sine * u + cosine * v + centerY - shiftY;
+        }
+    }
+
+    //Bilinear sampling, pixels outside of the input are 0. They are read at the clamped position, and masked out by a weight of 0.
+    const ptrdiff_t lastX = static_cast<ptrdiff_t>(width) - 1, lastY = static_cast<ptrdiff_t>(height) - 1;
+
+    for (size_t i = 0; i < planeSize; i++) {
+        const float fx = std::floor(sourceX[i]), fy = std::floor(sourceY[i]);
+        const float wx = sourceX[i] - fx, wy = sourceY[i] - fy;
+        const ptrdiff_t x0 = static_cast<ptrdiff_t>(fx), y0 = static_cast<ptrdiff_t>(fy);
+
+        const float left = (1.f - wx) * static_cast<float>(x0 >= 0 && x0 <= lastX), right = wx * static_cast<float>(x0 + 1 >= 0 && x0 + 1 <= lastX);
+        const float top = (1.f - wy) * static_cast<float>(y0 >= 0 && y0 <= lastY), bottom = wy * static_cast<float>(y0 + 1 >= 0 && y0 + 1 <= lastY);
+
+        const size_t x1 = static_cast<size_t>(std::clamp<ptrdiff_t>(x0, 0, lastX)), x2 = static_cast<size_t>(std::clamp<ptrdiff_t>(x0 + 1, 0, lastX));
+        const size_t row1 = static_cast<size_t>(std::clamp<ptrdiff_t>(y0, 0, lastY)) * width, row2 = static_cast<size_t>(std::clamp<ptrdiff_t>(y0 + 1, 0, lastY)) * width;
+
+        for (size_t c = 0; c < channels; c++) {
+            const float* plane = input.data() + c * planeSize;
+
+            output[c * planeSize + i] = top * (left * plane[row1 + x1] + right * plane[row1 + x2]) + bottom * (left * plane[row2 + x1] + right * plane[row2 + x2]);
+        }
+    }
+
+    if (settings.noise > 0.f) {
+        std::normal_distribution<float> noise(0.f, settings.noise);
+
+        for (size_t i = 0; i < sampleSize; i++)
+            output[i] = std::clamp(output[i] + noise(generator), 0.f, 1.f);
+    }
+}
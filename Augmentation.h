@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "common.h"
+
+/*
+* The random transformations that are applied to every training sample, all of them are disabled when set to 0.
+* Shifts are in pixels and rotations in degrees, the elastic distortion displaces every pixel by a random field which is smoothed by a gaussian with the given sigma.
+*/
+struct AugmentationSettings
+{
+    float maxShift = 2.f;
+    float maxRotation = 10.f;
+    float elasticAlpha = 0.f;
+    float elasticSigma = 4.f;
+    float noise = 0.f;
+    uint64_t seed = 0;
+};
+
+/*
+* Augments the training samples on worker threads while the network trains, instead of storing augmented copies of the data set.
+* The augmented samples are written to a fixed ring of slots, so the memory use does not depend on the amount of samples or epochs.
+* Every sample is augmented with its own random generator seeded from the seed, epoch and sample index, so the result does not depend on the amount of threads.
+*/
+class AugmentationPipeline
+{
+public:
+    AugmentationPipeline(const SampleSet& inputs, size_t width, size_t height, size_t channels, const AugmentationSettings& settings, size_t threads = 0, size_t capacity = 256);
+    ~AugmentationPipeline();
+
+    //Starts augmenting the samples firstIndex + step * stride for step in [0, count), every one of them has to be taken with Next before the next epoch starts.
+    void Start(size_t epoch, size_t firstIndex, size_t stride, size_t count);
+
+    //Waits for the next augmented sample of the epoch, and copies it to the destination.
+    void Next(std::span<float> destination);
+
+private:
+    //The buffers of a worker, for every output pixel the coordinates in the input it is sampled from.
+    struct Scratch
+    {
+        std::vector<float> sourceX, sourceY, blurred;
+    };
+
+    void Run(size_t worker);
+    void Augment(std::span<const float> input, float* output, uint64_t seed, Scratch& scratch) const;
+
+    const SampleSet inputs;
+    const size_t width, height, channels, sampleSize, capacity;
+    const AugmentationSettings settings;
+
+    //The gaussian that smooths the elastic displacement field.
+    std::vector<float> kernel;
+
+    std::vector<float> slots;
+
+    //The sequence number + 1 of the sample in every slot. Sequence numbers keep increasing over the epochs, so a slot is never mistaken for a slot of the previous epoch.
+    std::vector<std::atomic<size_t>> slotSequence;
+    std::atomic<size_t> consumed{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    size_t threadCount = 1;
+    std::vector<std::thread> workers;
+    std::vector<Scratch> scratch;
+
+    std::mutex mutex;
+    std::condition_variable started;
+    size_t generation = 0, epoch = 0, firstIndex = 0, stride = 1, count = 0, firstSequence = 0;
+};
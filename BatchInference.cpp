@@ -0,0 +1,245 @@
+#include "BatchInference.h"
+
+#include <iostream>
+#include <format>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <bit>
+#include <memory>
+
+BatchInference::BatchInference(const std::string& modelFile, size_t threads, size_t batchSize, size_t chunkSize) :
+    threadCount(threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u)), batchSize(std::max<size_t>(batchSize, 1)), chunkSize(std::max({ chunkSize, this->batchSize, size_t(1) }))
+{
+    model.SetAutoTuning();
+    model.LoadModel(modelFile);
+    inputSize = model.InputSize();
+    outputSize = model.OutputSize();
+
+    //Every worker can work on a chunk while the next one is read and the previous one is written.
+    slots.resize(threadCount + 2);
+}
+
+size_t BatchInference::ReadHeader(std::ifstream& file, InputFormat format, const std::string& fileName)
+{
+    const size_t fileSize = std::filesystem::file_size(fileName);
+
+    if (format != InputFormat::IDX) {
+        floats = format == InputFormat::RawFloats;
+        valueSize = floats ? sizeof(float) : 1;
+        bigEndian = false;
+
+        if (fileSize % (inputSize * valueSize) != 0) {
+            std::cout << "Error BatchInference::Run(), the size of " << fileName << " is not a multiple of the size of a sample\n";
+            exit(1);
+        }
+
+        return fileSize / (inputSize * valueSize);
+    }
+
+    //The magic value is two zero bytes, the type of the values and the amount of dimensions, followed by the big endian size of every dimension.
+    uint8_t magic[4] = {};
+    file.read(reinterpret_cast<char*>(magic), 4);
+
+    if (magic[0] != 0 || magic[1] != 0 || (magic[2] != 0x08 && magic[2] != 0x0D) || magic[3] == 0) {
+        std::cout << "Error BatchInference::Run(), " << fileName << " is not an IDX file of unsigned bytes or floats\n";
+        exit(1);
+    }
+
+    floats = magic[2] == 0x0D;
+    valueSize = floats ? sizeof(float) : 1;
+    bigEndian = true;
+
+    size_t samples = 0, sampleSize = 1;
+
+    for (uint8_t i = 0; i < magic[3]; i++) {
+        uint32_t dimension = 0;
+        file.read(reinterpret_cast<char*>(&dimension), 4);
+        dimension = std::byteswap(dimension);
+
+        if (i == 0)
+            samples = dimension;
+        else
+            sampleSize *= dimension;
+    }
+
+    if (!file || sampleSize != inputSize || 4 + 4 * magic[3] + samples * sampleSize * valueSize > fileSize) {
+        std::cout << "Error BatchInference::Run(), the samples of " << fileName << " do not match the input of the model, or the file is incomplete\n";
+        exit(1);
+    }
+
+    return samples;
+}
+
+void BatchInference::Run(const std::string& inputFile, InputFormat format, const std::string& outputFile)
+{
+    std::ifstream input(inputFile, std::ios::binary);
+
+    if (!input.is_open()) {
+        std::cout << "Error, could not open the given file: " << inputFile << '\n';
+        exit(1);
+    }
+
+    std::ofstream output(outputFile);
+
+    if (!output.is_open()) {
+        std::cout << "Error, could not create the given file: " << outputFile << '\n';
+        exit(1);
+    }
+
+    const size_t samples = ReadHeader(input, format, inputFile);
+    const size_t chunks = (samples + chunkSize - 1) / chunkSize;
+
+    for (auto& slot : slots) {
+        slot.state = SlotState::Free;
+        slot.raw.resize(chunkSize * inputSize * valueSize);
+        slot.inputs.resize(chunkSize * inputSize);
+        slot.outputs.resize(chunkSize * outputSize);
+    }
+
+    finished = false;
+    written = 0;
+
+    output << "index,prediction";
+    for (size_t i = 0; i < outputSize; i++)
+        output << ",output" << i;
+    output << '\n';
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    //The batch sizes of the workers, including the smaller last batches of the chunks, are tuned before the model is copied, so the copies do not all tune at once.
+    for (size_t size : { chunkSize % batchSize, samples % chunkSize % batchSize, batchSize }) {
+        if (size != 0)
+            model.SetBatchSize(size);
+    }
+
+    //Every worker feeds forward its own copy of the model, as the layers store the outputs of the batch.
+    std::vector<std::unique_ptr<NeuralNetwork>> networks;
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threadCount; i++) {
+        networks.push_back(std::make_unique<NeuralNetwork>(model));
+        workers.emplace_back(&BatchInference::Work, this, std::ref(*networks.back()));
+    }
+
+    std::thread writer([this, &output, chunks]() {
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            Slot& slot = slots[chunk % slots.size()];
+
+            std::unique_lock lock(mutex);
+            slotDone.wait(lock, [&slot, chunk]() { return slot.state == SlotState::Done && slot.sequence == chunk; });
+            lock.unlock();
+
+            std::string lines;
+
+            for (size_t n = 0; n < slot.samples; n++) {
+                const float* outputs = slot.outputs.data() + n * outputSize;
+
+                lines += std::format("{},{}", written + n, std::distance(outputs, std::max_element(outputs, outputs + outputSize)));
+                for (size_t i = 0; i < outputSize; i++)
+                    lines += std::format(",{:.6g}", outputs[i]);
+                lines += '\n';
+            }
+
+            output.write(lines.data(), lines.size());
+            written += slot.samples;
+
+            lock.lock();
+            slot.state = SlotState::Free;
+            slotFreed.notify_one();
+        }
+    });
+
+    //The chunks are read in order into the slots in turn, a slot is only reused after its chunk is written.
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        Slot& slot = slots[chunk % slots.size()];
+
+        {
+            std::unique_lock lock(mutex);
+            slotFreed.wait(lock, [&slot]() { return slot.state == SlotState::Free; });
+        }
+
+        slot.sequence = chunk;
+        slot.samples = std::min(chunkSize, samples - chunk * chunkSize);
+        input.read(reinterpret_cast<char*>(slot.raw.data()), slot.samples * inputSize * valueSize);
+
+        if (!input) {
+            std::cout << "Error BatchInference::Run(), " << inputFile << " is incomplete\n";
+            exit(1);
+        }
+
+        std::lock_guard lock(mutex);
+        slot.state = SlotState::Filled;
+        slotFilled.notify_one();
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        finished = true;
+        slotFilled.notify_all();
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    writer.join();
+
+    const std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - startTime;
+
+    std::cout << std::format("Scored {} samples in {:.2f}s - {:.1f} samples/s - {} threads, batch size {}, chunks of {} samples\n",
+        samples, elapsedTime.count(), static_cast<double>(samples) / elapsedTime.count(), threadCount, batchSize, chunkSize);
+}
+
+void BatchInference::Work(NeuralNetwork& network)
+{
+    while (true) {
+        Slot* slot = nullptr;
+
+        {
+            std::unique_lock lock(mutex);
+
+            auto filled = [this]() { return std::ranges::find(slots, SlotState::Filled, &Slot::state); };
+            slotFilled.wait(lock, [this, &filled]() { return filled() != slots.end() || finished; });
+
+            const auto found = filled();
+            if (found == slots.end())
+                return;
+
+            slot = &*found;
+            slot->state = SlotState::Working;
+        }
+
+        Convert(*slot);
+
+        for (size_t first = 0; first < slot->samples; first += batchSize) {
+            const size_t samples = std::min(batchSize, slot->samples - first);
+            const auto& outputs = network.PredictBatch(slot->inputs.data() + first * inputSize, samples);
+
+            std::copy_n(outputs.begin(), samples * outputSize, slot->outputs.begin() + first * outputSize);
+        }
+
+        std::lock_guard lock(mutex);
+        slot->state = SlotState::Done;
+        slotDone.notify_all();
+    }
+}
+
+void BatchInference::Convert(Slot& slot) const
+{
+    const size_t values = slot.samples * inputSize;
+
+    if (!floats) {
+        for (size_t i = 0; i < values; i++)
+            slot.inputs[i] = static_cast<float>(slot.raw[i]) / 255.f;
+
+        return;
+    }
+
+    std::memcpy(slot.inputs.data(), slot.raw.data(), values * sizeof(float));
+
+    if (bigEndian) {
+        for (size_t i = 0; i < values; i++)
+            slot.inputs[i] = std::bit_cast<float>(std::byteswap(std::bit_cast<uint32_t>(slot.inputs[i])));
+    }
+}
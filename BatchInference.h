@@ -0,0 +1,69 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+enum class InputFormat { IDX, RawBytes, RawFloats };
+
+/*
+* Scores a file of input samples with a saved model, without reading the whole file into memory. The samples are read in chunks
+* into a fixed amount of slots, the chunks are fed forward in batches on worker threads, each with its own copy of the model,
+* and the outputs are written in the order of the input. So the memory use only depends on the chunk size and the amount of threads.
+* The layers are tuned for the batch sizes that are used, with the tuning cache tuning.cache in the working directory.
+*
+* The input is an IDX file of unsigned bytes or floats, or a raw file of samples stored after each other as unsigned bytes or native floats.
+* Bytes are divided by 255, like ReadIDXFileData does. The output is a CSV file with the index, the predicted class and the output of every class.
+*/
+class BatchInference
+{
+public:
+    BatchInference(const std::string& modelFile, size_t threads = 0, size_t batchSize = 64, size_t chunkSize = 4096);
+    BatchInference(const BatchInference&) = delete;
+    BatchInference& operator=(const BatchInference&) = delete;
+
+    //Scores all samples of the input file, and reports the throughput afterwards.
+    void Run(const std::string& inputFile, InputFormat format, const std::string& outputFile);
+
+private:
+    enum class SlotState { Free, Filled, Working, Done };
+
+    struct Slot
+    {
+        SlotState state = SlotState::Free;
+        size_t sequence = 0, samples = 0;
+
+        //The samples as they are stored in the file, converted to floats by the worker.
+        std::vector<uint8_t> raw;
+        std::vector<float> inputs, outputs;
+    };
+
+    //Sets the size and type of the stored values from the format, or from the header of an IDX file. Returns the amount of samples.
+    size_t ReadHeader(std::ifstream& file, InputFormat format, const std::string& fileName);
+
+    void Work(NeuralNetwork& network);
+    void Convert(Slot& slot) const;
+
+    NeuralNetwork model;
+    const size_t threadCount, batchSize, chunkSize;
+    size_t inputSize = 0, outputSize = 0;
+
+    //How the values of the current input file are stored.
+    size_t valueSize = 1;
+    bool floats = false, bigEndian = false;
+
+    std::vector<Slot> slots;
+    bool finished = false;
+
+    //The amount of samples written to the output, only used by the writer thread.
+    size_t written = 0;
+
+    std::mutex mutex;
+    std::condition_variable slotFreed, slotFilled, slotDone;
+};
@@ -0,0 +1,201 @@
+#include "Benchmark.h"
+#include "NeuralNetwork.h"
+#include "MNISTreader.h"
+#include "MachineProfile.h"
+
+#include <iostream>
+#include <format>
+#include <random>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+
+static size_t PeakResidentBytes()
+{
+    PROCESS_MEMORY_COUNTERS counters{};
+
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+}
+#else
+#include <sys/resource.h>
+
+//Linux reports the maximum resident set size in kilobytes.
+static size_t PeakResidentBytes()
+{
+    rusage usage{};
+
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<size_t>(usage.ru_maxrss) * 1024 : 0;
+}
+#endif
+
+namespace
+{
+    struct ReferenceArchitecture
+    {
+        const char* name;
+        float learningRate, decayRate;
+        void (*build)(NeuralNetwork& network);
+    };
+
+    //The architectures and learning rates of the example models in Main.
+    const ReferenceArchitecture referenceArchitectures[] = {
+        { "mlp", 1E-4f, 0.1f, [](NeuralNetwork& network) {
+            network.AddLayer(new Input(28, 28, 1));
+            network.AddLayer(new FullyConnected(128, "relu"));
+            network.AddLayer(new FullyConnected(64, "relu"));
+            network.AddLayer(new FullyConnected(64, "relu"));
+            network.AddLayer(new FullyConnected(10, "softmax"));
+        } },
+        { "conv", 3E-4f, 0.1f, [](NeuralNetwork& network) {
+            network.AddLayer(new Input(28, 28, 1));
+            network.AddLayer(new Convolution(8, 5, 0, 1, "relu"));
+            network.AddLayer(new MaxPooling(2));
+            network.AddLayer(new Convolution(16, 3, 0, 1, "relu"));
+            network.AddLayer(new MaxPooling(2));
+            network.AddLayer(new FullyConnected(100, "relu"));
+            network.AddLayer(new FullyConnected(30, "relu"));
+            network.AddLayer(new FullyConnected(10, "softmax"));
+        } },
+    };
+}
+
+static std::string JsonString(const std::string& value)
+{
+    std::string escaped = "\"";
+
+    for (char c : value) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+
+        escaped += c;
+    }
+
+    return escaped + '"';
+}
+
+void RunBenchmarks(const DataSet& dataSet, const std::string& dataSetName, const BenchmarkSettings& settings, std::ostream& output)
+{
+    static const std::vector<std::vector<float>> noSamples;
+    static const std::vector<size_t> noLabels;
+
+    output << "{\n";
+    output << std::format("  \"dataSet\": {},\n", JsonString(dataSetName));
+    output << std::format("  \"processor\": {},\n", JsonString(MachineProfile::ProcessorName()));
+    output << std::format("  \"trainSamples\": {},\n", dataSet.trainInput.size());
+    output << std::format("  \"validationSamples\": {},\n", dataSet.validationInput.size());
+    output << std::format("  \"seed\": {},\n", settings.seed);
+    output << std::format("  \"targetAccuracy\": {},\n", settings.targetAccuracy);
+    output << "  \"architectures\": [\n";
+
+    for (size_t a = 0; a < std::size(referenceArchitectures); a++) {
+        const auto& architecture = referenceArchitectures[a];
+
+        SeedWeights(settings.seed);
+
+        NeuralNetwork network;
+        architecture.build(network);
+        network.Create(architecture.learningRate, architecture.decayRate);
+        network.SetVerbose(false);
+
+        const auto throughput = network.MeasureThroughput(dataSet.validationInput, dataSet.validationLabels, settings.throughputSamples);
+
+        std::vector<float> accuracies;
+        double trainingSeconds = 0.0, secondsToAccuracy = -1.0;
+
+        //Every epoch is fitted on its own, so the validation in between is not part of the training time.
+        while (accuracies.size() < settings.maxEpochs && secondsToAccuracy < 0.0) {
+            const auto startTime = std::chrono::steady_clock::now();
+            network.Fit(1, dataSet.trainInput, dataSet.trainLabels, noSamples, noLabels);
+            const std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - startTime;
+
+            trainingSeconds += elapsedTime.count();
+            accuracies.push_back(network.Accuracy(dataSet.validationInput, dataSet.validationLabels));
+
+            if (accuracies.back() >= settings.targetAccuracy)
+                secondsToAccuracy = trainingSeconds;
+        }
+
+        std::string accuracyList;
+        for (size_t i = 0; i < accuracies.size(); i++)
+            accuracyList += std::format("{}{:.4f}", i == 0 ? "" : ", ", accuracies[i]);
+
+        const double trainingThroughput = static_cast<double>(accuracies.size() * dataSet.trainInput.size()) / trainingSeconds;
+
+        output << "    {\n";
+        output << std::format("      \"name\": {},\n", JsonString(architecture.name));
+        output << std::format("      \"forwardSamplesPerSecond\": {:.1f},\n", throughput.forward);
+        output << std::format("      \"forwardBackwardSamplesPerSecond\": {:.1f},\n", throughput.forwardBackward);
+        output << std::format("      \"trainingSamplesPerSecond\": {:.1f},\n", trainingThroughput);
+        output << std::format("      \"epochs\": {},\n", accuracies.size());
+        output << std::format("      \"trainingSeconds\": {:.3f},\n", trainingSeconds);
+        output << std::format("      \"validationAccuracy\": [{}],\n", accuracyList);
+        output << std::format("      \"secondsToAccuracy\": {},\n", secondsToAccuracy < 0.0 ? "null" : std::format("{:.3f}", secondsToAccuracy));
+        //The peak of the whole process so far, so it includes the data set and the architectures before this one.
+        output << std::format("      \"cumulativePeakResidentBytes\": {}\n", PeakResidentBytes());
+        output << (a + 1 < std::size(referenceArchitectures) ? "    },\n" : "    }\n");
+    }
+
+    output << "  ]\n}\n";
+}
+
+void WriteSyntheticDataSet(const std::string& directory, size_t trainSamples, size_t validationSamples, uint64_t seed)
+{
+    constexpr size_t size = 28, classes = 10, strokes = 3, maxShift = 2;
+
+    std::mt19937_64 generator(seed);
+    std::uniform_real_distribution<float> position(4.f, static_cast<float>(size - 4));
+
+    //Every class is drawn as a few thick strokes between random points.
+    std::vector<float> patterns(classes * size * size, 0.f);
+
+    for (size_t c = 0; c < classes; c++) {
+        for (size_t s = 0; s < strokes; s++) {
+            const float x0 = position(generator), y0 = position(generator), x1 = position(generator), y1 = position(generator);
+
+            for (size_t t = 0; t <= 32; t++) {
+                const float x = x0 + (x1 - x0) * static_cast<float>(t) / 32.f, y = y0 + (y1 - y0) * static_cast<float>(t) / 32.f;
+
+                for (size_t py = static_cast<size_t>(y) - 1; py <= static_cast<size_t>(y) + 1; py++)
+                    for (size_t px = static_cast<size_t>(x) - 1; px <= static_cast<size_t>(x) + 1; px++)
+                        patterns[(c * size + py) * size + px] = 1.f;
+            }
+        }
+    }
+
+    std::uniform_int_distribution<size_t> label(0, classes - 1), shift(0, 2 * maxShift);
+    std::uniform_real_distribution<float> noise(0.f, 0.3f);
+
+    auto write = [&](size_t samples, const std::string& images, const std::string& labels) {
+        std::vector<uint8_t> pixels(samples * size * size);
+        std::vector<size_t> sampleLabels(samples);
+
+        for (size_t n = 0; n < samples; n++) {
+            sampleLabels[n] = label(generator);
+
+            const size_t shiftX = shift(generator), shiftY = shift(generator);
+            const float* pattern = patterns.data() + sampleLabels[n] * size * size;
+
+            for (size_t y = 0; y < size; y++) {
+                for (size_t x = 0; x < size; x++) {
+                    const size_t sourceX = x + shiftX - maxShift, sourceY = y + shiftY - maxShift;
+                    const float value = sourceX < size && sourceY < size ? pattern[sourceY * size + sourceX] : 0.f;
+
+                    pixels[(n * size + y) * size + x] = static_cast<uint8_t>(std::min(value * 0.8f + noise(generator), 1.f) * 255.f);
+                }
+            }
+        }
+
+        WriteIDXFileData((std::filesystem::path(directory) / images).string(), pixels, size, size);
+        WriteIDXFileLabels((std::filesystem::path(directory) / labels).string(), sampleLabels);
+    };
+
+    std::filesystem::create_directories(directory);
+
+    write(trainSamples, "train-images.idx3-ubyte", "train-labels.idx1-ubyte");
+    write(validationSamples, "t10k-images.idx3-ubyte", "t10k-labels.idx1-ubyte");
+}
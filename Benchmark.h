@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+#include "common.h"
+
+struct BenchmarkSettings
+{
+    //Training stops when the target validation accuracy is reached, or after the maximum amount of epochs.
+    size_t maxEpochs = 5;
+    float targetAccuracy = 0.97f;
+
+    //The amount of samples the forward and forward plus backward throughput are measured over.
+    size_t throughputSamples = 2000;
+
+    //The seed of the initial weights, training itself does not shuffle so a run is fully reproducible.
+    uint64_t seed = 1;
+};
+
+/*
+* Trains the reference architectures of Main, the fully connected network and the convolutional network, and writes for each of them
+* the samples per second of the forward pass, of the forward and backward pass and of full training, the time until the target validation
+* accuracy is reached and the peak resident memory of the process so far as JSON. The peak is cumulative, it never decreases from one architecture to the next. The training time excludes the validation after every epoch.
+*/
+void RunBenchmarks(const DataSet& dataSet, const std::string& dataSetName, const BenchmarkSettings& settings, std::ostream& output);
+
+/*
+* Writes a synthetic data set of 28x28 images with 10 classes to the directory, with the file names of MNIST. Every class is a pattern of random strokes,
+* the samples are shifted and noisy versions of the pattern of their class. The same seed always gives the same files.
+*/
+void WriteSyntheticDataSet(const std::string& directory, size_t trainSamples, size_t validationSamples, uint64_t seed);
@@ -0,0 +1,91 @@
+#include "NeuralNetwork.h"
+
+#include <iostream>
+#include <format>
+#include <random>
+#include <vector>
+#include <filesystem>
+
+/*
+* Checks that resuming a fine tune from a checkpoint keeps the layers that were frozen, so their weights stay those of the checkpoint
+* while the layers after them are trained further. Built by the CheckpointTest project. Uses random samples, so it does not need the data set.
+* Returns 0 when the frozen layers kept their weights, and 1 otherwise.
+*/
+
+static void RandomSamples(size_t amount, size_t size, std::mt19937& generator, std::vector<std::vector<float>>& samples, std::vector<size_t>& labels)
+{
+    std::uniform_real_distribution<float> value(0.f, 1.f);
+    std::uniform_int_distribution<size_t> label(0, 9);
+
+    samples.assign(amount, std::vector<float>(size));
+    labels.resize(amount);
+
+    for (size_t n = 0; n < amount; n++) {
+        for (auto& v : samples[n])
+            v = value(generator);
+
+        labels[n] = label(generator);
+    }
+}
+
+static void BuildNetwork(NeuralNetwork& model)
+{
+    model.AddLayer(new Input(12, 12, 1));
+    model.AddLayer(new Convolution(4, 3, 0, 1, "linear"));
+    model.AddLayer(new BatchNorm("relu"));
+    model.AddLayer(new FullyConnected(32, "relu"));
+    model.AddLayer(new FullyConnected(10, "softmax"));
+
+    model.Create(1E-3f);
+    model.SetVerbose(false);
+}
+
+int main()
+{
+    const std::string modelFile = "checkpoint_test.model", checkpointFile = "checkpoint_test.checkpoint";
+    constexpr size_t frozenLayers = 3;
+
+    std::mt19937 generator(1);
+    std::vector<std::vector<float>> trainInput, validationInput;
+    std::vector<size_t> trainLabels, validationLabels;
+
+    RandomSamples(200, 12 * 12, generator, trainInput, trainLabels);
+    RandomSamples(50, 12 * 12, generator, validationInput, validationLabels);
+
+    NeuralNetwork pretrained;
+    BuildNetwork(pretrained);
+    pretrained.Fit(1, trainInput, trainLabels, validationInput, validationLabels);
+    pretrained.SaveModel(modelFile);
+
+    //The fine tune is interrupted after its first epoch, which leaves its checkpoint behind.
+    std::filesystem::remove(checkpointFile);
+
+    NeuralNetwork interrupted;
+    interrupted.LoadModel(modelFile);
+    interrupted.SetLearningRate(1E-3f);
+    interrupted.SetVerbose(false);
+    for (size_t layer = 1; layer < frozenLayers; layer++)
+        interrupted.SetFrozen(layer);
+    interrupted.SetCheckpoint(checkpointFile);
+    interrupted.Fit(1, trainInput, trainLabels, validationInput, validationLabels);
+
+    NeuralNetwork checkpoint;
+    checkpoint.LoadModel(checkpointFile);
+
+    NeuralNetwork resumed;
+    BuildNetwork(resumed);
+    for (size_t layer = 1; layer < frozenLayers; layer++)
+        resumed.SetFrozen(layer);
+    resumed.ResumeFit(checkpointFile, 3, trainInput, trainLabels, validationInput, validationLabels);
+
+    const size_t identical = resumed.IdenticalLayers(checkpoint);
+    const bool passed = identical >= frozenLayers && identical < resumed.LayerCount();
+
+    std::cout << std::format("Resumed network - {} of {} leading layers unchanged, {} frozen\n", identical, resumed.LayerCount(), frozenLayers);
+    std::cout << (passed ? "Passed\n" : "Failed\n");
+
+    std::filesystem::remove(modelFile);
+    std::filesystem::remove(checkpointFile);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,253 @@
+#include "DataParallel.h"
+
+#include <iostream>
+#include <algorithm>
+
+RingAllReduce::RingAllReduce(size_t rank, size_t worldSize, uint16_t basePort, const std::string& host) :
+    rank(rank), worldSize(worldSize)
+{
+    if (rank >= worldSize) {
+        std::cout << "Error RingAllReduce(), rank " << rank << " is not smaller than the world size " << worldSize << '\n';
+        exit(1);
+    }
+
+    if (worldSize == 1)
+        return;
+
+    //Listen before connecting, so the previous rank can connect to this process while it is connecting to the next.
+    Socket listener = Socket::Listen(static_cast<uint16_t>(basePort + rank), host == "127.0.0.1");
+
+    next = Socket::Connect(host, static_cast<uint16_t>(basePort + (rank + 1) % worldSize), std::chrono::seconds(60));
+    previous = listener.Accept();
+
+    if (!next.IsValid() || !previous.IsValid()) {
+        std::cout << "Error RingAllReduce(), rank " << rank << " could not connect to its neighbours in the ring\n";
+        exit(1);
+    }
+
+    sender = std::thread(&RingAllReduce::RunSender, this);
+}
+
+RingAllReduce::~RingAllReduce()
+{
+    if (sender.joinable()) {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+
+        sendPosted.notify_one();
+        sender.join();
+    }
+}
+
+void RingAllReduce::AllReduce(std::span<float> data)
+{
+    if (worldSize == 1 || data.empty())
+        return;
+
+    const size_t chunkSize = (data.size() + worldSize - 1) / worldSize;
+    Reserve(data.size());
+
+    auto chunk = [&](size_t index) {
+        const size_t begin = std::min((index % worldSize) * chunkSize, data.size());
+        return data.subspan(begin, std::min(chunkSize, data.size() - begin));
+    };
+
+    //Reduce scatter, after it this rank holds the complete sum of chunk rank + 1.
+    for (size_t step = 0; step < worldSize - 1; step++) {
+        auto send = chunk(rank + worldSize - step);
+        auto receive = chunk(rank + worldSize - step - 1);
+
+        PostSend(send.data(), send.size());
+
+        if (!previous.Receive(receiveBuffer.data(), receive.size() * sizeof(float))) {
+            std::cout << "Error AllReduce(), rank " << rank << " lost the connection to the previous rank\n";
+            exit(1);
+        }
+
+        WaitSend();
+
+        for (size_t i = 0; i < receive.size(); i++)
+            receive[i] += receiveBuffer[i];
+    }
+
+    //All gather, pass the summed chunks around the ring.
+    for (size_t step = 0; step < worldSize - 1; step++) {
+        auto send = chunk(rank + worldSize - step + 1);
+        auto receive = chunk(rank + worldSize - step);
+
+        PostSend(send.data(), send.size());
+
+        if (!previous.Receive(receive.data(), receive.size() * sizeof(float))) {
+            std::cout << "Error AllReduce(), rank " << rank << " lost the connection to the previous rank\n";
+            exit(1);
+        }
+
+        WaitSend();
+    }
+}
+
+void RingAllReduce::Broadcast(std::span<float> data)
+{
+    if (rank != 0)
+        std::fill(data.begin(), data.end(), 0.f);
+
+    AllReduce(data);
+}
+
+void RingAllReduce::Reserve(size_t size)
+{
+    const size_t chunkSize = (size + worldSize - 1) / worldSize;
+
+    if (receiveBuffer.size() < chunkSize)
+        receiveBuffer.resize(chunkSize);
+}
+
+void RingAllReduce::PostSend(const float* data, size_t size)
+{
+    {
+        std::lock_guard lock(mutex);
+        sendData = data;
+        sendSize = size;
+        sending = true;
+    }
+
+    sendPosted.notify_one();
+}
+
+void RingAllReduce::WaitSend()
+{
+    std::unique_lock lock(mutex);
+    sendDone.wait(lock, [this]() { return !sending; });
+}
+
+void RingAllReduce::RunSender()
+{
+    std::unique_lock lock(mutex);
+
+    while (true) {
+        sendPosted.wait(lock, [this]() { return sending || stopping; });
+
+        if (stopping)
+            return;
+
+        lock.unlock();
+
+        if (!next.Send(sendData, sendSize * sizeof(float))) {
+            std::cout << "Error AllReduce(), rank " << rank << " lost the connection to the next rank\n";
+            exit(1);
+        }
+
+        lock.lock();
+        sending = false;
+        sendDone.notify_one();
+    }
+}
+
+GradientAllReduce::GradientAllReduce(RingAllReduce& ring, const std::vector<NeuralLayer*>& layers, size_t bucketSize) :
+    ring(ring), completesBucket(layers.size(), -1)
+{
+    Bucket bucket;
+    size_t lastLayer = 0;
+
+    //Backpropogation goes from the last layer to the first one, so the buckets are filled in that order.
+    for (size_t i = layers.size(); i-- > 0;) {
+        for (auto gradients : layers[i]->Gradients()) {
+            if (!gradients.empty())
+                bucket.gradients.push_back(gradients);
+        }
+
+        lastLayer = i;
+
+        size_t size = 0;
+        for (const auto& gradients : bucket.gradients)
+            size += gradients.size();
+
+        if (size * sizeof(float) >= bucketSize) {
+            bucket.buffer.assign(size, 0.f);
+            ring.Reserve(size);
+            completesBucket[i] = static_cast<ptrdiff_t>(buckets.size());
+            buckets.push_back(std::move(bucket));
+            bucket = Bucket();
+        }
+    }
+
+    if (!bucket.gradients.empty()) {
+        size_t size = 0;
+        for (const auto& gradients : bucket.gradients)
+            size += gradients.size();
+
+        bucket.buffer.assign(size, 0.f);
+        ring.Reserve(size);
+        completesBucket[lastLayer] = static_cast<ptrdiff_t>(buckets.size());
+        buckets.push_back(std::move(bucket));
+    }
+
+    worker = std::thread(&GradientAllReduce::Run, this);
+}
+
+GradientAllReduce::~GradientAllReduce()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+
+    bucketReady.notify_one();
+    worker.join();
+}
+
+void GradientAllReduce::LayerDone(size_t layer)
+{
+    if (completesBucket[layer] < 0)
+        return;
+
+    {
+        std::lock_guard lock(mutex);
+        readyBuckets++;
+    }
+
+    bucketReady.notify_one();
+}
+
+void GradientAllReduce::Wait()
+{
+    std::unique_lock lock(mutex);
+    bucketReduced.wait(lock, [this]() { return reducedBuckets == buckets.size(); });
+
+    readyBuckets = 0;
+    reducedBuckets = 0;
+}
+
+void GradientAllReduce::Run()
+{
+    std::unique_lock lock(mutex);
+
+    while (true) {
+        bucketReady.wait(lock, [this]() { return readyBuckets > reducedBuckets || stopping; });
+
+        if (stopping)
+            return;
+
+        Bucket& bucket = buckets[reducedBuckets];
+        lock.unlock();
+
+        //The gradients of a bucket are copied into one buffer, so small gradients like the biases do not need a pass around the ring of their own.
+        auto position = bucket.buffer.begin();
+        for (const auto& gradients : bucket.gradients)
+            position = std::copy(gradients.begin(), gradients.end(), position);
+
+        ring.AllReduce(bucket.buffer);
+
+        position = bucket.buffer.begin();
+        for (auto& gradients : bucket.gradients) {
+            std::copy(position, position + gradients.size(), gradients.begin());
+            position += gradients.size();
+        }
+
+        lock.lock();
+        reducedBuckets++;
+        bucketReduced.notify_one();
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "NeuralLayer.h"
+#include "Socket.h"
+
+#include <vector>
+#include <span>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+* Sums buffers over several processes that are connected in a ring, every process connects to the next rank and is connected to by the previous one.
+* The buffer is split into one chunk per process, the chunks are first summed while they are passed around the ring (reduce scatter),
+* after which the summed chunks are passed around once more (all gather). Every process sends and receives 2 * (worldSize - 1) / worldSize of the buffer.
+* Rank r listens on basePort + r, so all processes can run on the same machine.
+*/
+class RingAllReduce
+{
+public:
+    RingAllReduce(size_t rank, size_t worldSize, uint16_t basePort, const std::string& host = "127.0.0.1");
+    ~RingAllReduce();
+
+    //Replaces the data by the sum of the data of all processes.
+    void AllReduce(std::span<float> data);
+
+    //Replaces the data by the data of rank 0.
+    void Broadcast(std::span<float> data);
+
+    //Makes sure buffers of the given size can be reduced without allocating memory.
+    void Reserve(size_t size);
+
+    const size_t rank, worldSize;
+
+private:
+    //Sending happens on its own thread, so a process can send to the next rank and receive from the previous one at the same time.
+    void PostSend(const float* data, size_t size);
+    void WaitSend();
+    void RunSender();
+
+    Socket next, previous;
+    std::vector<float> receiveBuffer;
+
+    std::thread sender;
+    std::mutex mutex;
+    std::condition_variable sendPosted, sendDone;
+    const float* sendData = nullptr;
+    size_t sendSize = 0;
+    bool sending = false, stopping = false;
+};
+
+/*
+* Averages the gradients of the layers of a network over all processes, while the network is still backpropogating.
+* The gradients are grouped into buckets of at least bucketSize bytes, in the order in which backpropogation finishes them, thus starting at the last layer.
+* As soon as the last layer of a bucket is done, the bucket is reduced on a background thread, while the earlier layers are still backpropogating.
+*/
+class GradientAllReduce
+{
+public:
+    GradientAllReduce(RingAllReduce& ring, const std::vector<NeuralLayer*>& layers, size_t bucketSize = 32 * 1024);
+    ~GradientAllReduce();
+
+    //Is called after BackPropogate of the layer with the given index, on steps where the gradients are synchronized.
+    void LayerDone(size_t layer);
+
+    //Waits until all the buckets of this step are summed over all processes.
+    void Wait();
+
+private:
+    struct Bucket
+    {
+        std::vector<std::span<float>> gradients;
+        std::vector<float> buffer;
+    };
+
+    void Run();
+
+    RingAllReduce& ring;
+    std::vector<Bucket> buckets;
+
+    //For every layer, the index of the bucket that is complete once that layer is done, or -1.
+    std::vector<ptrdiff_t> completesBucket;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable bucketReady, bucketReduced;
+    size_t readyBuckets = 0, reducedBuckets = 0;
+    bool stopping = false;
+};
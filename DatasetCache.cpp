@@ -0,0 +1,376 @@
+#include "DatasetCache.h"
+#include "MNISTreader.h"
+#include "common.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <format>
+#include <bit>
+#include <limits>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+
+static bool MapFile(const std::string& fileName, const void*& data, size_t& size, intptr_t& file, intptr_t& mapping)
+{
+    HANDLE fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(fileHandle, &fileSize);
+    size = static_cast<size_t>(fileSize.QuadPart);
+    file = reinterpret_cast<intptr_t>(fileHandle);
+
+    if (size == 0)
+        return true;
+
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr)
+        return false;
+
+    mapping = reinterpret_cast<intptr_t>(mappingHandle);
+    data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+    return data != nullptr;
+}
+
+static void UnmapFile(const void* data, size_t size, intptr_t file, intptr_t mapping)
+{
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping != -1)
+        CloseHandle(reinterpret_cast<HANDLE>(mapping));
+    if (file != -1)
+        CloseHandle(reinterpret_cast<HANDLE>(file));
+}
+
+static void ReadAhead(const void* data, size_t size)
+{
+    WIN32_MEMORY_RANGE_ENTRY range{ const_cast<void*>(data), size };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+//Unlocking pages that are not locked removes them from the working set of the process.
+static void Release(const void* data, size_t size)
+{
+    VirtualUnlock(const_cast<void*>(data), size);
+}
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//The mapping stays valid after the file is closed, so no handles are kept.
+static bool MapFile(const std::string& fileName, const void*& data, size_t& size, intptr_t& file, intptr_t& mapping)
+{
+    const int descriptor = open(fileName.c_str(), O_RDONLY);
+    if (descriptor == -1)
+        return false;
+
+    struct stat status;
+    fstat(descriptor, &status);
+    size = static_cast<size_t>(status.st_size);
+
+    if (size != 0) {
+        void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+        data = address == MAP_FAILED ? nullptr : address;
+
+        if (data != nullptr)
+            madvise(address, size, MADV_SEQUENTIAL);
+    }
+
+    close(descriptor);
+
+    return size == 0 || data != nullptr;
+}
+
+static void UnmapFile(const void* data, size_t size, intptr_t, intptr_t)
+{
+    if (data != nullptr)
+        munmap(const_cast<void*>(data), size);
+}
+
+static void ReadAhead(const void* data, size_t size)
+{
+    madvise(const_cast<void*>(data), size, MADV_WILLNEED);
+}
+
+static void Release(const void* data, size_t size)
+{
+    madvise(const_cast<void*>(data), size, MADV_DONTNEED);
+}
+#endif
+
+static std::string ShardFileName(const std::string& directory, size_t shard)
+{
+    return (std::filesystem::path(directory) / std::format("shard-{:05}.bin", shard)).string();
+}
+
+static std::string IndexFileName(const std::string& directory)
+{
+    return (std::filesystem::path(directory) / "index.bin").string();
+}
+
+DatasetCache::DatasetCache(const std::string& directory, bool verify)
+{
+    std::ifstream file(IndexFileName(directory), std::ios::binary);
+
+    if (!file.is_open()) {
+        std::cout << "Error, could not open the dataset cache: " << directory << '\n';
+        exit(1);
+    }
+
+    size_t magic = 0, version = 0, size = 0, shardCount = 0;
+    file.read((char*)&magic, sizeof(magic));
+    file.read((char*)&version, sizeof(version));
+
+    if (magic != indexMagic || version > indexVersion) {
+        std::cout << "Error, " << directory << " is not a dataset cache of a supported version\n";
+        exit(1);
+    }
+
+    file.read((char*)&width, sizeof(width));
+    file.read((char*)&height, sizeof(height));
+    file.read((char*)&channels, sizeof(channels));
+    file.read((char*)&size, sizeof(size));
+    file.read((char*)&samplesPerShard, sizeof(samplesPerShard));
+    file.read((char*)&shardCount, sizeof(shardCount));
+
+    if (!file || samplesPerShard == 0 || shardCount != (size + samplesPerShard - 1) / samplesPerShard) {
+        std::cout << "Error, the index of the dataset cache: " << directory << " is corrupted\n";
+        exit(1);
+    }
+
+    shards.resize(shardCount);
+    for (auto& shard : shards)
+        file.read((char*)&shard.checksum, sizeof(shard.checksum));
+
+    //Version 1 stored the labels as size_t.
+    labels.resize(size);
+    if (version < 2) {
+        file.read((char*)labels.data(), size * sizeof(size_t));
+    }
+    else {
+        std::vector<uint32_t> storedLabels(size);
+        file.read((char*)storedLabels.data(), size * sizeof(uint32_t));
+        std::copy(storedLabels.begin(), storedLabels.end(), labels.begin());
+    }
+
+    if (!file) {
+        std::cout << "Error, the index of the dataset cache: " << directory << " is incomplete\n";
+        exit(1);
+    }
+
+    for (size_t i = 0; i < shards.size(); i++) {
+        const void* data = nullptr;
+        size_t bytes = 0;
+        const size_t expected = std::min(samplesPerShard, size - i * samplesPerShard) * SampleSize();
+
+        if (!MapFile(ShardFileName(directory, i), data, bytes, shards[i].file, shards[i].mapping) || bytes != expected * sizeof(float)) {
+            std::cout << "Error, shard " << i << " of the dataset cache: " << directory << " is missing or has the wrong size\n";
+            exit(1);
+        }
+
+        shards[i].data = static_cast<const float*>(data);
+        shards[i].size = expected;
+    }
+
+    if (!shards.empty())
+        ReadAhead(shards.front().data, shards.front().size * sizeof(float));
+
+    if (verify && !Verify()) {
+        std::cout << "Error, the dataset cache: " << directory << " is corrupted\n";
+        exit(1);
+    }
+}
+
+DatasetCache::~DatasetCache()
+{
+    for (auto& shard : shards)
+        UnmapFile(shard.data, shard.size * sizeof(float), shard.file, shard.mapping);
+}
+
+bool DatasetCache::Exists(const std::string& directory)
+{
+    return std::filesystem::exists(IndexFileName(directory));
+}
+
+std::span<const float> DatasetCache::Input(size_t n) const
+{
+    const size_t shard = n / samplesPerShard;
+
+    Stream(shard);
+
+    return { shards[shard].data + (n % samplesPerShard) * SampleSize(), SampleSize() };
+}
+
+/*
+* The first thread that reads from the next shard reads the shard after it ahead, and releases the shard before the previous one,
+* so at most three shards are resident while the samples are read in order. The previous shard is kept for threads that are slightly behind.
+*/
+void DatasetCache::Stream(size_t shard) const
+{
+    size_t previous = currentShard.load(std::memory_order_relaxed);
+
+    if (shard == previous || shard + 1 == previous || !currentShard.compare_exchange_strong(previous, shard, std::memory_order_relaxed))
+        return;
+
+    if (shard + 1 < shards.size())
+        ReadAhead(shards[shard + 1].data, shards[shard + 1].size * sizeof(float));
+
+    auto release = [this, shard](size_t index) {
+        if (index < shards.size() && index != shard && index != shard + 1)
+            Release(shards[index].data, shards[index].size * sizeof(float));
+    };
+
+    //When the reading jumped, for example to the start of the next epoch, the previous shard is not needed anymore either.
+    if (shard != previous + 1)
+        release(previous);
+
+    if (previous > 0)
+        release(previous - 1);
+}
+
+bool DatasetCache::Verify() const
+{
+    for (const auto& shard : shards) {
+        if (Checksum(shard.data, shard.size * sizeof(float)) != shard.checksum)
+            return false;
+
+        Release(shard.data, shard.size * sizeof(float));
+    }
+
+    return true;
+}
+
+//FNV-1a
+uint64_t DatasetCache::Checksum(const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+void DatasetCache::Convert(const std::string& imageFile, const std::string& labelFile, const std::string& directory, size_t samplesPerShard)
+{
+    if (samplesPerShard == 0) {
+        std::cout << "Error DatasetCache::Convert(), a shard has to contain at least one sample\n";
+        exit(1);
+    }
+
+    std::ifstream images(imageFile, std::ios::binary);
+
+    if (!images.is_open()) {
+        std::cout << "Error, could not open the given file: " << imageFile << '\n';
+        exit(1);
+    }
+
+    const auto labels = ReadIDXFileLabels(labelFile);
+
+    images.seekg(4);
+    uint32_t amount, height, width;
+
+    images.read(reinterpret_cast<char*>(&amount), 4);
+    images.read(reinterpret_cast<char*>(&height), 4);
+    images.read(reinterpret_cast<char*>(&width), 4);
+
+    amount = std::byteswap(amount);
+    height = std::byteswap(height);
+    width = std::byteswap(width);
+
+    if (amount != labels.size()) {
+        std::cout << "Error DatasetCache::Convert(), " << imageFile << " has " << amount << " images but " << labelFile << " has " << labels.size() << " labels\n";
+        exit(1);
+    }
+
+    std::vector<uint8_t> buffer(static_cast<size_t>(width) * height);
+
+    //The images are stored in order, so they are read while the shards are written.
+    Write(directory, width, height, 1, labels, [&](size_t, float* sample) {
+        images.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+        if (!images) {
+            std::cout << "Error DatasetCache::Convert(), " << imageFile << " is incomplete\n";
+            exit(1);
+        }
+
+        for (size_t i = 0; i < buffer.size(); i++)
+            sample[i] = static_cast<float>(buffer[i]) / 255.f;
+    }, samplesPerShard);
+}
+
+void DatasetCache::Write(const std::string& directory, size_t width, size_t height, size_t channels, const std::vector<size_t>& labels, const std::function<void(size_t, float*)>& produce, size_t samplesPerShard)
+{
+    if (samplesPerShard == 0) {
+        std::cout << "Error DatasetCache::Write(), a shard has to contain at least one sample\n";
+        exit(1);
+    }
+
+    for (size_t label : labels) {
+        if (label > std::numeric_limits<uint32_t>::max()) {
+            std::cout << "Error DatasetCache::Write(), label " << label << " does not fit in 32 bits\n";
+            exit(1);
+        }
+    }
+
+    std::filesystem::create_directories(directory);
+    std::filesystem::remove(IndexFileName(directory));
+
+    const size_t size = labels.size(), sampleSize = width * height * channels;
+    const size_t shardCount = (size + samplesPerShard - 1) / samplesPerShard;
+
+    std::vector<float> samples(samplesPerShard * sampleSize);
+    std::vector<uint64_t> checksums;
+
+    for (size_t i = 0; i < shardCount; i++) {
+        const size_t amount = std::min(samplesPerShard, size - i * samplesPerShard);
+
+        for (size_t j = 0; j < amount; j++)
+            produce(i * samplesPerShard + j, samples.data() + j * sampleSize);
+
+        std::ofstream shard = OpenTemporaryFile(ShardFileName(directory, i));
+        shard.write((const char*)samples.data(), amount * sampleSize * sizeof(float));
+
+        const std::string error = CommitTemporaryFile(shard, ShardFileName(directory, i));
+
+        if (!error.empty()) {
+            std::cout << "Error DatasetCache::Write(), could not write shard " << i << " of " << directory << " - " << error;
+            exit(1);
+        }
+
+        checksums.push_back(Checksum(samples.data(), amount * sampleSize * sizeof(float)));
+    }
+
+    const std::vector<uint32_t> storedLabels(labels.begin(), labels.end());
+
+    std::ofstream index = OpenTemporaryFile(IndexFileName(directory));
+
+    index.write((const char*)&indexMagic, sizeof(indexMagic));
+    index.write((const char*)&indexVersion, sizeof(indexVersion));
+    index.write((const char*)&width, sizeof(width));
+    index.write((const char*)&height, sizeof(height));
+    index.write((const char*)&channels, sizeof(channels));
+    index.write((const char*)&size, sizeof(size));
+    index.write((const char*)&samplesPerShard, sizeof(samplesPerShard));
+    index.write((const char*)&shardCount, sizeof(shardCount));
+    index.write((const char*)checksums.data(), checksums.size() * sizeof(uint64_t));
+    index.write((const char*)storedLabels.data(), storedLabels.size() * sizeof(uint32_t));
+
+    const std::string error = CommitTemporaryFile(index, IndexFileName(directory));
+
+    if (!error.empty()) {
+        std::cout << "Error DatasetCache::Write(), could not write the index of " << directory << " - " << error;
+        exit(1);
+    }
+}
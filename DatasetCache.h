@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+/*
+* A data set that is converted once to normalized floats and stored in shards on disk, which are memory mapped instead of read into memory.
+* The directory contains index.bin, with the shape of the samples, the checksums of the shards and all the labels as 32 bit integers, and the shards
+* shard-<n>.bin which contain the samples after each other. Every file is written to a temporary file first, and renamed when it is complete. Pages of the shards are only loaded when they are used, and while the samples are read in order
+* the next shard is read ahead and shards that were passed are released, so data sets larger than the memory can be trained on.
+*/
+class DatasetCache
+{
+public:
+    explicit DatasetCache(const std::string& directory, bool verify = false);
+    DatasetCache(const DatasetCache&) = delete;
+    DatasetCache& operator=(const DatasetCache&) = delete;
+    ~DatasetCache();
+
+    /*
+    * Converts the images and labels in IDX files to a cache in the given directory, the images are read one shard at a time.
+    * The index is written last, so an interrupted conversion does not leave a valid cache behind.
+    */
+    static void Convert(const std::string& imageFile, const std::string& labelFile, const std::string& directory, size_t samplesPerShard = 8192);
+
+    /*
+    * Writes a cache with the given labels, the samples are produced one at a time by calling produce(n, sample), so they never all have to be in memory.
+    */
+    static void Write(const std::string& directory, size_t width, size_t height, size_t channels, const std::vector<size_t>& labels, const std::function<void(size_t, float*)>& produce, size_t samplesPerShard = 8192);
+
+    static bool Exists(const std::string& directory);
+
+    //Can be called from any thread, the returned samples stay valid as long as the cache exists.
+    std::span<const float> Input(size_t n) const;
+
+    const std::vector<size_t>& Labels() const { return labels; }
+    size_t Size() const { return labels.size(); }
+    size_t SampleSize() const { return width * height * channels; }
+
+    //Reads all shards and compares their checksums to the index, returns false when a shard is corrupted.
+    bool Verify() const;
+
+    size_t width = 0, height = 0, channels = 0;
+
+private:
+    struct Shard
+    {
+        const float* data = nullptr;
+        size_t size = 0;
+        uint64_t checksum = 0;
+        intptr_t file = -1, mapping = -1;
+    };
+
+    //Gives the read ahead and release hints when the samples that are read move to the next shard.
+    void Stream(size_t shard) const;
+
+    static uint64_t Checksum(const void* data, size_t size);
+
+    //"CNNCACHE"
+    static constexpr size_t indexMagic = 0x45484341434E4E43;
+    static constexpr size_t indexVersion = 2;
+
+    std::vector<Shard> shards;
+    std::vector<size_t> labels;
+    size_t samplesPerShard = 0;
+
+    mutable std::atomic<size_t> currentShard{ 0 };
+};
@@ -0,0 +1,114 @@
+#include "Ensemble.h"
+
+#include <iostream>
+#include <format>
+#include <algorithm>
+
+Ensemble::Ensemble(const std::vector<std::string>& modelFiles, EnsembleCombination combination) :
+    combination(combination)
+{
+    if (modelFiles.empty()) {
+        std::cout << "Error Ensemble(), no model files are given\n";
+        exit(1);
+    }
+
+    for (const auto& fileName : modelFiles) {
+        Member member;
+        member.fileName = fileName;
+        member.network = std::make_unique<NeuralNetwork>();
+        member.network->LoadModel(fileName);
+
+        if (!members.empty() && (member.network->InputSize() != InputSize() || member.network->OutputSize() != OutputSize())) {
+            std::cout << "Error Ensemble(), the input or output size of " << fileName << " differs from that of " << members.front().fileName << '\n';
+            exit(1);
+        }
+
+        //The member with the most identical leading layers is the trunk. The last layer is always computed, so identical models still have their own outputs.
+        for (size_t i = 0; i < members.size(); i++) {
+            const size_t identical = std::min(member.network->IdenticalLayers(*members[i].network), member.network->LayerCount() - 1);
+
+            if (identical > member.sharedLayers) {
+                member.trunk = i;
+                member.sharedLayers = identical;
+            }
+        }
+
+        //When the trunk reads the last shared layer from its own trunk, that member computes it instead.
+        while (member.sharedLayers != 0 && member.sharedLayers <= members[member.trunk].sharedLayers)
+            member.trunk = members[member.trunk].trunk;
+
+        if (member.sharedLayers != 0)
+            member.network->ShareLayers(*members[member.trunk].network, member.sharedLayers);
+
+        members.push_back(std::move(member));
+    }
+}
+
+const std::vector<float>& Ensemble::Predict(std::span<const float> input)
+{
+    if (input.size() != InputSize()) {
+        std::cout << "Error Ensemble::Predict(), Given input is not the same size as the input of the models\n";
+        exit(1);
+    }
+
+    return PredictBatch(input.data(), 1);
+}
+
+const std::vector<float>& Ensemble::PredictBatch(const float* inputs, size_t batchSize)
+{
+    //The members that share layers read the outputs of their trunk, so all members have to use the same batch size.
+    if (this->batchSize != batchSize) {
+        for (auto& member : members)
+            member.network->SetBatchSize(batchSize);
+
+        this->batchSize = batchSize;
+    }
+
+    const size_t outputSize = OutputSize();
+    outputs.assign(batchSize * outputSize, 0.f);
+
+    for (auto& member : members) {
+        const auto& memberOutputs = member.sharedLayers == 0 ? member.network->PredictBatch(inputs, batchSize) : member.network->FeedForwardFrom(member.sharedLayers);
+
+        if (combination == EnsembleCombination::Average) {
+            for (size_t i = 0; i < outputs.size(); i++)
+                outputs[i] += memberOutputs[i];
+
+            continue;
+        }
+
+        for (size_t n = 0; n < batchSize; n++) {
+            const auto sample = memberOutputs.begin() + n * outputSize;
+            outputs[n * outputSize + std::distance(sample, std::max_element(sample, sample + outputSize))] += 1.f;
+        }
+    }
+
+    const float scale = 1.f / static_cast<float>(members.size());
+
+    for (auto& output : outputs)
+        output *= scale;
+
+    return outputs;
+}
+
+void Ensemble::PrintSharing() const
+{
+    size_t separateMACs = 0, ensembleMACs = 0;
+
+    for (size_t i = 0; i < members.size(); i++) {
+        const Member& member = members[i];
+        const size_t macs = member.network->ForwardMACs(), ownMACs = member.network->ForwardMACs(member.sharedLayers);
+
+        separateMACs += macs;
+        ensembleMACs += ownMACs;
+
+        if (member.sharedLayers == 0)
+            std::cout << std::format("Member {} {} - computes all {} layers, {} MACs\n", i, member.fileName, member.network->LayerCount(), macs);
+        else
+            std::cout << std::format("Member {} {} - reads the first {} layers from member {}, computes {} of {} MACs\n",
+                i, member.fileName, member.sharedLayers, member.trunk, ownMACs, macs);
+    }
+
+    std::cout << std::format("Ensemble of {} members - {} MACs per sample, {:.1f} % of running every member on its own\n",
+        members.size(), ensembleMACs, 100.0 * static_cast<double>(ensembleMACs) / static_cast<double>(std::max<size_t>(separateMACs, 1)));
+}
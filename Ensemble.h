@@ -0,0 +1,53 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+
+#include <vector>
+#include <string>
+#include <span>
+#include <memory>
+
+//Average averages the outputs of the members, Vote gives every class the fraction of the members that predict it.
+enum class EnsembleCombination { Average, Vote };
+
+/*
+* Predicts with several saved models at once, and combines their outputs. Leading layers that a member has in common with an earlier member,
+* with the same type, shape and weights, are not computed by the member but read from the member that computes them. So snapshots of a
+* model that was fine tuned with frozen layers only compute the frozen layers once. The input is copied into the first member only.
+* This is the only saving: the layers that differ are not batched together, every member feeds forward its own layers with the whole batch,
+* one member after the other. Independently trained members share no layers, and cost as much as running every model on its own.
+*/
+class Ensemble
+{
+public:
+    Ensemble(const std::vector<std::string>& modelFiles, EnsembleCombination combination = EnsembleCombination::Average);
+    Ensemble(const Ensemble&) = delete;
+    Ensemble& operator=(const Ensemble&) = delete;
+
+    const std::vector<float>& Predict(std::span<const float> input);
+
+    //The inputs and the returned outputs of the samples are stored after each other, as with NeuralNetwork::PredictBatch.
+    const std::vector<float>& PredictBatch(const float* inputs, size_t batchSize);
+
+    size_t InputSize() const { return members.front().network->InputSize(); }
+    size_t OutputSize() const { return members.front().network->OutputSize(); }
+
+    //Prints the layers every member shares, and the multiply adds of the ensemble compared to running every member on its own.
+    void PrintSharing() const;
+
+private:
+    struct Member
+    {
+        std::string fileName;
+        std::unique_ptr<NeuralNetwork> network;
+
+        //The member that computes the last shared layer, and the amount of shared layers. The first member shares nothing.
+        size_t trunk = 0, sharedLayers = 0;
+    };
+
+    std::vector<Member> members;
+    EnsembleCombination combination;
+    size_t batchSize = 0;
+
+    std::vector<float> outputs;
+};
@@ -0,0 +1,313 @@
+#include "InferenceServer.h"
+#include "common.h"
+
+#include <iostream>
+#include <format>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+#include <cmath>
+
+InferenceServer::InferenceServer(const std::string& modelFile, size_t maxBatchSize, std::chrono::microseconds maxDelay) :
+    maxBatchSize(std::max<size_t>(maxBatchSize, 1)), maxDelay(maxDelay)
+{
+    if (!std::filesystem::exists(modelFile)) {
+        std::cout << "Error, could not open model file: " << modelFile << '\n';
+        exit(1);
+    }
+
+    model.SetAutoTuning();
+    model.LoadModel(modelFile);
+    //The BatchNorm layers are folded into the layers before them, so serving does not pay for them.
+    model.FoldBatchNorm();
+
+    //Every batch size is tuned before serving, so no request waits for the tuning of its batch size.
+    for (size_t batchSize = 1; batchSize < this->maxBatchSize; batchSize++)
+        model.SetBatchSize(batchSize);
+
+    //Warm up with the largest batch, after that smaller batches reuse the same buffers.
+    model.SetBatchSize(this->maxBatchSize);
+
+    inputSize = model.InputSize();
+    outputSize = model.OutputSize();
+
+    batchInputs.assign(this->maxBatchSize * inputSize, 0.f);
+    batch.reserve(this->maxBatchSize);
+}
+
+void InferenceServer::Run(uint16_t port)
+{
+    Socket listener = Socket::Listen(port);
+
+    std::cout << std::format("Serving model with {} inputs and {} outputs on port {}, max batch size {}, max delay {}us\n", inputSize, outputSize, port, maxBatchSize, maxDelay.count());
+
+    {
+        std::lock_guard lock(mutex);
+        this->port = port;
+        connectionsClosed = false;
+    }
+
+    lastReport = std::chrono::steady_clock::now();
+    std::thread batchThread(&InferenceServer::RunBatches, this);
+
+    bool acceptFailed = false;
+
+    while (true) {
+        Socket connection = listener.Accept();
+
+        std::unique_lock lock(mutex);
+
+        if (stopping)
+            break;
+
+        JoinFinishedConnections();
+
+        //Accept fails for example when the process runs out of file descriptors, so it is retried after a pause instead of right away.
+        if (!connection.IsValid()) {
+            if (!acceptFailed)
+                std::cout << "Error, could not accept a connection, retrying until it succeeds again\n";
+
+            acceptFailed = true;
+
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        acceptFailed = false;
+
+        Connection& added = connections.emplace_back();
+        added.socket = std::move(connection);
+        added.thread = std::thread([this, &added]() {
+            HandleConnection(added.socket);
+
+            std::lock_guard lock(mutex);
+            added.finished = true;
+        });
+    }
+
+    //A connection that waits for its answer gets it from the batch thread, which keeps running until all connections are closed.
+    {
+        std::lock_guard lock(mutex);
+
+        for (auto& connection : connections)
+            connection.socket.Shutdown();
+    }
+
+    for (auto& connection : connections)
+        connection.thread.join();
+
+    connections.clear();
+
+    {
+        std::lock_guard lock(mutex);
+        connectionsClosed = true;
+    }
+
+    requestQueued.notify_all();
+    batchThread.join();
+}
+
+void InferenceServer::Stop()
+{
+    uint16_t listening;
+
+    {
+        std::lock_guard lock(mutex);
+
+        if (stopping)
+            return;
+
+        stopping = true;
+        listening = port;
+    }
+
+    //Accept blocks until a connection arrives, so the server connects to itself to wake it up.
+    Socket::Connect("127.0.0.1", listening, std::chrono::seconds(1));
+}
+
+//Called with the mutex locked, the threads of finished connections only have to return.
+void InferenceServer::JoinFinishedConnections()
+{
+    for (auto connection = connections.begin(); connection != connections.end();) {
+        if (connection->finished) {
+            connection->thread.join();
+            connection = connections.erase(connection);
+        }
+        else {
+            ++connection;
+        }
+    }
+}
+
+void InferenceServer::HandleConnection(const Socket& connection)
+{
+    const uint32_t sizes[2] = { static_cast<uint32_t>(inputSize), static_cast<uint32_t>(outputSize) };
+
+    if (!connection.Send(sizes, sizeof(sizes)))
+        return;
+
+    std::vector<float> input(inputSize), output(outputSize);
+
+    while (connection.Receive(input.data(), inputSize * sizeof(float))) {
+        Request request{ input.data(), output.data(), std::chrono::steady_clock::now() };
+
+        {
+            std::unique_lock lock(mutex);
+            queue.push_back(&request);
+            requestQueued.notify_one();
+
+            requestDone.wait(lock, [&request]() { return request.done; });
+        }
+
+        if (!connection.Send(output.data(), outputSize * sizeof(float)))
+            return;
+    }
+}
+
+void InferenceServer::RunBatches()
+{
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+
+            requestQueued.wait(lock, [this]() { return !queue.empty() || connectionsClosed; });
+
+            if (queue.empty())
+                return;
+
+            //Wait for the batch to fill up, but never longer than the max delay after the oldest request arrived.
+            const auto deadline = queue.front()->arrival + maxDelay;
+            requestQueued.wait_until(lock, deadline, [this]() { return queue.size() >= maxBatchSize; });
+
+            const size_t size = std::min(queue.size(), maxBatchSize);
+            batch.assign(queue.begin(), queue.begin() + size);
+            queue.erase(queue.begin(), queue.begin() + size);
+        }
+
+        for (size_t b = 0; b < batch.size(); b++)
+            std::copy(batch[b]->input, batch[b]->input + inputSize, batchInputs.begin() + b * inputSize);
+
+        const auto& outputs = model.PredictBatch(batchInputs.data(), batch.size());
+
+        for (size_t b = 0; b < batch.size(); b++)
+            std::copy(outputs.begin() + b * outputSize, outputs.begin() + (b + 1) * outputSize, batch[b]->output);
+
+        const auto now = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard lock(mutex);
+
+            for (auto request : batch) {
+                latencies[LatencyBucket(std::chrono::duration<double, std::micro>(now - request->arrival).count())]++;
+                request->done = true;
+            }
+
+            requests += batch.size();
+            batches++;
+        }
+
+        requestDone.notify_all();
+
+        if (now - lastReport >= reportInterval)
+            Report(now);
+    }
+}
+
+void InferenceServer::Report(std::chrono::steady_clock::time_point now)
+{
+    std::lock_guard lock(mutex);
+
+    const double seconds = std::chrono::duration<double>(now - lastReport).count();
+
+    const double p50 = LatencyPercentile(50.0);
+    const double p99 = LatencyPercentile(99.0);
+
+    std::cout << std::format("Requests: {} - Throughput: {:.1f} req/s - Average batch: {:.2f} - Latency p50: {:.3f}ms p99: {:.3f}ms\n",
+        requests, static_cast<double>(requests) / seconds, batches ? static_cast<double>(requests) / static_cast<double>(batches) : 0.0, p50, p99);
+
+    latencies.fill(0);
+    requests = 0;
+    batches = 0;
+    lastReport = now;
+}
+
+//Latencies below a microsecond go to the first bucket, and those above the range to the last.
+size_t InferenceServer::LatencyBucket(double microseconds)
+{
+    const double bucket = std::log2(std::max(microseconds, 1.0)) * bucketsPerDoubling;
+
+    return std::min(static_cast<size_t>(bucket), latencyBuckets - 1);
+}
+
+//Returns the latency in milliseconds below which the given percentage of the requests since the last report finished.
+double InferenceServer::LatencyPercentile(double percentile) const
+{
+    if (requests == 0)
+        return 0.0;
+
+    const size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0 * static_cast<double>(requests)));
+    size_t counted = 0, bucket = 0;
+
+    for (; bucket + 1 < latencyBuckets; bucket++) {
+        counted += latencies[bucket];
+
+        if (counted >= std::max<size_t>(rank, 1))
+            break;
+    }
+
+    return std::exp2((static_cast<double>(bucket) + 0.5) / bucketsPerDoubling) / 1000.0;
+}
+
+void RunLoadGenerator(uint16_t port, size_t clients, size_t requestsPerClient, const std::vector<std::vector<float>>& inputs)
+{
+    std::vector<std::vector<double>> clientLatencies(clients);
+    std::vector<std::thread> threads;
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    for (size_t c = 0; c < clients; c++) {
+        threads.emplace_back([&, c]() {
+            Socket connection = Socket::Connect("127.0.0.1", port, std::chrono::seconds(5));
+            uint32_t sizes[2];
+
+            if (!connection.IsValid() || !connection.Receive(sizes, sizeof(sizes))) {
+                std::cout << "Error, could not connect to the inference server on port: " << port << '\n';
+                exit(1);
+            }
+
+            if (inputs.empty() || inputs.front().size() != sizes[0]) {
+                std::cout << "Error, the inputs are not the same size as the input of the served model\n";
+                exit(1);
+            }
+
+            std::vector<float> output(sizes[1]);
+            auto& latencies = clientLatencies[c];
+            latencies.reserve(requestsPerClient);
+
+            for (size_t n = 0; n < requestsPerClient; n++) {
+                const auto& input = inputs[(c * requestsPerClient + n) % inputs.size()];
+                const auto sent = std::chrono::steady_clock::now();
+
+                if (!connection.Send(input.data(), input.size() * sizeof(float)) || !connection.Receive(output.data(), output.size() * sizeof(float))) {
+                    std::cout << "Error, the connection to the inference server was closed\n";
+                    exit(1);
+                }
+
+                latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count());
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::vector<double> latencies;
+    for (const auto& client : clientLatencies)
+        latencies.insert(latencies.end(), client.begin(), client.end());
+
+    std::cout << std::format("Clients: {} - Requests: {} - Throughput: {:.1f} req/s - Latency p50: {:.3f}ms p99: {:.3f}ms\n",
+        clients, latencies.size(), static_cast<double>(latencies.size()) / seconds, Percentile(latencies, 50.0), Percentile(latencies, 99.0));
+}
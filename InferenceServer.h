@@ -0,0 +1,100 @@
+#pragma once
+
+#include "NeuralNetwork.h"
+#include "Socket.h"
+
+#include <vector>
+#include <deque>
+#include <list>
+#include <array>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/*
+* Serves a saved model on a TCP port of the loopback interface. Concurrent requests are coalesced into micro batches,
+* a batch is run as soon as it holds maxBatchSize requests, or when its oldest request has waited for maxDelay.
+* Every few seconds the throughput, the average batch size and the p50/p99 latency of the requests are reported.
+* The layers are tuned for every batch size up to maxBatchSize at startup, with the tuning cache tuning.cache in the working directory.
+*
+* After connecting, the server sends the input and output size of the model as two uint32_t values.
+* Then the client sends requests of input size floats, and the server answers every request with output size floats.
+*/
+class InferenceServer
+{
+public:
+    InferenceServer(const std::string& modelFile, size_t maxBatchSize = 32, std::chrono::microseconds maxDelay = std::chrono::microseconds(500));
+
+    /*
+    * Serves requests until Stop is called. Then the connections are closed, the requests that were received are still answered,
+    * and Run returns when all threads of the server have finished.
+    */
+    void Run(uint16_t port);
+
+    //Can be called from any thread while Run serves requests.
+    void Stop();
+
+private:
+    struct Request
+    {
+        const float* input;
+        float* output;
+        std::chrono::steady_clock::time_point arrival;
+        bool done = false;
+    };
+
+    //Every connection is served by its own thread, the list keeps the connections in place while their threads refer to them.
+    struct Connection
+    {
+        Socket socket;
+        std::thread thread;
+        bool finished = false;
+    };
+
+    void HandleConnection(const Socket& connection);
+    void JoinFinishedConnections();
+    void RunBatches();
+    void Report(std::chrono::steady_clock::time_point now);
+
+    /*
+    * The latencies are counted in a histogram with 16 buckets for every doubling of the latency in microseconds, so the memory is fixed
+    * however many requests arrive between two reports. A percentile is reported as the middle of its bucket, within 2.2% of the real latency.
+    */
+    static constexpr size_t bucketsPerDoubling = 16, latencyBuckets = 28 * bucketsPerDoubling;
+    static size_t LatencyBucket(double microseconds);
+    double LatencyPercentile(double percentile) const;
+
+    NeuralNetwork model;
+    size_t inputSize, outputSize;
+    size_t maxBatchSize;
+    std::chrono::microseconds maxDelay;
+
+    std::mutex mutex;
+    std::condition_variable requestQueued, requestDone;
+    std::deque<Request*> queue;
+
+    uint16_t port = 0;
+    std::list<Connection> connections;
+
+    //Stop sets stopping, Run sets connectionsClosed when no more requests can arrive, after which the batch thread finishes.
+    bool stopping = false, connectionsClosed = false;
+
+    //Only used by the batch thread.
+    std::vector<float> batchInputs;
+    std::vector<Request*> batch;
+
+    //Statistics since the last report.
+    std::array<size_t, latencyBuckets> latencies{};
+    size_t requests = 0, batches = 0;
+    std::chrono::steady_clock::time_point lastReport;
+
+    static constexpr std::chrono::seconds reportInterval{ 5 };
+};
+
+/*
+* Opens the given amount of connections to an inference server, which each send requests one after the other,
+* cycling through the given inputs. Reports the throughput and the p50/p99 latency measured by the clients.
+*/
+void RunLoadGenerator(uint16_t port, size_t clients, size_t requestsPerClient, const std::vector<std::vector<float>>& inputs);
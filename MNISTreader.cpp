@@ -87,3 +87,36 @@ std::vector<std::vector<float>> ReadIDXFileData(const std::string& fileName)
 
     return imageSet;
 }
+
+void WriteIDXFileLabels(const std::string& fileName, const std::vector<size_t>& labels)
+{
+    std::ofstream file(fileName, std::ios::binary);
+
+    const uint32_t magic = std::byteswap(0x00000801u), amount = std::byteswap(static_cast<uint32_t>(labels.size()));
+
+    file.write(reinterpret_cast<const char*>(&magic), 4);
+    file.write(reinterpret_cast<const char*>(&amount), 4);
+
+    for (size_t label : labels)
+        file.put(static_cast<char>(label));
+
+    if (!file) {
+        std::cout << "Error, could not write the given file: " << fileName << '\n';
+        exit(1);
+    }
+}
+
+void WriteIDXFileData(const std::string& fileName, const std::vector<uint8_t>& images, uint32_t width, uint32_t height)
+{
+    std::ofstream file(fileName, std::ios::binary);
+
+    const uint32_t header[4] = { std::byteswap(0x00000803u), std::byteswap(static_cast<uint32_t>(images.size() / (width * height))), std::byteswap(height), std::byteswap(width) };
+
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(images.data()), images.size());
+
+    if (!file) {
+        std::cout << "Error, could not write the given file: " << fileName << '\n';
+        exit(1);
+    }
+}
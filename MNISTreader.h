@@ -4,9 +4,14 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
 
 
 DataSet ReadMNISTDataSet(const std::string& trainData, const std::string& trainLabels, const std::string& validationData, const std::string& validationLabels);
 
 std::vector<size_t> ReadIDXFileLabels(const std::string& fileName);
-std::vector<std::vector<float>> ReadIDXFileData(const std::string& fileName);
\ No newline at end of file
+std::vector<std::vector<float>> ReadIDXFileData(const std::string& fileName);
+
+//Writes the labels, or the images of width by height bytes stored after each other, in the IDX format of MNIST.
+void WriteIDXFileLabels(const std::string& fileName, const std::vector<size_t>& labels);
+void WriteIDXFileData(const std::string& fileName, const std::vector<uint8_t>& images, uint32_t width, uint32_t height);
@@ -0,0 +1,113 @@
+#include "MachineProfile.h"
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+* Multiply adds on a few independent values, so they are not limited by the latency of a single chain and the loop is vectorized.
+* The values stay in registers, so this measures the throughput the compiled layers can reach instead of the theoretical peak of the processor.
+*/
+static double MeasurePeakFlops()
+{
+    constexpr size_t lanes = 32, repeats = 1 << 21;
+    float values[lanes];
+    const float scale = 0.999999f, offset = 1E-7f;
+    double best = 0.0;
+
+    std::fill(values, values + lanes, 1.f);
+
+    for (size_t attempt = 0; attempt < 3; attempt++) {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (size_t r = 0; r < repeats; r++) {
+            for (size_t i = 0; i < lanes; i++)
+                values[i] = values[i] * scale + offset;
+        }
+
+        best = std::max(best, 2.0 * lanes * repeats / Seconds(start));
+    }
+
+    //Uses the result, so the loop is not removed.
+    volatile float sink = values[0];
+    (void)sink;
+
+    return best;
+}
+
+static double MeasureBandwidth()
+{
+    constexpr size_t bytes = size_t(1) << 27;
+    std::vector<uint64_t> buffer(bytes / sizeof(uint64_t), 1);
+    double best = 0.0;
+    uint64_t sum = 0;
+
+    for (size_t attempt = 0; attempt < 3; attempt++) {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (uint64_t value : buffer)
+            sum += value;
+
+        best = std::max(best, bytes / Seconds(start));
+    }
+
+    volatile uint64_t sink = sum;
+    (void)sink;
+
+    return best;
+}
+
+const MachineProfile& MachineProfile::Get()
+{
+    static const MachineProfile profile{ MeasurePeakFlops(), MeasureBandwidth() };
+
+    return profile;
+}
+
+std::string MachineProfile::ProcessorName()
+{
+    //The brand string is returned in 16 byte parts by the extended cpuid leaves 0x80000002 to 0x80000004.
+    char name[49] = {};
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int registers[4];
+    __cpuid(registers, 0x80000000);
+
+    if (static_cast<unsigned int>(registers[0]) >= 0x80000004) {
+        for (int i = 0; i < 3; i++) {
+            __cpuid(registers, 0x80000002 + i);
+            std::memcpy(name + 16 * i, registers, sizeof(registers));
+        }
+    }
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned int registers[4];
+
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+        for (unsigned int i = 0; i < 3; i++) {
+            __get_cpuid(0x80000002 + i, &registers[0], &registers[1], &registers[2], &registers[3]);
+            std::memcpy(name + 16 * i, registers, sizeof(registers));
+        }
+    }
+#endif
+
+    std::string processor(name);
+    const size_t first = processor.find_first_not_of(' '), last = processor.find_last_not_of(' ');
+
+    if (first == std::string::npos)
+        return "unknown";
+
+    return processor.substr(first, last - first + 1);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+/*
+* The peak floating point throughput and memory bandwidth of a single core, measured once by small benchmarks the first time they are needed.
+* The layers run on a single thread, so a single core is measured. Used for the roofline estimates of NeuralNetwork::PrintSummary.
+*/
+struct MachineProfile
+{
+    //Floating point operations per second, a multiply add counts as two operations.
+    double peakFlops = 0.0;
+
+    //Bytes per second read from a buffer that is much larger than the caches.
+    double bandwidth = 0.0;
+
+    static const MachineProfile& Get();
+
+    //The brand string of the processor, or "unknown" when it can not be queried.
+    static std::string ProcessorName();
+};
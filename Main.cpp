@@ -1,9 +1,350 @@
 #include "NeuralNetwork.h"
 #include "common.h"
 #include "MNISTreader.h"
+#include "InferenceServer.h"
+#include "DataParallel.h"
+#include "DatasetCache.h"
+#include "WorkStealingPool.h"
+#include "Numa.h"
+#include "Sweep.h"
+#include "Benchmark.h"
+#include "BatchInference.h"
+#include "Ensemble.h"
 
-int main()
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <format>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+#include <thread>
+
+/*
+* Without arguments the example model is trained, with resume it continues from the checkpoint of an interrupted run. The tools are started with:
+*   serve <model file> [port] [max batch size] [max delay in us] [threads per layer]
+*   loadgen [port] [clients] [requests per client]
+*   distributed <rank> <world size> [base port]
+*   numa <model file> [node] [local | interleaved]
+*   prune <model file> <sparsity> [epochs]
+*   cache <image file> <label file> <cache directory> [samples per shard]
+*   sweep <search space file>
+*   benchmark [mnist | synthetic] [json file] [max epochs]
+*   score <model file> <input file> <output csv file> [idx | u8 | f32] [threads] [batch size] [chunk size]
+*   earlyexit [epochs] [model file]
+*   ensemble <average | vote> <model file> <model file> [more model files]
+*/
+int main(int argc, char* argv[])
 {
+    const std::vector<std::string> arguments(argv + 1, argv + argc);
+
+    auto argument = [&arguments](size_t index, size_t defaultValue) {
+        return index < arguments.size() ? std::stoull(arguments[index]) : defaultValue;
+    };
+
+    if (!arguments.empty() && arguments[0] == "serve") {
+        if (arguments.size() < 2) {
+            std::cout << "Usage: serve <model file> [port] [max batch size] [max delay in us] [threads per layer]\n";
+            return 1;
+        }
+
+        //Splitting the layers over the cores lowers the latency of requests that are not batched.
+        WorkStealingPool::SetThreads(argument(5, 1));
+
+        InferenceServer server(arguments[1], argument(3, 32), std::chrono::microseconds(argument(4, 500)));
+
+        //Typing quit stops the server after it answered the requests it received.
+        std::thread input([&server]() {
+            std::string line;
+
+            while (std::getline(std::cin, line)) {
+                if (line == "quit") {
+                    server.Stop();
+                    return;
+                }
+            }
+        });
+
+        server.Run(static_cast<uint16_t>(argument(2, 7878)));
+        input.join();
+
+        return 0;
+    }
+
+    //Data parallel training of the example model, start one process for every rank on this machine.
+    if (!arguments.empty() && arguments[0] == "distributed") {
+        if (arguments.size() < 3) {
+            std::cout << "Usage: distributed <rank> <world size> [base port]\n";
+            return 1;
+        }
+
+        const size_t rank = argument(1, 0);
+
+        //The ranks are spread over the NUMA nodes, the ring and the network are created after pinning so all their memory is on the node of the rank.
+        PinThreadToNode(rank % NumaNodeCount());
+
+        RingAllReduce ring(rank, argument(2, 1), static_cast<uint16_t>(argument(3, 7900)));
+
+        NeuralNetwork model;
+        model.AddLayer(new Input(28, 28, 1));
+        model.AddLayer(new FullyConnected(128, "relu"));
+        model.AddLayer(new FullyConnected(64, "relu"));
+        model.AddLayer(new FullyConnected(64, "relu"));
+        model.AddLayer(new FullyConnected(10, "softmax"));
+
+        //The gradients are averaged over 8 samples per process, so the learning rate is higher than for per sample training.
+        model.Create(1E-2f, 0.1f);
+        model.SetDataParallel(ring, 8);
+
+        if (rank == 0)
+            model.PrintSummary();
+
+        DataSet dataSet = ReadMNISTDataSet("dataset/train-images.idx3-ubyte", "dataset/train-labels.idx1-ubyte", "dataset/t10k-images.idx3-ubyte", "dataset/t10k-labels.idx1-ubyte");
+        model.Fit(10, dataSet);
+
+        if (rank == 0)
+            model.SaveModel("distributed.model");
+
+        return 0;
+    }
+
+    //Places a trained model on a NUMA node, and shows how many of the memory loads of every layer are served by a remote node.
+    if (!arguments.empty() && arguments[0] == "numa") {
+        if (arguments.size() < 2 || (arguments.size() > 3 && arguments[3] != "local" && arguments[3] != "interleaved")) {
+            std::cout << "Usage: numa <model file> [node] [local | interleaved]\n";
+            return 1;
+        }
+
+        const size_t node = argument(2, 0);
+        const WeightPlacement placement = arguments.size() > 3 && arguments[3] == "interleaved" ? WeightPlacement::Interleaved : WeightPlacement::Local;
+
+        if (node >= NumaNodeCount()) {
+            std::cout << std::format("Error, node {} does not exist, this machine has {} nodes\n", node, NumaNodeCount());
+            return 1;
+        }
+
+        NeuralNetwork model;
+        model.LoadModel(arguments[1]);
+
+        if (!model.PlaceOnNode(node, placement))
+            std::cout << "The pages of the model could not all be moved, the counts include pages on other nodes\n";
+
+        DataSet dataSet = ReadMNISTDataSet("dataset/train-images.idx3-ubyte", "dataset/train-labels.idx1-ubyte", "dataset/t10k-images.idx3-ubyte", "dataset/t10k-labels.idx1-ubyte");
+        model.PrintMemoryAccess(dataSet.trainInput, dataSet.trainLabels);
+
+        return 0;
+    }
+
+    //Fine tunes a trained model while pruning it, and compares the dense and sparse inference of the pruned model.
+    if (!arguments.empty() && arguments[0] == "prune") {
+        if (arguments.size() < 3) {
+            std::cout << "Usage: prune <model file> <sparsity> [epochs]\n";
+            return 1;
+        }
+
+        const float sparsity = std::stof(arguments[2]);
+        const size_t epochs = argument(3, 4);
+
+        NeuralNetwork model;
+        model.LoadModel(arguments[1]);
+        model.SetLearningRate(1E-4f);
+        model.SetPruning(sparsity, std::max<size_t>(epochs / 2, 1));
+
+        DataSet dataSet = ReadMNISTDataSet("dataset/train-images.idx3-ubyte", "dataset/train-labels.idx1-ubyte", "dataset/t10k-images.idx3-ubyte", "dataset/t10k-labels.idx1-ubyte");
+        model.Fit(epochs, dataSet);
+
+        auto measure = [&dataSet](NeuralNetwork& network, const char* name) {
+            const auto startTime = std::chrono::steady_clock::now();
+            const float accuracy = network.Accuracy(dataSet.validationInput, dataSet.validationLabels);
+            const std::chrono::duration<double, std::micro> elapsedTime = std::chrono::steady_clock::now() - startTime;
+
+            std::cout << std::format("{} - Accuracy: {:.2f} % - {:.2f} us per sample\n", name, accuracy * 100.f, elapsedTime.count() / static_cast<double>(dataSet.validationInput.size()));
+        };
+
+        model.SaveModel("pruned_dense.model");
+        measure(model, "Dense ");
+
+        model.ConvertToSparse(sparsity * 0.9f);
+        model.SaveModel("pruned.model");
+        measure(model, "Sparse");
+
+        model.PrintSummary();
+        std::cout << std::format("Model size: {} bytes dense, {} bytes sparse\n", std::filesystem::file_size("pruned_dense.model"), std::filesystem::file_size("pruned.model"));
+
+        return 0;
+    }
+
+    if (!arguments.empty() && arguments[0] == "cache") {
+        if (arguments.size() < 4) {
+            std::cout << "Usage: cache <image file> <label file> <cache directory> [samples per shard]\n";
+            return 1;
+        }
+
+        DatasetCache::Convert(arguments[1], arguments[2], arguments[3], argument(4, 8192));
+
+        DatasetCache cache(arguments[3]);
+        std::cout << std::format("Cached {} samples of {}x{} in {}, checksums {}\n", cache.Size(), cache.width, cache.height, arguments[3], cache.Verify() ? "verified" : "do not match");
+
+        return 0;
+    }
+
+    //Trains the configurations of a hyperparameter search concurrently, see SweepSpace for the format of the file.
+    if (!arguments.empty() && arguments[0] == "sweep") {
+        if (arguments.size() < 2) {
+            std::cout << "Usage: sweep <search space file>\n";
+            return 1;
+        }
+
+        const SweepSpace space = SweepSpace::Read(arguments[1]);
+        DataSet dataSet = ReadMNISTDataSet("dataset/train-images.idx3-ubyte", "dataset/train-labels.idx1-ubyte", "dataset/t10k-images.idx3-ubyte", "dataset/t10k-labels.idx1-ubyte");
+
+        Sweep sweep(dataSet, space);
+        sweep.Run();
+        sweep.PrintResults();
+
+        return 0;
+    }
+
+    //Reproducible training benchmarks of the example models, the synthetic data set is generated once with a fixed seed.
+    if (!arguments.empty() && arguments[0] == "benchmark") {
+        const std::string dataSetName = arguments.size() > 1 ? arguments[1] : "mnist";
+        const std::string outputFile = arguments.size() > 2 ? arguments[2] : "benchmark.json";
+        const std::string directory = dataSetName == "synthetic" ? "dataset/synthetic" : "dataset";
+
+        if (dataSetName == "synthetic" && !std::filesystem::exists(directory + "/train-images.idx3-ubyte"))
+            WriteSyntheticDataSet(directory, 60000, 10000, 1);
+
+        DataSet dataSet = ReadMNISTDataSet(directory + "/train-images.idx3-ubyte", directory + "/train-labels.idx1-ubyte", directory + "/t10k-images.idx3-ubyte", directory + "/t10k-labels.idx1-ubyte");
+
+        BenchmarkSettings settings;
+        settings.maxEpochs = argument(3, settings.maxEpochs);
+
+        std::ofstream output(outputFile);
+        RunBenchmarks(dataSet, dataSetName, settings, output);
+
+        std::cout << "Wrote the benchmark results to " << outputFile << '\n';
+
+        return 0;
+    }
+
+    //Scores a file of samples of any size with bounded memory.
+    if (!arguments.empty() && arguments[0] == "score") {
+        if (arguments.size() < 4) {
+            std::cout << "Usage: score <model file> <input file> <output csv file> [idx | u8 | f32] [threads] [batch size] [chunk size]\n";
+            return 1;
+        }
+
+        const std::string format = arguments.size() > 4 ? arguments[4] : "idx";
+
+        BatchInference inference(arguments[1], argument(5, 0), argument(6, 64), argument(7, 4096));
+        inference.Run(arguments[2], format == "u8" ? InputFormat::RawBytes : format == "f32" ? InputFormat::RawFloats : InputFormat::IDX, arguments[3]);
+
+        return 0;
+    }
+
+    //Trains the example model with exit heads after its first two hidden layers, and shows what every confidence threshold saves and costs.
+    if (!arguments.empty() && arguments[0] == "earlyexit") {
+        const std::string modelFile = arguments.size() > 2 ? arguments[2] : "earlyexit.model";
+
+        NeuralNetwork model;
+        model.AddLayer(new Input(28, 28, 1));
+        model.AddLayer(new FullyConnected(128, "relu"));
+        model.AddLayer(new FullyConnected(64, "relu"));
+        model.AddLayer(new FullyConnected(64, "relu"));
+        model.AddLayer(new FullyConnected(10, "softmax"));
+
+        model.Create(1E-4f, 0.1f);
+        model.AddExitHead(1);
+        model.AddExitHead(2);
+        model.PrintSummary();
+
+        DataSet dataSet = ReadMNISTDataSet("dataset/train-images.idx3-ubyte", "dataset/train-labels.idx1-ubyte", "dataset/t10k-images.idx3-ubyte", "dataset/t10k-labels.idx1-ubyte");
+        model.Fit(argument(1, 5), dataSet);
+
+        model.PrintExitTradeoff(dataSet.validationInput, dataSet.validationLabels, { 0.5f, 0.8f, 0.9f, 0.95f, 0.99f, 0.999f });
+        model.SaveModel(modelFile);
+
+        return 0;
+    }
+
+    //Compares an ensemble of saved models, which computes the layers they have in common once, with running every model on its own.
+    if (!arguments.empty() && arguments[0] == "ensemble") {
+        if (arguments.size() < 4 || (arguments[1] != "average" && arguments[1] != "vote")) {
+            std::cout << "Usage: ensemble <average | vote> <model file> <model file> [more model files]\n";
+            return 1;
+        }
+
+        const std::vector<std::string> modelFiles(arguments.begin() + 2, arguments.end());
+
+        Ensemble ensemble(modelFiles, arguments[1] == "vote" ? EnsembleCombination::Vote : EnsembleCombination::Average);
+        ensemble.PrintSharing();
+
+        std::vector<std::unique_ptr<NeuralNetwork>> models;
+        for (const auto& modelFile : modelFiles) {
+            models.push_back(std::make_unique<NeuralNetwork>());
+            models.back()->LoadModel(modelFile);
+        }
+
+        const auto inputs = ReadIDXFileData("dataset/t10k-images.idx3-ubyte");
+        const auto labels = ReadIDXFileLabels("dataset/t10k-labels.idx1-ubyte");
+        const size_t batchSize = 64, inputSize = ensemble.InputSize(), outputSize = ensemble.OutputSize();
+
+        auto measure = [&](const char* name, auto&& predictBatch) {
+            std::vector<float> batch(batchSize * inputSize);
+            size_t correct = 0;
+
+            const auto startTime = std::chrono::steady_clock::now();
+
+            for (size_t first = 0; first < inputs.size(); first += batchSize) {
+                const size_t samples = std::min(batchSize, inputs.size() - first);
+
+                for (size_t n = 0; n < samples; n++)
+                    std::ranges::copy(inputs[first + n], batch.begin() + n * inputSize);
+
+                const auto& outputs = predictBatch(batch.data(), samples);
+
+                for (size_t n = 0; n < samples; n++) {
+                    const auto sample = outputs.begin() + n * outputSize;
+                    correct += std::distance(sample, std::max_element(sample, sample + outputSize)) == labels[first + n];
+                }
+            }
+
+            const std::chrono::duration<double, std::micro> elapsedTime = std::chrono::steady_clock::now() - startTime;
+
+            std::cout << std::format("{} - Accuracy: {:.2f} % - {:.2f} us per sample\n", name, 100.0 * correct / inputs.size(), elapsedTime.count() / inputs.size());
+        };
+
+        for (size_t i = 0; i < models.size(); i++)
+            measure(modelFiles[i].c_str(), [&](const float* batch, size_t samples) -> const std::vector<float>& { return models[i]->PredictBatch(batch, samples); });
+
+        //Running every model on its own and averaging the outputs afterwards, as the ensemble was served before.
+        std::vector<float> averaged;
+        measure("Separate models", [&](const float* batch, size_t samples) -> const std::vector<float>& {
+            averaged.assign(samples * outputSize, 0.f);
+
+            for (auto& model : models) {
+                const auto& outputs = model->PredictBatch(batch, samples);
+                for (size_t i = 0; i < averaged.size(); i++)
+                    averaged[i] += outputs[i] / static_cast<float>(models.size());
+            }
+
+            return averaged;
+        });
+
+        measure("Ensemble", [&](const float* batch, size_t samples) -> const std::vector<float>& { return ensemble.PredictBatch(batch, samples); });
+
+        return 0;
+    }
+
+    if (!arguments.empty() && arguments[0] == "loadgen") {
+        auto inputs = ReadIDXFileData("dataset/t10k-images.idx3-ubyte");
+        RunLoadGenerator(static_cast<uint16_t>(argument(1, 7878)), argument(2, 8), argument(3, 1000), inputs);
+
+        return 0;
+    }
+
     /*
     NeuralNetwork* model = new NeuralNetwork();
     model->AddLayer(new Input(28, 28, 1));
@@ -30,9 +371,21 @@ int main()
     model->Create(1E-4f, 0.1f);
     model->PrintSummary();
 
-    DataSet _dataSet = ReadMNISTDataSet("dataset/train-images.idx3-ubyte", "dataset/train-labels.idx1-ubyte", "dataset/t10k-images.idx3-ubyte", "dataset/t10k-labels.idx1-ubyte");
+    //The IDX files are only parsed by the first run, later runs memory map the cache.
+    if (!DatasetCache::Exists("dataset/cache/train"))
+        DatasetCache::Convert("dataset/train-images.idx3-ubyte", "dataset/train-labels.idx1-ubyte", "dataset/cache/train");
+    if (!DatasetCache::Exists("dataset/cache/validation"))
+        DatasetCache::Convert("dataset/t10k-images.idx3-ubyte", "dataset/t10k-labels.idx1-ubyte", "dataset/cache/validation");
+
+    DatasetCache trainSet("dataset/cache/train"), validationSet("dataset/cache/validation");
+
+    //Checkpoints after every epoch, so a crashed run continues where it stopped when it is started again with resume.
+    model->SetCheckpoint("best.checkpoint");
 
-    model->Fit(10, _dataSet);
+    if (!arguments.empty() && arguments[0] == "resume")
+        model->ResumeFit("best.checkpoint", 10, trainSet, trainSet.Labels(), validationSet, validationSet.Labels());
+    else
+        model->Fit(10, trainSet, trainSet.Labels(), validationSet, validationSet.Labels());
 
     model->SaveModel("best.model");
 
@@ -42,7 +395,9 @@ int main()
 
     model2->PrintSummary();
 
-    model2->Fit(1, _dataSet);
+    //Only the last two layers are fine tuned, the features of the frozen layers are computed once.
+    model2->SetFrozen(2);
+    model2->Fit(1, trainSet, trainSet.Labels(), validationSet, validationSet.Labels());
 
     return 0;
 }
\ No newline at end of file
@@ -1,11 +1,32 @@
 #include "NeuralLayer.h"
 #include "common.h"
+#include "WorkStealingPool.h"
 
 #include <iostream>
 #include <algorithm>
 #include <ranges>
 #include <numeric>
 #include <format>
+#include <span>
+#include <cmath>
+
+namespace {
+    /*
+    * The range of outputs [begin, end) for which the kernel offset k reads an input inside of [0, inputSize), with the given padding and stride.
+    * The input of output i is at i * stride + k - padding.
+    */
+    std::pair<size_t, size_t> ValidOutputs(size_t k, size_t inputSize, size_t outputSize, size_t padding, size_t stride)
+    {
+        const size_t begin = padding > k ? (padding - k + stride - 1) / stride : 0;
+
+        if (inputSize + padding <= k)
+            return { begin, begin };
+
+        const size_t end = std::min((inputSize + padding - k - 1) / stride + 1, outputSize);
+
+        return { begin, std::max(begin, end) };
+    }
+}
 
 void NeuralLayer::SetActivationFuction(std::string ActivationFunction)
 {
@@ -21,6 +42,10 @@ void NeuralLayer::SetActivationFuction(std::string ActivationFunction)
         Activation = LeakyReLu;
         ActivationDerivative = LeakyReLuDerivative;
     }
+    else if (ActivationFunction == "linear") {
+        Activation = Linear;
+        ActivationDerivative = LinearDerivative;
+    }
     else
     {
         std::cerr << "Given Activation function: '" << ActivationFunction << "' does not exists!\n Exiting!";
@@ -56,20 +81,62 @@ void NeuralLayer::LeakyReLuDerivative(NeuralLayer* NL)
 
 void NeuralLayer::SoftMax(NeuralLayer* NL)
 {
-    auto max = std::max_element(NL->outputs.cbegin(), NL->outputs.cend());
-    std::transform(NL->outputs.begin(), NL->outputs.end(), NL->outputs.begin(), [max](float Z) {return std::clamp(Z - *max, -80.f, 50.f); });
+    const size_t sampleSize = NL->outputs.size() / NL->batchSize;
+
+    //The softmax is taken over every sample of the batch on its own.
+    for (size_t b = 0; b < NL->batchSize; b++) {
+        std::span<float> sample(NL->outputs.data() + b * sampleSize, sampleSize);
 
-    float sum = std::accumulate(NL->outputs.cbegin(), NL->outputs.cend(), 0.f, [](float acc, float Z) {return acc + std::expf(Z); });
+        auto max = *std::max_element(sample.begin(), sample.end());
+        std::transform(sample.begin(), sample.end(), sample.begin(), [max](float Z) {return std::clamp(Z - max, -80.f, 50.f); });
 
-    sum = std::max(sum, 1E-12f);
+        float sum = std::accumulate(sample.begin(), sample.end(), 0.f, [](float acc, float Z) {return acc + std::expf(Z); });
 
-    std::transform(NL->outputs.begin(), NL->outputs.end(), NL->outputs.begin(), [&sum](float Z) {return std::expf(Z) / sum; });
+        sum = std::max(sum, 1E-12f);
+
+        std::transform(sample.begin(), sample.end(), sample.begin(), [&sum](float Z) {return std::expf(Z) / sum; });
+    }
 }
 
 void NeuralLayer::SoftMaxDerivative(NeuralLayer* NL)
 {
 }
 
+void NeuralLayer::SetGradientAccumulation(bool accumulate)
+{
+    accumulateGradients = accumulate;
+}
+
+void NeuralLayer::SetBatchSize(size_t batchSize)
+{
+    this->batchSize = batchSize;
+
+    outputs.resize(batchSize * outputWidth * outputHeight * outputChannels);
+}
+
+LayerCost NeuralLayer::EstimateCost(size_t forwardMACs, size_t weightGradientMACs, size_t inputGradientMACs, size_t parameterBytes) const
+{
+    const size_t inputs = previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels;
+    const size_t outputSize = outputWidth * outputHeight * outputChannels;
+    const bool propogates = PropogatesToPreviousLayer();
+
+    LayerCost cost;
+    cost.forwardMACs = forwardMACs;
+    cost.forwardBytesRead = inputs * sizeof(float) + parameterBytes;
+    cost.forwardBytesWritten = outputSize * sizeof(float);
+
+    cost.backwardMACs = weightGradientMACs + (propogates ? inputGradientMACs : 0);
+
+    //The output gradients and inputs are read for the weight gradients, and the weights for the input gradients, after which the weights are updated.
+    cost.backwardBytesRead = outputSize * sizeof(float) + (weightGradientMACs ? inputs * sizeof(float) + parameterBytes : 0);
+    cost.backwardBytesWritten = (propogates ? inputs * sizeof(float) : 0) + (weightGradientMACs ? parameterBytes : 0);
+
+    cost.activationMemory = 2 * outputSize * sizeof(float);
+    cost.parameterMemory = parameterBytes;
+
+    return cost;
+}
+
 void NeuralLayer::SaveLayer(std::ofstream& file) const
 {
     if (file.is_open()) {
@@ -84,7 +151,7 @@ void NeuralLayer::SaveLayer(std::ofstream& file) const
 Input::Input(size_t width, size_t height, size_t channels) : 
     NeuralLayer(width, height, channels)
 {
-    outputs.reserve(width * height * channels);
+    outputs.assign(width * height * channels, 0.f);
     layerType = LayerTypes::InputLayer;
 }
 
@@ -100,7 +167,7 @@ Input::Input(std::ifstream& file)
     this->outputHeight = outputHeight;
     this->outputWidth = outputWidth;
 
-    outputs.reserve(outputWidth * outputHeight * outputChannels);
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
     layerType = LayerTypes::InputLayer;
 
     outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.0f);
@@ -113,6 +180,14 @@ size_t Input::PrintStats() const
     return 0;
 }
 
+LayerCost Input::Cost() const
+{
+    LayerCost cost;
+    cost.activationMemory = outputWidth * outputHeight * outputChannels * sizeof(float);
+
+    return cost;
+}
+
 Convolution::Convolution(size_t amount, size_t kernelSize, size_t padding, size_t stride, std::string ActivationFunction) :
     kernelSize(kernelSize), padding(padding), stride(stride), kernelAmount(amount)
 {
@@ -123,7 +198,7 @@ Convolution::Convolution(size_t amount, size_t kernelSize, size_t padding, size_
     layerType = LayerTypes::ConvolutionLayer;
 }
 
-Convolution::Convolution(std::ifstream& file)
+Convolution::Convolution(std::ifstream& file, size_t version)
 {
     size_t outputChannels, outputHeight, outputWidth, kernelSize, kernelAmount, padding;
     std::string activationFunction;
@@ -139,6 +214,12 @@ Convolution::Convolution(std::ifstream& file)
     file.read((char*)&kernelAmount, sizeof(kernelAmount));
     file.read((char*)&padding, sizeof(padding));
 
+    //Models saved before the stride was stored, were always fed forward with a stride of 1.
+    if (version >= 6)
+        file.read((char*)&stride, sizeof(stride));
+    else
+        stride = 1;
+
     this->outputChannels = outputChannels;
     this->outputHeight = outputHeight;
     this->outputWidth = outputWidth;
@@ -146,33 +227,24 @@ Convolution::Convolution(std::ifstream& file)
     this->kernelSize = kernelSize;
     this->kernelAmount = kernelAmount;
     this->padding = padding;
-    stride = 0;
 
     size_t size = 0;
 
     //Read in the amount of kernel weights, and the initialize the weights with the stored weights.
     file.read((char*)&size, sizeof(size));
 
-    kernelWeights.reserve(size);
+    kernelWeights.resize(size);
     kernelGradients.assign(size, 0.f);
 
-    for (int i = 0; i < size; i++) {
-        float weight;
-        file.read((char*)&weight, sizeof(weight));
-        this->kernelWeights.push_back(weight);
-    }
+    file.read((char*)kernelWeights.data(), size * sizeof(float));
 
     //Read in the amount of bias weights, and the initialize the weights with the stored weights.
     file.read((char*)&size, sizeof(size));
 
-    biasWeights.reserve(size);
+    biasWeights.resize(size);
     biasGradients.assign(size, 0.f);
 
-    for (int i = 0; i < size; i++) {
-        float weight;
-        file.read((char*)&weight, sizeof(weight));
-        this->biasWeights.push_back(weight);
-    }
+    file.read((char*)biasWeights.data(), size * sizeof(float));
 
     outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
     outputs.assign(outputWidth * outputHeight * outputChannels, 0.0);
@@ -187,35 +259,221 @@ Convolution::Convolution(std::ifstream& file)
 
 void Convolution::FeedForward()
 {
-    for (size_t k = 0; k < kernelAmount; k++) {
-        for (size_t j = 0; j < outputHeight; j++) {
-            for (size_t i = 0; i < outputWidth; i++) {
-                float Z = CrossCorrelation(i, j, k) + biasWeights[k];
+    switch (algorithm) {
+    case Unrolled:
+        FeedForwardUnrolled();
+        break;
+    case Lowered:
+        FeedForwardLowered();
+        break;
+    default:
+        FeedForwardDirect();
+        break;
+    }
+
+    Activation(this);
+}
+
+/*
+* The output channels of all the samples are split over the threads, by all three algorithms.
+*/
+void Convolution::FeedForwardDirect()
+{
+    const size_t outputSize = outputWidth * outputHeight * outputChannels;
+    const size_t channelWork = outputWidth * outputHeight * previousLayer->outputChannels * kernelSize * kernelSize;
+
+    WorkStealingPool::ParallelFor(batchSize * kernelAmount, channelWork, [this, outputSize](size_t first, size_t last) {
+        for (size_t n = first; n < last; n++) {
+            const size_t b = n / kernelAmount, k = n % kernelAmount;
+
+            for (size_t j = 0; j < outputHeight; j++) {
+                for (size_t i = 0; i < outputWidth; i++) {
+                    float Z = CrossCorrelation(i, j, k, b) + biasWeights[k];
+
+                    outputs[b * outputSize + k * outputWidth * outputHeight + j * outputWidth + i] = Z;
+                }
+            }
+        }
+    });
+}
+
+/*
+* Every kernel weight is multiplied with all the inputs it is used for at once, so the inner loop runs over a row of the output.
+*/
+void Convolution::FeedForwardUnrolled()
+{
+    const size_t inputWidth = previousLayer->outputWidth, inputHeight = previousLayer->outputHeight, channels = previousLayer->outputChannels;
+    const size_t inputPlane = inputWidth * inputHeight, outputPlane = outputWidth * outputHeight;
+
+    WorkStealingPool::ParallelFor(batchSize * kernelAmount, outputPlane * channels * kernelSize * kernelSize, [&](size_t first, size_t last) {
+        for (size_t n = first; n < last; n++) {
+            const size_t b = n / kernelAmount, k = n % kernelAmount;
+            float* output = outputs.data() + n * outputPlane;
+
+            std::fill(output, output + outputPlane, biasWeights[k]);
 
-                outputs[k * kernelSize * kernelSize + j * kernelSize + i] = Z;
+            for (size_t c = 0; c < channels; c++) {
+                const float* input = previousLayer->outputs.data() + (b * channels + c) * inputPlane;
+                const float* kernel = kernelWeights.data() + (k * channels + c) * kernelSize * kernelSize;
+
+                for (size_t ky = 0; ky < kernelSize; ky++) {
+                    const auto [firstRow, lastRow] = ValidOutputs(ky, inputHeight, outputHeight, padding, stride);
+
+                    for (size_t kx = 0; kx < kernelSize; kx++) {
+                        const auto [firstColumn, lastColumn] = ValidOutputs(kx, inputWidth, outputWidth, padding, stride);
+                        const float weight = kernel[ky * kernelSize + kx];
+
+                        for (size_t j = firstRow; j < lastRow; j++) {
+                            const float* inputRow = input + (j * stride + ky - padding) * inputWidth;
+                            float* outputRow = output + j * outputWidth;
+
+                            for (size_t i = firstColumn; i < lastColumn; i++)
+                                outputRow[i] += weight * inputRow[i * stride + kx - padding];
+                        }
+                    }
+                }
             }
         }
+    });
+}
+
+/*
+* The input of a sample is lowered to a matrix with a row for every kernel weight and a column for every output position,
+* after which the outputs are the product of the kernels x weights matrix with it. Four kernels are computed at once,
+* so every row of the lowered input is read once for four kernels.
+*/
+void Convolution::FeedForwardLowered()
+{
+    const size_t inputWidth = previousLayer->outputWidth, inputHeight = previousLayer->outputHeight, channels = previousLayer->outputChannels;
+    const size_t inputPlane = inputWidth * inputHeight, outputPlane = outputWidth * outputHeight;
+    const size_t rows = channels * kernelSize * kernelSize;
+
+    for (size_t b = 0; b < batchSize; b++) {
+        WorkStealingPool::ParallelFor(channels, kernelSize * kernelSize * outputPlane, [&](size_t firstChannel, size_t lastChannel) {
+            for (size_t c = firstChannel; c < lastChannel; c++) {
+                const float* input = previousLayer->outputs.data() + (b * channels + c) * inputPlane;
+
+                for (size_t ky = 0; ky < kernelSize; ky++) {
+                    const auto [firstRow, lastRow] = ValidOutputs(ky, inputHeight, outputHeight, padding, stride);
+
+                    for (size_t kx = 0; kx < kernelSize; kx++) {
+                        const auto [firstColumn, lastColumn] = ValidOutputs(kx, inputWidth, outputWidth, padding, stride);
+                        float* lowered = loweredInputs.data() + ((c * kernelSize + ky) * kernelSize + kx) * outputPlane;
+
+                        //The positions that read the padding stay zero.
+                        if (firstRow > 0 || lastRow < outputHeight || firstColumn > 0 || lastColumn < outputWidth)
+                            std::fill(lowered, lowered + outputPlane, 0.f);
+
+                        for (size_t j = firstRow; j < lastRow; j++) {
+                            const float* inputRow = input + (j * stride + ky - padding) * inputWidth;
+                            float* loweredRow = lowered + j * outputWidth;
+
+                            for (size_t i = firstColumn; i < lastColumn; i++)
+                                loweredRow[i] = inputRow[i * stride + kx - padding];
+                        }
+                    }
+                }
+            }
+        });
+
+        float* output = outputs.data() + b * kernelAmount * outputPlane;
+
+        //The kernels are split over the threads in blocks of four.
+        WorkStealingPool::ParallelFor((kernelAmount + 3) / 4, 4 * rows * outputPlane, [&](size_t firstBlock, size_t lastBlock) {
+            const size_t lastKernel = std::min(kernelAmount, lastBlock * 4);
+            size_t k = firstBlock * 4;
+
+            for (; k + 4 <= lastKernel; k += 4) {
+                float* output0 = output + k * outputPlane, *output1 = output0 + outputPlane, *output2 = output1 + outputPlane, *output3 = output2 + outputPlane;
+                const float* weights = kernelWeights.data() + k * rows;
+
+                std::fill(output0, output0 + outputPlane, biasWeights[k]);
+                std::fill(output1, output1 + outputPlane, biasWeights[k + 1]);
+                std::fill(output2, output2 + outputPlane, biasWeights[k + 2]);
+                std::fill(output3, output3 + outputPlane, biasWeights[k + 3]);
+
+                for (size_t r = 0; r < rows; r++) {
+                    const float* lowered = loweredInputs.data() + r * outputPlane;
+                    const float weight0 = weights[r], weight1 = weights[rows + r], weight2 = weights[2 * rows + r], weight3 = weights[3 * rows + r];
+
+                    for (size_t p = 0; p < outputPlane; p++) {
+                        const float value = lowered[p];
+
+                        output0[p] += weight0 * value;
+                        output1[p] += weight1 * value;
+                        output2[p] += weight2 * value;
+                        output3[p] += weight3 * value;
+                    }
+                }
+            }
+
+            for (; k < lastKernel; k++) {
+                float* kernelOutput = output + k * outputPlane;
+                const float* weights = kernelWeights.data() + k * rows;
+
+                std::fill(kernelOutput, kernelOutput + outputPlane, biasWeights[k]);
+
+                for (size_t r = 0; r < rows; r++) {
+                    const float* lowered = loweredInputs.data() + r * outputPlane;
+                    const float weight = weights[r];
+
+                    for (size_t p = 0; p < outputPlane; p++)
+                        kernelOutput[p] += weight * lowered[p];
+                }
+            }
+        });
     }
+}
 
-    Activation(this);
+std::string Convolution::AlgorithmName(size_t algorithm) const
+{
+    switch (algorithm) {
+    case Unrolled:
+        return "unrolled";
+    case Lowered:
+        return "lowered";
+    default:
+        return "direct";
+    }
+}
+
+void Convolution::SetAlgorithm(size_t algorithm)
+{
+    this->algorithm = algorithm;
+
+    if (algorithm == Lowered)
+        loweredInputs.assign(previousLayer->outputChannels * kernelSize * kernelSize * outputWidth * outputHeight, 0.f);
+    else
+        loweredInputs = std::vector<float>();
+}
+
+std::string Convolution::TuningKey() const
+{
+    return std::format("Convolution [{}, {}, {}] kernels {} size {} padding {} stride {} batch {}", previousLayer->outputWidth, previousLayer->outputHeight,
+        previousLayer->outputChannels, kernelAmount, kernelSize, padding, stride, batchSize);
 }
 
 void Convolution::BackPropogate()
 {
     ActivationDerivative(this);
 
-    //Gradient with respect to the weights
+    //Gradient with respect to the weights, every kernel writes only its own gradients so the kernels are split over the threads.
+    const size_t kernelWork = previousLayer->outputChannels * kernelSize * kernelSize * outputWidth * outputHeight;
+
+    WorkStealingPool::ParallelFor(kernelAmount, kernelWork, [this](size_t firstKernel, size_t lastKernel) {
+        for (size_t kernel = firstKernel; kernel < lastKernel; kernel++) {
+            for (size_t channel = 0; channel < previousLayer->outputChannels; channel++) {
+                for (size_t y = 0; y < kernelSize; y++) {
+                    for (size_t x = 0; x < kernelSize; x++) {
+                        float gradient = WeightGradient(x, y, kernel, channel);
+                        float& kernelGradient = kernelGradients[kernel * previousLayer->outputChannels * kernelSize * kernelSize + channel * kernelSize * kernelSize + y * kernelSize + x];
 
-    for (size_t kernel = 0; kernel < kernelAmount; kernel++) {
-        for (size_t channel = 0; channel < previousLayer->outputChannels; channel++) {
-            for (size_t y = 0; y < kernelSize; y++) {
-                for (size_t x = 0; x < kernelSize; x++) {
-                    float gradient = WeightGradient(x, y, kernel, channel);
-                    kernelGradients[kernel * previousLayer->outputChannels * kernelSize * kernelSize + channel * kernelSize * kernelSize + y * kernelSize + x] = gradient;
+                        kernelGradient = accumulateGradients ? kernelGradient + gradient : gradient;
+                    }
                 }
             }
         }
-    }
+    });
 
     //Gradient with respect to the bias
     
@@ -227,21 +485,17 @@ void Convolution::BackPropogate()
             biasGradient += outputGradients[k * outputHeight * outputWidth + i];
         }
 
-        biasGradients[k] = biasGradient;
+        biasGradients[k] = accumulateGradients ? biasGradients[k] + biasGradient : biasGradient;
     }
 
     //Gradient with respect to the input
-    for (size_t c = 0; c < previousLayer->outputChannels; c++) {
-        for (size_t y = 0; y < previousLayer->outputHeight; y++) {
-            for (size_t x = 0; x < previousLayer->outputWidth; x++) {
-                float inputGradient = CalculateInputGradient(c, x, y);
+    if (PropogatesToPreviousLayer())
+        InputGradients();
 
-                previousLayer->outputGradients[c * previousLayer->outputWidth * previousLayer->outputHeight + y * previousLayer->outputWidth + x] = inputGradient;
-            }
-        }
-    }
+    //update all the weights based upon the gradients, unless they are accumulated
 
-    //update all the weights based upon the gradients
+    if (accumulateGradients)
+        return;
 
     for (size_t i = 0; i < kernelWeights.size(); i++) {
         kernelWeights[i] -= learningRate * kernelGradients[i];
@@ -252,6 +506,38 @@ void Convolution::BackPropogate()
     }
 }
 
+void Convolution::SetGradientAccumulation(bool accumulate)
+{
+    NeuralLayer::SetGradientAccumulation(accumulate);
+
+    std::fill(kernelGradients.begin(), kernelGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+void Convolution::ApplyGradients(float scale)
+{
+    const float step = learningRate * scale;
+
+    for (size_t i = 0; i < kernelWeights.size(); i++)
+        kernelWeights[i] -= step * kernelGradients[i];
+
+    for (size_t k = 0; k < biasWeights.size(); k++)
+        biasWeights[k] -= step * biasGradients[k];
+
+    std::fill(kernelGradients.begin(), kernelGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+std::vector<std::span<float>> Convolution::Parameters()
+{
+    return { kernelWeights, biasWeights };
+}
+
+std::vector<std::span<float>> Convolution::Gradients()
+{
+    return { kernelGradients, biasGradients };
+}
+
 void Convolution::Create(NeuralLayer* previousLayer)
 {
     this->previousLayer = previousLayer;
@@ -281,6 +567,13 @@ size_t Convolution::PrintStats() const
     return params;
 }
 
+LayerCost Convolution::Cost() const
+{
+    const size_t macs = outputWidth * outputHeight * kernelWeights.size();
+
+    return EstimateCost(macs, macs, macs, (kernelWeights.size() + biasWeights.size()) * sizeof(float));
+}
+
 void Convolution::SaveLayer(std::ofstream& file) const
 {
     NeuralLayer::SaveLayer(file);
@@ -290,26 +583,23 @@ void Convolution::SaveLayer(std::ofstream& file) const
     file.write((const char*)&kernelSize, sizeof(kernelSize));
     file.write((const char*)&kernelAmount, sizeof(kernelAmount));
     file.write((const char*)&padding, sizeof(padding));
+    file.write((const char*)&stride, sizeof(stride));
 
     size_t size = kernelWeights.size();
     file.write((const char*)&size, sizeof(size));
-
-    for (const auto& weight : kernelWeights)
-        file.write((const char*)&weight, sizeof(weight));
+    file.write((const char*)kernelWeights.data(), size * sizeof(float));
 
     size = biasWeights.size();
     file.write((const char*)&size, sizeof(size));
-
-    for (const auto& weight : biasWeights)
-        file.write((const char*)&weight, sizeof(weight));
+    file.write((const char*)biasWeights.data(), size * sizeof(float));
 }
 
 
 /*
 * Cross Corelates the kernel given by the index, with the previous layer's output based upon
-* The given x and y coordinates.
+* The given x and y coordinates. The sample is the index of the sample in the batch.
 */
-float Convolution::CrossCorrelation(size_t beginX, size_t beginY, size_t kernel) const
+float Convolution::CrossCorrelation(size_t beginX, size_t beginY, size_t kernel, size_t sample) const
 {
     /*size_t kernelBase = kernel * kernelSize * kernelSize;
     float sum = 0.f;
@@ -328,15 +618,21 @@ float Convolution::CrossCorrelation(size_t beginX, size_t beginY, size_t kernel)
 
     float sum = 0.f;
     size_t kernelBase = kernel * kernelSize * kernelSize * previousLayer->outputChannels;
+    size_t sampleBase = sample * previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels;
+
+    //The window of the output starts at beginX * stride - padding, the parts of the window in the padding are skipped.
+    const size_t windowX = beginX * stride, windowY = beginY * stride;
+    const size_t firstX = padding > windowX ? padding - windowX : 0, lastX = std::min(kernelSize, previousLayer->outputWidth + padding - windowX);
+    const size_t firstY = padding > windowY ? padding - windowY : 0, lastY = std::min(kernelSize, previousLayer->outputHeight + padding - windowY);
 
     for (size_t k = 0; k < previousLayer->outputChannels; k++) {
-        size_t channelBase = k * previousLayer->outputWidth * previousLayer->outputHeight;
+        size_t channelBase = sampleBase + k * previousLayer->outputWidth * previousLayer->outputHeight;
 
-        for (size_t y = 0; y < kernelSize; y++) {
-            size_t inputY = beginY + y;
+        for (size_t y = firstY; y < lastY; y++) {
+            size_t inputY = windowY + y - padding;
 
-            for (size_t x = 0; x < kernelSize; x++) {
-                size_t inputX = beginX + x;
+            for (size_t x = firstX; x < lastX; x++) {
+                size_t inputX = windowX + x - padding;
 
                 float input = previousLayer->outputs[channelBase + inputY * previousLayer->outputWidth + inputX];
                 float weight = kernelWeights[kernelBase + k * kernelSize * kernelSize + y * kernelSize + x];
@@ -353,175 +649,296 @@ float Convolution::CrossCorrelation(size_t beginX, size_t beginY, size_t kernel)
 */
 float Convolution::WeightGradient(size_t beginX, size_t beginY, size_t kernel, size_t channel) const
 {
+    const size_t inputWidth = previousLayer->outputWidth, inputHeight = previousLayer->outputHeight;
+    const auto [firstRow, lastRow] = ValidOutputs(beginY, inputHeight, outputHeight, padding, stride);
+    const auto [firstColumn, lastColumn] = ValidOutputs(beginX, inputWidth, outputWidth, padding, stride);
+
+    const float* input = previousLayer->outputs.data() + channel * inputWidth * inputHeight;
+    const float* gradients = outputGradients.data() + kernel * outputWidth * outputHeight;
     float sum = 0.f;
 
-    for (size_t y = 0; y < outputHeight; y++) {
-        for (size_t x = 0; x < outputWidth; x++) {
-            float input = previousLayer->outputs[channel * previousLayer->outputWidth * previousLayer->outputHeight + (beginY + y) * previousLayer->outputWidth + (beginX + x)];
-            float outputGradient = outputGradients[kernel * outputWidth * outputHeight + y * outputWidth + x];
+    for (size_t y = firstRow; y < lastRow; y++) {
+        const float* inputRow = input + (y * stride + beginY - padding) * inputWidth;
+        const float* gradientRow = gradients + y * outputWidth;
 
-            sum += input * outputGradient;
-        }
+        for (size_t x = firstColumn; x < lastColumn; x++)
+            sum += inputRow[x * stride + beginX - padding] * gradientRow[x];
     }
 
     return sum;
 }
 
-inline float Convolution::CalculateInputGradient(size_t c, size_t x, size_t y) const
+/*
+* Every kernel weight passes the gradients of a row of outputs to the inputs they were computed from at once.
+*/
+void Convolution::InputGradients()
 {
-    size_t pad = kernelSize - 1 - padding;  //logical padding around the output gradients in all directions
-    size_t deltaPad = (previousLayer->outputWidth - outputWidth) / 2; //Difference in padding between the input and output
-    float gradient = 0.f;
+    const size_t inputWidth = previousLayer->outputWidth, inputHeight = previousLayer->outputHeight, channels = previousLayer->outputChannels;
+    const size_t inputPlane = inputWidth * inputHeight, outputPlane = outputWidth * outputHeight;
 
-    auto kernelChunks = kernelWeights | std::views::chunk(kernelSize * kernelSize);
+    //Every channel of the input gradients is only written by its own thread.
+    WorkStealingPool::ParallelFor(channels, kernelAmount * kernelSize * kernelSize * outputPlane, [&](size_t firstChannel, size_t lastChannel) {
+        for (size_t c = firstChannel; c < lastChannel; c++) {
+            float* inputGradients = previousLayer->outputGradients.data() + c * inputPlane;
 
-    for (size_t k = 0; k < kernelAmount; k++) {
-        auto rotatedKernelWeights = std::views::reverse(kernelChunks[k * previousLayer->outputChannels + c]);
+            std::fill(inputGradients, inputGradients + inputPlane, 0.f);
+
+            for (size_t k = 0; k < kernelAmount; k++) {
+                const float* gradients = outputGradients.data() + k * outputPlane;
+                const float* kernel = kernelWeights.data() + (k * channels + c) * kernelSize * kernelSize;
+
+                for (size_t ky = 0; ky < kernelSize; ky++) {
+                    const auto [firstRow, lastRow] = ValidOutputs(ky, inputHeight, outputHeight, padding, stride);
+
+                    for (size_t kx = 0; kx < kernelSize; kx++) {
+                        const auto [firstColumn, lastColumn] = ValidOutputs(kx, inputWidth, outputWidth, padding, stride);
+                        const float weight = kernel[ky * kernelSize + kx];
 
-        for (size_t localY = std::max(pad > y ? pad - y : 0ull, 0ull); localY < std::min(kernelSize, previousLayer->outputHeight - y); localY++) {
-            for (size_t localX = std::max(pad > x ? pad - x : 0ull, 0ull); localX < std::min(kernelSize, previousLayer->outputWidth - x); localX++) {
-                float kernelWeight = rotatedKernelWeights[localY * kernelSize + localX];
-                size_t outputX = localX + x - pad;
-                size_t outputY = localY + y - pad;
-                float outputGradient = outputGradients[k * outputWidth * outputHeight + outputY * outputWidth + outputX];
-                gradient += kernelWeight * outputGradient;
+                        for (size_t j = firstRow; j < lastRow; j++) {
+                            float* inputGradientRow = inputGradients + (j * stride + ky - padding) * inputWidth;
+                            const float* gradientRow = gradients + j * outputWidth;
+
+                            for (size_t i = firstColumn; i < lastColumn; i++)
+                                inputGradientRow[i * stride + kx - padding] += weight * gradientRow[i];
+                        }
+                    }
+                }
             }
         }
-    }
-
-    return gradient;
+    });
 }
 
-inline float Convolution::GetOutputGradientForBackPropogate(size_t x, size_t y) const
+DepthwiseConvolution::DepthwiseConvolution(size_t kernelSize, size_t padding, size_t stride, std::string ActivationFunction) :
+    kernelSize(kernelSize), padding(padding), stride(stride ? stride : 1)
 {
-    return 0.0f;
-}
+    SetActivationFuction(ActivationFunction);
 
-MaxPooling::MaxPooling(size_t poolSize) :
-    poolingSize(poolSize)
-{
-    layerType = LayerTypes::MaxPoolingLayer;
+    layerType = LayerTypes::DepthwiseConvolutionLayer;
 }
 
-MaxPooling::MaxPooling(std::ifstream& file)
+DepthwiseConvolution::DepthwiseConvolution(std::ifstream& file)
 {
-    size_t outputChannels, outputHeight, outputWidth;
-
     file.read((char*)&outputChannels, sizeof(outputChannels));
     file.read((char*)&outputHeight, sizeof(outputHeight));
     file.read((char*)&outputWidth, sizeof(outputWidth));
-    file.read((char*)&poolingSize, sizeof(poolingSize));
 
-    this->outputChannels = outputChannels;
-    this->outputHeight = outputHeight;
-    this->outputWidth = outputWidth;
+    std::getline(file, ActivationFunction, '\0');
 
-    layerType = LayerTypes::MaxPoolingLayer;
+    file.read((char*)&kernelSize, sizeof(kernelSize));
+    file.read((char*)&padding, sizeof(padding));
+    file.read((char*)&stride, sizeof(stride));
 
-    outputs.assign(outputWidth * outputHeight * outputChannels, 0.0f);
-    maxIndexes.assign(outputWidth * outputHeight * outputChannels, 0);
+    size_t size = 0;
+
+    file.read((char*)&size, sizeof(size));
+
+    kernelWeights.resize(size);
+    kernelGradients.assign(size, 0.f);
+
+    file.read((char*)kernelWeights.data(), size * sizeof(float));
+
+    file.read((char*)&size, sizeof(size));
+
+    biasWeights.resize(size);
+    biasGradients.assign(size, 0.f);
+
+    file.read((char*)biasWeights.data(), size * sizeof(float));
+
+    SetActivationFuction(ActivationFunction);
+
+    layerType = LayerTypes::DepthwiseConvolutionLayer;
+
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
     outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
 }
 
-void MaxPooling::FeedForward()
+void DepthwiseConvolution::FeedForward()
 {
-    for (size_t k = 0; k < outputChannels; k++) {
-        for (size_t j = 0; j < outputHeight; j++) {
-            for (size_t i = 0; i < outputWidth; i++) {
-                Max(i, j, k);
+    const size_t inputWidth = previousLayer->outputWidth, inputHeight = previousLayer->outputHeight;
+    const size_t inputPlane = inputWidth * inputHeight, outputPlane = outputWidth * outputHeight;
+
+    for (size_t b = 0; b < batchSize; b++) {
+        for (size_t c = 0; c < outputChannels; c++) {
+            const float* input = previousLayer->outputs.data() + (b * outputChannels + c) * inputPlane;
+            const float* kernel = kernelWeights.data() + c * kernelSize * kernelSize;
+            float* output = outputs.data() + (b * outputChannels + c) * outputPlane;
+
+            std::fill(output, output + outputPlane, biasWeights[c]);
+
+            //Every kernel weight is added to all the outputs at once, so the inner loop runs over a row of the output.
+            for (size_t ky = 0; ky < kernelSize; ky++) {
+                const auto [firstRow, lastRow] = ValidOutputs(ky, inputHeight, outputHeight, padding, stride);
+
+                for (size_t kx = 0; kx < kernelSize; kx++) {
+                    const auto [firstColumn, lastColumn] = ValidOutputs(kx, inputWidth, outputWidth, padding, stride);
+                    const float weight = kernel[ky * kernelSize + kx];
+
+                    for (size_t j = firstRow; j < lastRow; j++) {
+                        const float* inputRow = input + (j * stride + ky - padding) * inputWidth;
+                        float* outputRow = output + j * outputWidth;
+
+                        for (size_t i = firstColumn; i < lastColumn; i++)
+                            outputRow[i] += weight * inputRow[i * stride + kx - padding];
+                    }
+                }
             }
         }
     }
+
+    Activation(this);
 }
 
-void MaxPooling::BackPropogate()
+void DepthwiseConvolution::BackPropogate()
 {
-    //Reset all the gradients for the input
-    std::fill(previousLayer->outputGradients.begin(), previousLayer->outputGradients.end(), 0.f);
+    ActivationDerivative(this);
+
+    const size_t inputWidth = previousLayer->outputWidth, inputHeight = previousLayer->outputHeight;
+    const size_t inputPlane = inputWidth * inputHeight, outputPlane = outputWidth * outputHeight;
+    const bool propogateInput = PropogatesToPreviousLayer();
+
+    if (propogateInput)
+        std::fill(previousLayer->outputGradients.begin(), previousLayer->outputGradients.end(), 0.f);
+
+    for (size_t c = 0; c < outputChannels; c++) {
+        const float* input = previousLayer->outputs.data() + c * inputPlane;
+        const float* gradients = outputGradients.data() + c * outputPlane;
+        float* inputGradients = previousLayer->outputGradients.data() + c * inputPlane;
+        float* kernel = kernelWeights.data() + c * kernelSize * kernelSize;
+        float* kernelGradient = kernelGradients.data() + c * kernelSize * kernelSize;
+
+        const float biasGradient = std::accumulate(gradients, gradients + outputPlane, 0.f);
+        biasGradients[c] = accumulateGradients ? biasGradients[c] + biasGradient : biasGradient;
 
-    //Set the gradient for the inputs only for those with the max value that was given to this output;
-    for (size_t i = 0; i < outputWidth * outputHeight * outputChannels; i++) {
-        previousLayer->outputGradients[maxIndexes[i]] = outputGradients[i];
+        for (size_t ky = 0; ky < kernelSize; ky++) {
+            const auto [firstRow, lastRow] = ValidOutputs(ky, inputHeight, outputHeight, padding, stride);
+
+            for (size_t kx = 0; kx < kernelSize; kx++) {
+                const auto [firstColumn, lastColumn] = ValidOutputs(kx, inputWidth, outputWidth, padding, stride);
+                const float weight = kernel[ky * kernelSize + kx];
+                float weightGradient = 0.f;
+
+                for (size_t j = firstRow; j < lastRow; j++) {
+                    const float* inputRow = input + (j * stride + ky - padding) * inputWidth;
+                    float* inputGradientRow = inputGradients + (j * stride + ky - padding) * inputWidth;
+                    const float* gradientRow = gradients + j * outputWidth;
+
+                    for (size_t i = firstColumn; i < lastColumn; i++)
+                        weightGradient += gradientRow[i] * inputRow[i * stride + kx - padding];
+
+                    if (propogateInput) {
+                        for (size_t i = firstColumn; i < lastColumn; i++)
+                            inputGradientRow[i * stride + kx - padding] += weight * gradientRow[i];
+                    }
+                }
+
+                kernelGradient[ky * kernelSize + kx] = accumulateGradients ? kernelGradient[ky * kernelSize + kx] + weightGradient : weightGradient;
+            }
+        }
     }
+
+    if (accumulateGradients)
+        return;
+
+    for (size_t i = 0; i < kernelWeights.size(); i++)
+        kernelWeights[i] -= learningRate * kernelGradients[i];
+
+    for (size_t c = 0; c < biasWeights.size(); c++)
+        biasWeights[c] -= learningRate * biasGradients[c];
 }
 
-void MaxPooling::Create(NeuralLayer* previousLayer)
+void DepthwiseConvolution::Create(NeuralLayer* previousLayer)
 {
     this->previousLayer = previousLayer;
 
-    outputWidth = previousLayer->outputWidth / poolingSize;
-    outputHeight = previousLayer->outputHeight / poolingSize;
+    outputWidth = (previousLayer->outputWidth + 2 * padding - kernelSize) / stride + 1;
+    outputHeight = (previousLayer->outputHeight + 2 * padding - kernelSize) / stride + 1;
     outputChannels = previousLayer->outputChannels;
 
-    outputs.reserve(outputWidth * outputHeight * outputChannels);
-    outputs.assign(outputWidth * outputHeight * outputChannels, 0.0f);
-    maxIndexes.reserve(outputWidth * outputHeight * outputChannels);
-    maxIndexes.assign(outputWidth * outputHeight * outputChannels, 0);
-
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
     outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    kernelGradients.assign(outputChannels * kernelSize * kernelSize, 0.f);
+    biasGradients.assign(outputChannels, 0.f);
+
+    InitWeights(kernelWeights, outputChannels * kernelSize * kernelSize, kernelSize * kernelSize);
+    InitWeights(biasWeights, outputChannels, kernelSize * kernelSize);
 }
 
-size_t MaxPooling::PrintStats() const
+size_t DepthwiseConvolution::PrintStats() const
 {
-    std::cout << std::format("MaxPooling [{}, {}, {}] {}\n", outputWidth, outputHeight, outputChannels, 0);
+    size_t params = kernelWeights.size() + biasWeights.size();
 
-    return 0;
+    std::cout << std::format("DepthwiseConvolution [{}, {}, {}] {}\n", outputWidth, outputHeight, outputChannels, params);
+
+    return params;
 }
 
-void MaxPooling::SaveLayer(std::ofstream& file) const
+LayerCost DepthwiseConvolution::Cost() const
 {
-    if (file.is_open()) {
-        NeuralLayer::SaveLayer(file);
+    const size_t macs = outputWidth * outputHeight * kernelWeights.size();
 
-        file.write((const char*)&poolingSize, sizeof(poolingSize));
-    }
+    return EstimateCost(macs, macs, macs, (kernelWeights.size() + biasWeights.size()) * sizeof(float));
 }
 
-/*
-* Calcules the max value based upon the previous layer's output. 
-* the i, j, and k values are given for this layer itself.
-*/
-void MaxPooling::Max(size_t i, size_t j, size_t k)
+void DepthwiseConvolution::SaveLayer(std::ofstream& file) const
 {
-    size_t inputK = k * previousLayer->outputWidth * previousLayer->outputHeight;
+    NeuralLayer::SaveLayer(file);
 
-    float max = std::numeric_limits<float>::lowest(); //set to lowest possible value for floats.
-    size_t index = 0;
+    file << ActivationFunction << '\0';
 
-    for (size_t y = 0; y < poolingSize; y++) {
-        size_t inputY = j * poolingSize + y;
+    file.write((const char*)&kernelSize, sizeof(kernelSize));
+    file.write((const char*)&padding, sizeof(padding));
+    file.write((const char*)&stride, sizeof(stride));
 
-        for (size_t x = 0; x < poolingSize; x++) {
-            size_t inputX = i * poolingSize + x;
+    size_t size = kernelWeights.size();
+    file.write((const char*)&size, sizeof(size));
+    file.write((const char*)kernelWeights.data(), size * sizeof(float));
 
-            size_t inputIndex = inputK + inputY * previousLayer->outputWidth + inputX;
+    size = biasWeights.size();
+    file.write((const char*)&size, sizeof(size));
+    file.write((const char*)biasWeights.data(), size * sizeof(float));
+}
 
-            if (max < previousLayer->outputs[inputIndex]) {
-                index = inputIndex;
-                max = previousLayer->outputs[inputIndex];
-            }
-        }
-    }
+void DepthwiseConvolution::SetGradientAccumulation(bool accumulate)
+{
+    NeuralLayer::SetGradientAccumulation(accumulate);
 
-    size_t outputIndex = k * outputWidth * outputHeight + j * outputWidth + i;
-    outputs[outputIndex] = max;
-    maxIndexes[outputIndex] = index;
+    std::fill(kernelGradients.begin(), kernelGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
 }
 
-FullyConnected::FullyConnected(size_t outputSize, std::string ActivationFunction)
+void DepthwiseConvolution::ApplyGradients(float scale)
 {
-    outputChannels = 1;
-    outputWidth = 1;
-    outputHeight = outputSize;
+    const float step = learningRate * scale;
 
-    biasWeights.reserve(outputSize);
+    for (size_t i = 0; i < kernelWeights.size(); i++)
+        kernelWeights[i] -= step * kernelGradients[i];
+
+    for (size_t c = 0; c < biasWeights.size(); c++)
+        biasWeights[c] -= step * biasGradients[c];
+
+    std::fill(kernelGradients.begin(), kernelGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+std::vector<std::span<float>> DepthwiseConvolution::Parameters()
+{
+    return { kernelWeights, biasWeights };
+}
 
+std::vector<std::span<float>> DepthwiseConvolution::Gradients()
+{
+    return { kernelGradients, biasGradients };
+}
+
+PointwiseConvolution::PointwiseConvolution(size_t amount, std::string ActivationFunction) :
+    kernelAmount(amount)
+{
     SetActivationFuction(ActivationFunction);
 
-    layerType = LayerTypes::FullyConnectedLayer;
+    layerType = LayerTypes::PointwiseConvolutionLayer;
 }
 
-FullyConnected::FullyConnected(std::ifstream& file, NeuralLayer* previousLayer)
+PointwiseConvolution::PointwiseConvolution(std::ifstream& file)
 {
     file.read((char*)&outputChannels, sizeof(outputChannels));
     file.read((char*)&outputHeight, sizeof(outputHeight));
@@ -529,142 +946,1439 @@ FullyConnected::FullyConnected(std::ifstream& file, NeuralLayer* previousLayer)
 
     std::getline(file, ActivationFunction, '\0');
 
+    file.read((char*)&kernelAmount, sizeof(kernelAmount));
+
     size_t size = 0;
 
     file.read((char*)&size, sizeof(size));
 
-    weights.reserve(size);
-    weightGradients.assign(size, 0.f);
+    kernelWeights.resize(size);
+    kernelGradients.assign(size, 0.f);
+
+    file.read((char*)kernelWeights.data(), size * sizeof(float));
+
+    file.read((char*)&size, sizeof(size));
+
+    biasWeights.resize(size);
+    biasGradients.assign(size, 0.f);
+
+    file.read((char*)biasWeights.data(), size * sizeof(float));
+
+    SetActivationFuction(ActivationFunction);
+
+    layerType = LayerTypes::PointwiseConvolutionLayer;
+
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+}
+
+/*
+* The outputs of a sample are the kernels x channels weights times the channels x positions inputs. Every weight is multiplied
+* with a whole row of positions at once, which runs over contiguous memory in both the inputs and the outputs.
+*/
+void PointwiseConvolution::FeedForward()
+{
+    const size_t channels = previousLayer->outputChannels, positions = outputWidth * outputHeight;
+
+    for (size_t b = 0; b < batchSize; b++) {
+        const float* input = previousLayer->outputs.data() + b * channels * positions;
+
+        for (size_t k = 0; k < kernelAmount; k++) {
+            float* output = outputs.data() + (b * kernelAmount + k) * positions;
+            const float* weights = kernelWeights.data() + k * channels;
+
+            std::fill(output, output + positions, biasWeights[k]);
+
+            for (size_t c = 0; c < channels; c++) {
+                const float weight = weights[c];
+                const float* inputRow = input + c * positions;
+
+                for (size_t p = 0; p < positions; p++)
+                    output[p] += weight * inputRow[p];
+            }
+        }
+    }
+
+    Activation(this);
+}
+
+/*
+* The gradient of every weight is the dot product of the output gradients of its kernel and the inputs of its channel,
+* the input gradients are accumulated with the weight before it is updated.
+*/
+void PointwiseConvolution::BackPropogate()
+{
+    ActivationDerivative(this);
+
+    const size_t channels = previousLayer->outputChannels, positions = outputWidth * outputHeight;
+    const bool propogateInput = PropogatesToPreviousLayer();
+
+    if (propogateInput)
+        std::fill(previousLayer->outputGradients.begin(), previousLayer->outputGradients.end(), 0.f);
+
+    const float* input = previousLayer->outputs.data();
+    float* inputGradients = previousLayer->outputGradients.data();
+
+    for (size_t k = 0; k < kernelAmount; k++) {
+        const float* gradients = outputGradients.data() + k * positions;
+        float* weights = kernelWeights.data() + k * channels;
+        float* weightGradients = kernelGradients.data() + k * channels;
+
+        const float biasGradient = std::accumulate(gradients, gradients + positions, 0.f);
+        biasGradients[k] = accumulateGradients ? biasGradients[k] + biasGradient : biasGradient;
+
+        for (size_t c = 0; c < channels; c++) {
+            const float* inputRow = input + c * positions;
+            float weightGradient = 0.f;
+
+            for (size_t p = 0; p < positions; p++)
+                weightGradient += gradients[p] * inputRow[p];
+
+            if (propogateInput) {
+                const float weight = weights[c];
+                float* inputGradientRow = inputGradients + c * positions;
+
+                for (size_t p = 0; p < positions; p++)
+                    inputGradientRow[p] += weight * gradients[p];
+            }
+
+            if (accumulateGradients)
+                weightGradients[c] += weightGradient;
+            else
+                weights[c] -= learningRate * weightGradient;
+        }
+
+        if (!accumulateGradients)
+            biasWeights[k] -= learningRate * biasGradients[k];
+    }
+}
+
+void PointwiseConvolution::Create(NeuralLayer* previousLayer)
+{
+    this->previousLayer = previousLayer;
+
+    outputWidth = previousLayer->outputWidth;
+    outputHeight = previousLayer->outputHeight;
+    outputChannels = kernelAmount;
+
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    kernelGradients.assign(kernelAmount * previousLayer->outputChannels, 0.f);
+    biasGradients.assign(kernelAmount, 0.f);
+
+    InitWeights(kernelWeights, kernelAmount * previousLayer->outputChannels, previousLayer->outputChannels);
+    InitWeights(biasWeights, kernelAmount, previousLayer->outputChannels);
+}
+
+size_t PointwiseConvolution::PrintStats() const
+{
+    size_t params = kernelWeights.size() + biasWeights.size();
+
+    std::cout << std::format("PointwiseConvolution [{}, {}, {}] {}\n", outputWidth, outputHeight, outputChannels, params);
+
+    return params;
+}
+
+LayerCost PointwiseConvolution::Cost() const
+{
+    const size_t macs = outputWidth * outputHeight * kernelWeights.size();
+
+    return EstimateCost(macs, macs, macs, (kernelWeights.size() + biasWeights.size()) * sizeof(float));
+}
+
+void PointwiseConvolution::SaveLayer(std::ofstream& file) const
+{
+    NeuralLayer::SaveLayer(file);
+
+    file << ActivationFunction << '\0';
+
+    file.write((const char*)&kernelAmount, sizeof(kernelAmount));
+
+    size_t size = kernelWeights.size();
+    file.write((const char*)&size, sizeof(size));
+    file.write((const char*)kernelWeights.data(), size * sizeof(float));
+
+    size = biasWeights.size();
+    file.write((const char*)&size, sizeof(size));
+    file.write((const char*)biasWeights.data(), size * sizeof(float));
+}
+
+void PointwiseConvolution::SetGradientAccumulation(bool accumulate)
+{
+    NeuralLayer::SetGradientAccumulation(accumulate);
+
+    std::fill(kernelGradients.begin(), kernelGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+void PointwiseConvolution::ApplyGradients(float scale)
+{
+    const float step = learningRate * scale;
+
+    for (size_t i = 0; i < kernelWeights.size(); i++)
+        kernelWeights[i] -= step * kernelGradients[i];
+
+    for (size_t k = 0; k < biasWeights.size(); k++)
+        biasWeights[k] -= step * biasGradients[k];
+
+    std::fill(kernelGradients.begin(), kernelGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+std::vector<std::span<float>> PointwiseConvolution::Parameters()
+{
+    return { kernelWeights, biasWeights };
+}
+
+std::vector<std::span<float>> PointwiseConvolution::Gradients()
+{
+    return { kernelGradients, biasGradients };
+}
+
+MaxPooling::MaxPooling(size_t poolSize, size_t stride) :
+    poolingSize(poolSize), stride(stride ? stride : poolSize)
+{
+    layerType = LayerTypes::MaxPoolingLayer;
+}
+
+MaxPooling::MaxPooling(std::ifstream& file, size_t version)
+{
+    size_t outputChannels, outputHeight, outputWidth;
+
+    file.read((char*)&outputChannels, sizeof(outputChannels));
+    file.read((char*)&outputHeight, sizeof(outputHeight));
+    file.read((char*)&outputWidth, sizeof(outputWidth));
+    file.read((char*)&poolingSize, sizeof(poolingSize));
+
+    //Models saved before the stride was stored, always used a stride equal to the pooling size.
+    if (version >= 1)
+        file.read((char*)&stride, sizeof(stride));
+    else
+        stride = poolingSize;
+
+    this->outputChannels = outputChannels;
+    this->outputHeight = outputHeight;
+    this->outputWidth = outputWidth;
+
+    layerType = LayerTypes::MaxPoolingLayer;
+
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.0f);
+    maxOffsets.assign(outputWidth * outputHeight * outputChannels, 0);
+    outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+}
+
+void MaxPooling::FeedForward()
+{
+    for (size_t b = 0; b < batchSize; b++) {
+        for (size_t k = 0; k < outputChannels; k++) {
+            for (size_t j = 0; j < outputHeight; j++) {
+                for (size_t i = 0; i < outputWidth; i++) {
+                    Max(i, j, k, b);
+                }
+            }
+        }
+    }
+}
+
+/*
+* Every input gradient is written exactly once, thus there is no need to reset the gradients of the previous layer first.
+* For every input, all the pooling windows that contain it are visited, and the gradient of every window that had its max at this input is summed.
+* With non overlapping windows this is at most one window, inputs that are not in any window get a gradient of zero.
+*/
+void MaxPooling::BackPropogate()
+{
+    if (!PropogatesToPreviousLayer())
+        return;
+
+    const size_t inputWidth = previousLayer->outputWidth, inputHeight = previousLayer->outputHeight;
+
+    for (size_t k = 0; k < outputChannels; k++) {
+        const size_t inputK = k * inputWidth * inputHeight;
+        const size_t outputK = k * outputWidth * outputHeight;
+
+        for (size_t y = 0; y < inputHeight; y++) {
+            //Range of the window rows [firstJ, lastJ) that contain this input row.
+            const size_t firstJ = y + 1 > poolingSize ? (y + 1 - poolingSize + stride - 1) / stride : 0;
+            const size_t lastJ = std::min(y / stride + 1, outputHeight);
+
+            for (size_t x = 0; x < inputWidth; x++) {
+                const size_t firstI = x + 1 > poolingSize ? (x + 1 - poolingSize + stride - 1) / stride : 0;
+                const size_t lastI = std::min(x / stride + 1, outputWidth);
+
+                float gradient = 0.f;
+
+                for (size_t j = firstJ; j < lastJ; j++) {
+                    for (size_t i = firstI; i < lastI; i++) {
+                        const size_t outputIndex = outputK + j * outputWidth + i;
+                        const size_t offset = (y - j * stride) * poolingSize + (x - i * stride);
+
+                        if (maxOffsets[outputIndex] == offset)
+                            gradient += outputGradients[outputIndex];
+                    }
+                }
+
+                previousLayer->outputGradients[inputK + y * inputWidth + x] = gradient;
+            }
+        }
+    }
+}
+
+void MaxPooling::Create(NeuralLayer* previousLayer)
+{
+    this->previousLayer = previousLayer;
+
+    if (poolingSize * poolingSize > 256) {
+        std::cout << "Error MaxPooling::Create(), a pooling size of " << poolingSize << " does not fit in the stored max offsets!\n";
+        exit(1);
+    }
+
+    if (previousLayer->outputWidth < poolingSize || previousLayer->outputHeight < poolingSize) {
+        std::cout << std::format("Error MaxPooling::Create(), the input of [{}, {}] is smaller than the pooling size of {}\n", previousLayer->outputWidth, previousLayer->outputHeight, poolingSize);
+        exit(1);
+    }
+
+    outputWidth = (previousLayer->outputWidth - poolingSize) / stride + 1;
+    outputHeight = (previousLayer->outputHeight - poolingSize) / stride + 1;
+    outputChannels = previousLayer->outputChannels;
+
+    outputs.reserve(outputWidth * outputHeight * outputChannels);
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.0f);
+    maxOffsets.reserve(outputWidth * outputHeight * outputChannels);
+    maxOffsets.assign(outputWidth * outputHeight * outputChannels, 0);
+
+    outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+}
+
+void MaxPooling::SetBatchSize(size_t batchSize)
+{
+    NeuralLayer::SetBatchSize(batchSize);
+
+    maxOffsets.resize(outputs.size());
+}
+
+size_t MaxPooling::PrintStats() const
+{
+    std::cout << std::format("MaxPooling [{}, {}, {}] {}\n", outputWidth, outputHeight, outputChannels, 0);
+
+    return 0;
+}
+
+LayerCost MaxPooling::Cost() const
+{
+    const size_t outputSize = outputWidth * outputHeight * outputChannels;
+
+    return EstimateCost(outputSize * poolingSize * poolingSize, 0, outputSize, 0);
+}
+
+void MaxPooling::SaveLayer(std::ofstream& file) const
+{
+    if (file.is_open()) {
+        NeuralLayer::SaveLayer(file);
+
+        file.write((const char*)&poolingSize, sizeof(poolingSize));
+        file.write((const char*)&stride, sizeof(stride));
+    }
+}
+
+/*
+* Calcules the max value based upon the previous layer's output. 
+* the i, j, and k values are given for this layer itself, the sample is the index of the sample in the batch.
+*/
+void MaxPooling::Max(size_t i, size_t j, size_t k, size_t sample)
+{
+    size_t inputK = (sample * previousLayer->outputChannels + k) * previousLayer->outputWidth * previousLayer->outputHeight;
+
+    float max = std::numeric_limits<float>::lowest(); //set to lowest possible value for floats.
+    uint8_t offset = 0;
+
+    for (size_t y = 0; y < poolingSize; y++) {
+        size_t inputY = j * stride + y;
+
+        for (size_t x = 0; x < poolingSize; x++) {
+            size_t inputX = i * stride + x;
+
+            size_t inputIndex = inputK + inputY * previousLayer->outputWidth + inputX;
+
+            if (max < previousLayer->outputs[inputIndex]) {
+                offset = static_cast<uint8_t>(y * poolingSize + x);
+                max = previousLayer->outputs[inputIndex];
+            }
+        }
+    }
+
+    size_t outputIndex = (sample * outputChannels + k) * outputWidth * outputHeight + j * outputWidth + i;
+    outputs[outputIndex] = max;
+    maxOffsets[outputIndex] = offset;
+}
+
+AveragePooling::AveragePooling(size_t poolSize, size_t stride, size_t padding) :
+    poolingSize(poolSize), stride(stride ? stride : poolSize), padding(padding)
+{
+    layerType = LayerTypes::AveragePoolingLayer;
+}
+
+AveragePooling::AveragePooling(std::ifstream& file)
+{
+    file.read((char*)&outputChannels, sizeof(outputChannels));
+    file.read((char*)&outputHeight, sizeof(outputHeight));
+    file.read((char*)&outputWidth, sizeof(outputWidth));
+    file.read((char*)&poolingSize, sizeof(poolingSize));
+    file.read((char*)&stride, sizeof(stride));
+    file.read((char*)&padding, sizeof(padding));
+    file.read((char*)&inputWidth, sizeof(inputWidth));
+    file.read((char*)&inputHeight, sizeof(inputHeight));
+
+    layerType = LayerTypes::AveragePoolingLayer;
+
+    CountWindows();
+
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+}
+
+void AveragePooling::CountWindows()
+{
+    auto inverseCounts = [this](size_t inputSize, size_t outputSize) {
+        std::vector<float> counts(outputSize);
+
+        for (size_t i = 0; i < outputSize; i++) {
+            const size_t begin = std::max(i * stride, padding), end = std::min(i * stride + poolingSize, inputSize + padding);
+            counts[i] = 1.f / static_cast<float>(end - begin);
+        }
+
+        return counts;
+    };
+
+    inverseRowCounts = inverseCounts(inputHeight, outputHeight);
+    inverseColumnCounts = inverseCounts(inputWidth, outputWidth);
+}
+
+/*
+* Every position in the window is added to all outputs at once, so the inner loops run over a row of the output, after which the sums are scaled.
+*/
+void AveragePooling::FeedForward()
+{
+    const size_t inputPlane = inputWidth * inputHeight, outputPlane = outputWidth * outputHeight;
+
+    for (size_t b = 0; b < batchSize; b++) {
+        for (size_t c = 0; c < outputChannels; c++) {
+            const float* input = previousLayer->outputs.data() + (b * outputChannels + c) * inputPlane;
+            float* output = outputs.data() + (b * outputChannels + c) * outputPlane;
+
+            std::fill(output, output + outputPlane, 0.f);
+
+            for (size_t ky = 0; ky < poolingSize; ky++) {
+                const auto [firstRow, lastRow] = ValidOutputs(ky, inputHeight, outputHeight, padding, stride);
+
+                for (size_t kx = 0; kx < poolingSize; kx++) {
+                    const auto [firstColumn, lastColumn] = ValidOutputs(kx, inputWidth, outputWidth, padding, stride);
+
+                    for (size_t j = firstRow; j < lastRow; j++) {
+                        const float* inputRow = input + (j * stride + ky - padding) * inputWidth;
+                        float* outputRow = output + j * outputWidth;
+
+                        for (size_t i = firstColumn; i < lastColumn; i++)
+                            outputRow[i] += inputRow[i * stride + kx - padding];
+                    }
+                }
+            }
+
+            for (size_t j = 0; j < outputHeight; j++) {
+                for (size_t i = 0; i < outputWidth; i++)
+                    output[j * outputWidth + i] *= inverseRowCounts[j] * inverseColumnCounts[i];
+            }
+        }
+    }
+}
+
+void AveragePooling::BackPropogate()
+{
+    if (!PropogatesToPreviousLayer())
+        return;
+
+    const size_t inputPlane = inputWidth * inputHeight, outputPlane = outputWidth * outputHeight;
+
+    std::fill(previousLayer->outputGradients.begin(), previousLayer->outputGradients.end(), 0.f);
+
+    for (size_t c = 0; c < outputChannels; c++) {
+        const float* gradients = outputGradients.data() + c * outputPlane;
+        float* inputGradients = previousLayer->outputGradients.data() + c * inputPlane;
+
+        for (size_t ky = 0; ky < poolingSize; ky++) {
+            const auto [firstRow, lastRow] = ValidOutputs(ky, inputHeight, outputHeight, padding, stride);
+
+            for (size_t kx = 0; kx < poolingSize; kx++) {
+                const auto [firstColumn, lastColumn] = ValidOutputs(kx, inputWidth, outputWidth, padding, stride);
+
+                for (size_t j = firstRow; j < lastRow; j++) {
+                    float* inputGradientRow = inputGradients + (j * stride + ky - padding) * inputWidth;
+                    const float* gradientRow = gradients + j * outputWidth;
+                    const float rowScale = inverseRowCounts[j];
+
+                    for (size_t i = firstColumn; i < lastColumn; i++)
+                        inputGradientRow[i * stride + kx - padding] += gradientRow[i] * rowScale * inverseColumnCounts[i];
+                }
+            }
+        }
+    }
+}
+
+void AveragePooling::Create(NeuralLayer* previousLayer)
+{
+    this->previousLayer = previousLayer;
+
+    if (poolingSize <= padding) {
+        std::cout << "Error AveragePooling::Create(), the padding has to be smaller than the pooling size\n";
+        exit(1);
+    }
+
+    inputWidth = previousLayer->outputWidth;
+    inputHeight = previousLayer->outputHeight;
+
+    outputWidth = (inputWidth + 2 * padding - poolingSize) / stride + 1;
+    outputHeight = (inputHeight + 2 * padding - poolingSize) / stride + 1;
+    outputChannels = previousLayer->outputChannels;
+
+    CountWindows();
+
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+}
+
+size_t AveragePooling::PrintStats() const
+{
+    std::cout << std::format("AveragePooling [{}, {}, {}] {}\n", outputWidth, outputHeight, outputChannels, 0);
+
+    return 0;
+}
+
+LayerCost AveragePooling::Cost() const
+{
+    const size_t macs = outputWidth * outputHeight * outputChannels * poolingSize * poolingSize;
+
+    return EstimateCost(macs, 0, macs, 0);
+}
+
+void AveragePooling::SaveLayer(std::ofstream& file) const
+{
+    if (file.is_open()) {
+        NeuralLayer::SaveLayer(file);
+
+        file.write((const char*)&poolingSize, sizeof(poolingSize));
+        file.write((const char*)&stride, sizeof(stride));
+        file.write((const char*)&padding, sizeof(padding));
+        file.write((const char*)&inputWidth, sizeof(inputWidth));
+        file.write((const char*)&inputHeight, sizeof(inputHeight));
+    }
+}
+
+GlobalAveragePooling::GlobalAveragePooling()
+{
+    layerType = LayerTypes::GlobalAveragePoolingLayer;
+}
+
+GlobalAveragePooling::GlobalAveragePooling(std::ifstream& file)
+{
+    file.read((char*)&outputChannels, sizeof(outputChannels));
+    file.read((char*)&outputHeight, sizeof(outputHeight));
+    file.read((char*)&outputWidth, sizeof(outputWidth));
+
+    layerType = LayerTypes::GlobalAveragePoolingLayer;
+
+    outputs.assign(outputChannels, 0.f);
+    outputGradients.assign(outputChannels, 0.f);
+}
+
+void GlobalAveragePooling::FeedForward()
+{
+    const size_t plane = previousLayer->outputWidth * previousLayer->outputHeight;
+    const float scale = 1.f / static_cast<float>(plane);
+
+    for (size_t b = 0; b < batchSize; b++) {
+        for (size_t c = 0; c < outputChannels; c++) {
+            const float* input = previousLayer->outputs.data() + (b * outputChannels + c) * plane;
+
+            outputs[b * outputChannels + c] = std::accumulate(input, input + plane, 0.f) * scale;
+        }
+    }
+}
+
+void GlobalAveragePooling::BackPropogate()
+{
+    if (!PropogatesToPreviousLayer())
+        return;
+
+    const size_t plane = previousLayer->outputWidth * previousLayer->outputHeight;
+    const float scale = 1.f / static_cast<float>(plane);
+
+    for (size_t c = 0; c < outputChannels; c++) {
+        float* inputGradients = previousLayer->outputGradients.data() + c * plane;
+
+        std::fill(inputGradients, inputGradients + plane, outputGradients[c] * scale);
+    }
+}
+
+void GlobalAveragePooling::Create(NeuralLayer* previousLayer)
+{
+    this->previousLayer = previousLayer;
+
+    outputWidth = 1;
+    outputHeight = 1;
+    outputChannels = previousLayer->outputChannels;
+
+    outputs.assign(outputChannels, 0.f);
+    outputGradients.assign(outputChannels, 0.f);
+}
+
+size_t GlobalAveragePooling::PrintStats() const
+{
+    std::cout << std::format("GlobalAveragePooling [{}, {}, {}] {}\n", outputWidth, outputHeight, outputChannels, 0);
+
+    return 0;
+}
+
+LayerCost GlobalAveragePooling::Cost() const
+{
+    const size_t inputs = previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels;
+
+    return EstimateCost(inputs, 0, inputs, 0);
+}
+
+FullyConnected::FullyConnected(size_t outputSize, std::string ActivationFunction)
+{
+    outputChannels = 1;
+    outputWidth = 1;
+    outputHeight = outputSize;
+
+    biasWeights.reserve(outputSize);
+
+    SetActivationFuction(ActivationFunction);
+
+    layerType = LayerTypes::FullyConnectedLayer;
+}
+
+FullyConnected::FullyConnected(std::ifstream& file, NeuralLayer* previousLayer)
+{
+    file.read((char*)&outputChannels, sizeof(outputChannels));
+    file.read((char*)&outputHeight, sizeof(outputHeight));
+    file.read((char*)&outputWidth, sizeof(outputWidth));
+
+    std::getline(file, ActivationFunction, '\0');
+
+    size_t size = 0;
+
+    file.read((char*)&size, sizeof(size));
+
+    weights.resize(size);
+    file.read((char*)weights.data(), size * sizeof(float));
+
+    file.read((char*)&size, sizeof(size));
+
+    biasWeights.resize(size);
+    biasGradients.assign(size, 0.f);
+
+    file.read((char*)biasWeights.data(), size * sizeof(float));
+
+    layerType = LayerTypes::FullyConnectedLayer;
+
+    SetActivationFuction(ActivationFunction);
+
+    outputs.assign(outputHeight, 0.f);
+    outputGradients.assign(outputHeight, 0.f);
+
+    if (previousLayer)
+        sizePreviousLayer = previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels;
+}
+
+/*
+* Every row of weights is used for all the samples in the batch before moving on to the next row,
+* thus the weights are only read from memory once per batch.
+* The output neurons are split over the threads, every thread reads only the rows of weights of its own neurons.
+*/
+void FullyConnected::FeedForward()
+{
+    WorkStealingPool::ParallelFor(outputHeight, sizePreviousLayer * batchSize, [this](size_t first, size_t last) {
+        FeedForward(first, last);
+    });
+
+    Activation(this);
+}
+
+void FullyConnected::FeedForward(size_t firstOutput, size_t lastOutput)
+{
+    const float* inputs = previousLayer->outputs.data();
+
+    for (size_t k = firstOutput; k < lastOutput; k++) {
+        const float* row = weights.data() + k * sizePreviousLayer;
+        size_t b = 0;
+
+        if (algorithm == BatchTiled) {
+            for (; b + 4 <= batchSize; b += 4) {
+                const float* inputs0 = inputs + b * sizePreviousLayer, *inputs1 = inputs0 + sizePreviousLayer;
+                const float* inputs2 = inputs1 + sizePreviousLayer, *inputs3 = inputs2 + sizePreviousLayer;
+                float Z0 = 0, Z1 = 0, Z2 = 0, Z3 = 0;
+
+                for (size_t j = 0; j < sizePreviousLayer; j++) {
+                    const float weight = row[j];
+
+                    Z0 += inputs0[j] * weight;
+                    Z1 += inputs1[j] * weight;
+                    Z2 += inputs2[j] * weight;
+                    Z3 += inputs3[j] * weight;
+                }
+
+                outputs[b * outputHeight + k] = Z0 + biasWeights[k];
+                outputs[(b + 1) * outputHeight + k] = Z1 + biasWeights[k];
+                outputs[(b + 2) * outputHeight + k] = Z2 + biasWeights[k];
+                outputs[(b + 3) * outputHeight + k] = Z3 + biasWeights[k];
+            }
+        }
+
+        for (; b < batchSize; b++) {
+            const float* sampleInputs = inputs + b * sizePreviousLayer;
+            float Z = 0;
+
+            if (algorithm == Unrolled) {
+                //Independent partial sums, so the additions do not wait on each other and can be vectorized.
+                float partial[8] = {};
+                size_t j = 0;
+
+                for (; j + 8 <= sizePreviousLayer; j += 8) {
+                    for (size_t l = 0; l < 8; l++)
+                        partial[l] += sampleInputs[j + l] * row[j + l];
+                }
+
+                for (; j < sizePreviousLayer; j++)
+                    Z += sampleInputs[j] * row[j];
+
+                Z += ((partial[0] + partial[1]) + (partial[2] + partial[3])) + ((partial[4] + partial[5]) + (partial[6] + partial[7]));
+            }
+            else {
+                for (size_t j = 0; j < sizePreviousLayer; j++) {
+                    Z += sampleInputs[j] * row[j];
+                }
+            }
+
+            Z += biasWeights[k];
+
+            outputs[b * outputHeight + k] = Z;
+        }
+    }
+}
+
+std::string FullyConnected::AlgorithmName(size_t algorithm) const
+{
+    switch (algorithm) {
+    case Unrolled:
+        return "unrolled";
+    case BatchTiled:
+        return "batch tiled";
+    default:
+        return "direct";
+    }
+}
+
+std::string FullyConnected::TuningKey() const
+{
+    return std::format("FullyConnected [{}] to [{}] batch {}", sizePreviousLayer, outputHeight, batchSize);
+}
+
+void FullyConnected::BackPropogate()
+{
+    //Gradient with respect to the output after activation
+    //Calculate the gradient with respect to the output based on the derivative of the used activation fucntion. 
+    ActivationDerivative(this);
+
+    //Gradient with respect to the bias
+
+    for (size_t i = 0; i < outputHeight; i++)
+        biasGradients[i] = outputGradients[i] + (accumulateGradients ? biasGradients[i] : 0.f);
+
+    /*
+    * The gradient with respect to the input and the update of the weights are done in one fused pass.
+    * The input gradient is accumulated from each weight before it is updated, so it still uses the old weights.
+    * The weights are walked in column tiles, so the part of the input gradient that is being accumulated stays in cache
+    * while every weight is only read from memory and written once. The gradient with respect to the weights is only stored
+    * when the gradients are accumulated.
+    */
+    const bool propogateInput = PropogatesToPreviousLayer();
+
+    if (propogateInput)
+        std::fill(previousLayer->outputGradients.begin(), previousLayer->outputGradients.end(), 0.f);
+
+    const float* inputs = previousLayer->outputs.data();
+    float* inputGradients = previousLayer->outputGradients.data();
+
+    for (size_t tileBegin = 0; tileBegin < sizePreviousLayer; tileBegin += backPropogateTileSize) {
+        const size_t tileEnd = std::min(tileBegin + backPropogateTileSize, sizePreviousLayer);
+
+        for (size_t k = 0; k < outputHeight; k++) {
+            const float gradient = outputGradients[k];
+
+            //A zero gradient, which happens a lot after a relu, changes neither the weights nor the input gradient.
+            if (gradient == 0.f)
+                continue;
+
+            float* row = weights.data() + k * sizePreviousLayer;
+
+            if (propogateInput) {
+                for (size_t j = tileBegin; j < tileEnd; j++)
+                    inputGradients[j] += gradient * row[j];
+            }
+
+            if (accumulateGradients) {
+                float* gradientRow = weightGradients.data() + k * sizePreviousLayer;
+
+                for (size_t j = tileBegin; j < tileEnd; j++)
+                    gradientRow[j] += gradient * inputs[j];
+            }
+            else if (!mask.empty()) {
+                const float step = learningRate * gradient;
+                const uint8_t* maskRow = mask.data() + k * sizePreviousLayer;
+
+                //Pruned weights are kept at zero.
+                for (size_t j = tileBegin; j < tileEnd; j++)
+                    row[j] = (row[j] - step * inputs[j]) * maskRow[j];
+            }
+            else {
+                const float step = learningRate * gradient;
+
+                for (size_t j = tileBegin; j < tileEnd; j++)
+                    row[j] -= step * inputs[j];
+            }
+        }
+    }
+
+    if (!accumulateGradients) {
+        for (size_t b = 0; b < outputHeight; b++) {
+            biasWeights[b] -= learningRate * biasGradients[b];
+        }
+    }
+}
+
+void FullyConnected::SetGradientAccumulation(bool accumulate)
+{
+    NeuralLayer::SetGradientAccumulation(accumulate);
+
+    //The gradients of the weights are only stored while they are accumulated.
+    if (accumulate)
+        weightGradients.assign(weights.size(), 0.f);
+    else
+        std::vector<float>().swap(weightGradients);
+
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+void FullyConnected::ApplyGradients(float scale)
+{
+    const float step = learningRate * scale;
+
+    for (size_t i = 0; i < weights.size(); i++)
+        weights[i] -= step * weightGradients[i];
+
+    for (size_t i = 0; i < mask.size(); i++)
+        weights[i] *= mask[i];
+
+    for (size_t b = 0; b < biasWeights.size(); b++)
+        biasWeights[b] -= step * biasGradients[b];
+
+    std::fill(weightGradients.begin(), weightGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+void FullyConnected::Prune(float sparsity)
+{
+    const size_t prunedAmount = std::min(static_cast<size_t>(sparsity * static_cast<float>(weights.size())), weights.size());
+
+    mask.assign(weights.size(), 1);
+
+    if (prunedAmount == 0)
+        return;
+
+    //The magnitude of the prunedAmount-th smallest weight is the threshold, weights that are already zero are pruned first.
+    std::vector<float> magnitudes(weights.size());
+    std::transform(weights.begin(), weights.end(), magnitudes.begin(), [](float weight) { return std::abs(weight); });
+    std::nth_element(magnitudes.begin(), magnitudes.begin() + (prunedAmount - 1), magnitudes.end());
+
+    const float threshold = magnitudes[prunedAmount - 1];
+    size_t pruned = 0;
+
+    for (size_t i = 0; i < weights.size() && pruned < prunedAmount; i++) {
+        if (std::abs(weights[i]) <= threshold) {
+            weights[i] = 0.f;
+            mask[i] = 0;
+            pruned++;
+        }
+    }
+}
+
+std::vector<std::span<float>> FullyConnected::Parameters()
+{
+    return { weights, biasWeights };
+}
+
+std::vector<std::span<float>> FullyConnected::Gradients()
+{
+    return { weightGradients, biasGradients };
+}
+
+void FullyConnected::Create(NeuralLayer* previousLayer)
+{
+    this->previousLayer = previousLayer;
+    sizePreviousLayer = previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels;
+
+    weights.reserve(outputHeight * sizePreviousLayer);
+    outputs.assign(outputHeight, 0.f);
+
+    outputGradients.assign(outputHeight, 0.f);
+    biasGradients.assign(outputHeight, 0.f);
+
+    InitWeights(weights, outputHeight * sizePreviousLayer, sizePreviousLayer);
+    InitWeights(biasWeights, outputHeight,sizePreviousLayer);
+}
+
+size_t FullyConnected::PrintStats() const
+{
+    size_t params = weights.size() + biasWeights.size();
+
+    std::cout << std::format("FullyConnected [{}] {}\n", outputHeight, params);
+
+    return params;
+}
+
+LayerCost FullyConnected::Cost() const
+{
+    return EstimateCost(weights.size(), weights.size(), weights.size(), (weights.size() + biasWeights.size()) * sizeof(float));
+}
+
+void FullyConnected::SaveLayer(std::ofstream& file) const
+{
+    if (file.is_open()) {
+        NeuralLayer::SaveLayer(file);
+
+        file << ActivationFunction << '\0';
+
+        size_t size = weights.size();
+        file.write((const char*)&size, sizeof(size_t));
+        file.write((const char*)weights.data(), size * sizeof(float));
+
+        size = biasWeights.size();
+        file.write((const char*)&size, sizeof(size_t));
+        file.write((const char*)biasWeights.data(), size * sizeof(float));
+    }
+}
+
+SparseFullyConnected::SparseFullyConnected(const FullyConnected& layer) :
+    NeuralLayer(layer.outputWidth, layer.outputHeight, layer.outputChannels), biasWeights(layer.biasWeights), sizePreviousLayer(layer.InputSize())
+{
+    previousLayer = layer.previousLayer;
+    learningRate = layer.learningRate;
+    batchSize = layer.batchSize;
+    layerType = LayerTypes::SparseFullyConnectedLayer;
+
+    SetActivationFuction(layer.ActivationFunction);
+
+    rowOffsets.reserve(outputHeight + 1);
+    rowOffsets.push_back(0);
+
+    for (size_t k = 0; k < outputHeight; k++) {
+        for (size_t j = 0; j < sizePreviousLayer; j++) {
+            const float weight = layer.weights[k * sizePreviousLayer + j];
+
+            if (weight != 0.f) {
+                weights.push_back(weight);
+                columns.push_back(static_cast<uint32_t>(j));
+            }
+        }
 
-    for (int i = 0; i < size; i++) {
-        float weight;
-        file.read((char*)&weight, sizeof(weight));
-        weights.push_back(weight);
+        rowOffsets.push_back(static_cast<uint32_t>(weights.size()));
     }
 
+    biasGradients.assign(outputHeight, 0.f);
+    outputs.assign(batchSize * outputHeight, 0.f);
+    outputGradients.assign(outputHeight, 0.f);
+}
+
+SparseFullyConnected::SparseFullyConnected(std::ifstream& file)
+{
+    file.read((char*)&outputChannels, sizeof(outputChannels));
+    file.read((char*)&outputHeight, sizeof(outputHeight));
+    file.read((char*)&outputWidth, sizeof(outputWidth));
+
+    std::getline(file, ActivationFunction, '\0');
+
+    file.read((char*)&sizePreviousLayer, sizeof(sizePreviousLayer));
+
+    size_t size = 0;
+    file.read((char*)&size, sizeof(size));
+
+    rowOffsets.resize(outputHeight + 1);
+    columns.resize(size);
+    weights.resize(size);
+
+    file.read((char*)rowOffsets.data(), rowOffsets.size() * sizeof(uint32_t));
+    file.read((char*)columns.data(), size * sizeof(uint32_t));
+    file.read((char*)weights.data(), size * sizeof(float));
+
     file.read((char*)&size, sizeof(size));
 
-    biasWeights.reserve(size);
+    biasWeights.resize(size);
     biasGradients.assign(size, 0.f);
 
-    for (int i = 0; i < size; i++) {
-        float weight;
-        file.read((char*)&weight, sizeof(weight));
-        biasWeights.push_back(weight);
-    }
+    file.read((char*)biasWeights.data(), size * sizeof(float));
 
-    layerType = LayerTypes::FullyConnectedLayer;
+    layerType = LayerTypes::SparseFullyConnectedLayer;
 
     SetActivationFuction(ActivationFunction);
 
     outputs.assign(outputHeight, 0.f);
     outputGradients.assign(outputHeight, 0.f);
-
-    if (previousLayer)
-        sizePreviousLayer = previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels;
 }
 
-void FullyConnected::FeedForward()
+void SparseFullyConnected::FeedForward()
 {
     for (size_t k = 0; k < outputHeight; k++) {
-        float Z = 0;
-
-        for (size_t j = 0; j < sizePreviousLayer; j++) {
-            Z += previousLayer->outputs[j] * weights[k * sizePreviousLayer + j];
-        }
+        for (size_t b = 0; b < batchSize; b++) {
+            const float* inputs = previousLayer->outputs.data() + b * sizePreviousLayer;
+            float Z = biasWeights[k];
 
-        Z += biasWeights[k];
+            for (size_t i = rowOffsets[k]; i < rowOffsets[k + 1]; i++) {
+                Z += weights[i] * inputs[columns[i]];
+            }
 
-        outputs[k] = Z;
+            outputs[b * outputHeight + k] = Z;
+        }
     }
 
     Activation(this);
 }
 
-void FullyConnected::BackPropogate()
+/*
+* Works like the fused backpropogation of the FullyConnected layer, but only for the weights that are stored.
+* Thus the pruned weights stay zero.
+*/
+void SparseFullyConnected::BackPropogate()
 {
-    //Gradient with respect to the output after activation
-    //Calculate the gradient with respect to the output based on the derivative of the used activation fucntion. 
     ActivationDerivative(this);
 
-    //Gradient with respect to the weights
+    for (size_t i = 0; i < outputHeight; i++)
+        biasGradients[i] = outputGradients[i] + (accumulateGradients ? biasGradients[i] : 0.f);
 
-    for (size_t k = 0; k < outputHeight; k++) {
-        for (size_t j = 0; j < sizePreviousLayer; j++) {
-            weightGradients[k * sizePreviousLayer + j] = previousLayer->outputs[j] * outputGradients[k];
-        }
-    }
+    const bool propogateInput = PropogatesToPreviousLayer();
 
-    //Gradient with respect to the bias
+    if (propogateInput)
+        std::fill(previousLayer->outputGradients.begin(), previousLayer->outputGradients.end(), 0.f);
 
-    for (size_t i = 0; i < outputHeight; i++)
-        biasGradients[i] = outputGradients[i];
+    const float* inputs = previousLayer->outputs.data();
+    float* inputGradients = previousLayer->outputGradients.data();
 
-    //Gradient with respect to the input
+    for (size_t k = 0; k < outputHeight; k++) {
+        const float gradient = outputGradients[k];
 
-    for (size_t j = 0; j < sizePreviousLayer; j++) {
-        float gradient = 0.f;
+        if (gradient == 0.f)
+            continue;
 
-        for (size_t k = 0; k < outputHeight; k++) {
-            gradient += outputGradients[k] * weights[k * sizePreviousLayer + j];
-        }
+        const float step = learningRate * gradient;
 
-        previousLayer->outputGradients[j] = gradient;
-    }
+        for (size_t i = rowOffsets[k]; i < rowOffsets[k + 1]; i++) {
+            const uint32_t j = columns[i];
 
+            if (propogateInput)
+                inputGradients[j] += gradient * weights[i];
 
-    //update all the weights based upon the gradients
-    for (size_t k = 0; k < outputHeight * sizePreviousLayer; k++) {
-        weights[k] -= learningRate * weightGradients[k];
+            if (accumulateGradients)
+                weightGradients[i] += gradient * inputs[j];
+            else
+                weights[i] -= step * inputs[j];
+        }
     }
 
-    for (size_t b = 0; b < outputHeight; b++) {
-        biasWeights[b] -= learningRate * biasGradients[b];
+    if (!accumulateGradients) {
+        for (size_t b = 0; b < outputHeight; b++) {
+            biasWeights[b] -= learningRate * biasGradients[b];
+        }
     }
 }
 
-void FullyConnected::Create(NeuralLayer* previousLayer)
+void SparseFullyConnected::Create(NeuralLayer* previousLayer)
 {
     this->previousLayer = previousLayer;
-    sizePreviousLayer = previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels;
 
-    weights.reserve(outputHeight * sizePreviousLayer);
-    outputs.assign(outputHeight, 0.f);
+    if (previousLayer->outputWidth * previousLayer->outputHeight * previousLayer->outputChannels != sizePreviousLayer) {
+        std::cout << "Error SparseFullyConnected::Create(), the previous layer does not have " << sizePreviousLayer << " outputs\n";
+        exit(1);
+    }
 
+    outputs.assign(outputHeight, 0.f);
     outputGradients.assign(outputHeight, 0.f);
-    weightGradients.assign(outputHeight * sizePreviousLayer, 0.f);
     biasGradients.assign(outputHeight, 0.f);
-
-    InitWeights(weights, outputHeight * sizePreviousLayer, sizePreviousLayer);
-    InitWeights(biasWeights, outputHeight,sizePreviousLayer);
 }
 
-size_t FullyConnected::PrintStats() const
+size_t SparseFullyConnected::PrintStats() const
 {
     size_t params = weights.size() + biasWeights.size();
+    const float density = static_cast<float>(weights.size()) / static_cast<float>(outputHeight * sizePreviousLayer) * 100.f;
 
-    std::cout << std::format("FullyConnected [{}] {}\n", outputHeight, params);
+    std::cout << std::format("SparseFullyConnected [{}] {} ({:.1f}% dense)\n", outputHeight, params, density);
 
     return params;
 }
 
-void FullyConnected::SaveLayer(std::ofstream& file) const
+LayerCost SparseFullyConnected::Cost() const
+{
+    //Every weight is stored together with the index of its input.
+    const size_t parameterBytes = (weights.size() + biasWeights.size()) * sizeof(float) + (columns.size() + rowOffsets.size()) * sizeof(uint32_t);
+
+    return EstimateCost(weights.size(), weights.size(), weights.size(), parameterBytes);
+}
+
+void SparseFullyConnected::SaveLayer(std::ofstream& file) const
 {
     if (file.is_open()) {
         NeuralLayer::SaveLayer(file);
 
         file << ActivationFunction << '\0';
 
-        size_t size = weights.size();
-        file.write((const char*)&size, sizeof(size_t));
+        file.write((const char*)&sizePreviousLayer, sizeof(sizePreviousLayer));
 
-        for (const auto& weight : weights)
-            file.write((const char*)&weight, sizeof(weight));
+        size_t size = weights.size();
+        file.write((const char*)&size, sizeof(size));
+        file.write((const char*)rowOffsets.data(), rowOffsets.size() * sizeof(uint32_t));
+        file.write((const char*)columns.data(), size * sizeof(uint32_t));
+        file.write((const char*)weights.data(), size * sizeof(float));
 
         size = biasWeights.size();
-        file.write((const char*)&size, sizeof(size_t));
+        file.write((const char*)&size, sizeof(size));
+        file.write((const char*)biasWeights.data(), size * sizeof(float));
+    }
+}
+
+void SparseFullyConnected::SetGradientAccumulation(bool accumulate)
+{
+    NeuralLayer::SetGradientAccumulation(accumulate);
+
+    if (accumulate)
+        weightGradients.assign(weights.size(), 0.f);
+    else
+        std::vector<float>().swap(weightGradients);
+
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+void SparseFullyConnected::ApplyGradients(float scale)
+{
+    const float step = learningRate * scale;
+
+    for (size_t i = 0; i < weights.size(); i++)
+        weights[i] -= step * weightGradients[i];
+
+    for (size_t b = 0; b < biasWeights.size(); b++)
+        biasWeights[b] -= step * biasGradients[b];
+
+    std::fill(weightGradients.begin(), weightGradients.end(), 0.f);
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.f);
+}
+
+std::vector<std::span<float>> SparseFullyConnected::Parameters()
+{
+    return { weights, biasWeights };
+}
+
+std::vector<std::span<float>> SparseFullyConnected::Gradients()
+{
+    return { weightGradients, biasGradients };
+}
+
+BatchNorm::BatchNorm(std::string ActivationFunction, float momentum) :
+    momentum(momentum)
+{
+    layerType = LayerTypes::BatchNormLayer;
+
+    SetActivationFuction(ActivationFunction);
+}
+
+BatchNorm::BatchNorm(std::ifstream& file)
+{
+    file.read((char*)&outputChannels, sizeof(outputChannels));
+    file.read((char*)&outputHeight, sizeof(outputHeight));
+    file.read((char*)&outputWidth, sizeof(outputWidth));
+
+    std::getline(file, ActivationFunction, '\0');
+
+    file.read((char*)&momentum, sizeof(momentum));
+    file.read((char*)&features, sizeof(features));
+
+    for (auto* values : { &gamma, &beta, &runningMean, &runningVariance }) {
+        values->resize(features);
+        file.read((char*)values->data(), features * sizeof(float));
+    }
+
+    layerType = LayerTypes::BatchNormLayer;
+
+    SetActivationFuction(ActivationFunction);
+
+    spatialSize = outputWidth * outputHeight * outputChannels / features;
+
+    gammaGradients.assign(features, 0.f);
+    betaGradients.assign(features, 0.f);
+    correction.assign(features, 1.f);
+    shift.assign(features, 0.f);
+    inverseDeviation.assign(features, 1.f);
+
+    outputs.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    outputGradients.assign(outputs.size(), 0.f);
+    normalized.assign(outputs.size(), 0.f);
+}
+
+void BatchNorm::Create(NeuralLayer* previousLayer)
+{
+    this->previousLayer = previousLayer;
+
+    outputWidth = previousLayer->outputWidth;
+    outputHeight = previousLayer->outputHeight;
+    outputChannels = previousLayer->outputChannels;
+
+    //A FullyConnected layer stores its outputs as a column, every output is a feature.
+    const bool column = outputWidth == 1 && outputChannels == 1;
+    features = column ? outputHeight : outputChannels;
+    spatialSize = column ? 1 : outputWidth * outputHeight;
+
+    gamma.assign(features, 1.f);
+    beta.assign(features, 0.f);
+    runningMean.assign(features, 0.f);
+    runningVariance.assign(features, 1.f);
+
+    gammaGradients.assign(features, 0.f);
+    betaGradients.assign(features, 0.f);
+    correction.assign(features, 1.f);
+    shift.assign(features, 0.f);
+    inverseDeviation.assign(features, 1.f);
+
+    outputs.assign(batchSize * outputWidth * outputHeight * outputChannels, 0.f);
+    outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.f);
+    normalized.assign(outputs.size(), 0.f);
+}
+
+void BatchNorm::FeedForward()
+{
+    const float* inputs = previousLayer->outputs.data();
+    const size_t sampleSize = features * spatialSize;
+    const size_t count = batchSize * spatialSize;
+
+    batchStatistics = training && !frozen && count > 1;
+
+    for (size_t f = 0; f < features; f++) {
+        const float deviation = std::sqrt(runningVariance[f] + epsilon);
+        float mean = runningMean[f];
+
+        if (batchStatistics) {
+            float sum = 0.f, squaredSum = 0.f;
+
+            for (size_t b = 0; b < batchSize; b++) {
+                for (size_t i = 0; i < spatialSize; i++) {
+                    const float value = inputs[b * sampleSize + f * spatialSize + i];
+                    sum += value;
+                    squaredSum += value * value;
+                }
+            }
+
+            mean = sum / static_cast<float>(count);
+            const float variance = std::max(squaredSum / static_cast<float>(count) - mean * mean, 0.f);
+            const float batchDeviation = std::sqrt(variance + epsilon);
+
+            //The correction makes the outputs equal to those normalized by the running averages, within the clipping limits.
+            correction[f] = std::clamp(batchDeviation / deviation, 1.f / maxCorrection, maxCorrection);
+            shift[f] = std::clamp((mean - runningMean[f]) / deviation, -maxShift, maxShift);
+            inverseDeviation[f] = 1.f / batchDeviation;
+
+            runningMean[f] += momentum * (mean - runningMean[f]);
+            runningVariance[f] += momentum * (variance * static_cast<float>(count) / static_cast<float>(count - 1) - runningVariance[f]);
+        }
+        else {
+            correction[f] = 1.f;
+            shift[f] = 0.f;
+            inverseDeviation[f] = 1.f / deviation;
+
+            //A single value updates the running averages by itself.
+            if (training && !frozen) {
+                const float difference = inputs[f * spatialSize] - runningMean[f];
+
+                runningMean[f] += momentum * difference;
+                runningVariance[f] += momentum * (difference * difference - runningVariance[f]);
+            }
+        }
+
+        for (size_t b = 0; b < batchSize; b++) {
+            for (size_t i = 0; i < spatialSize; i++) {
+                const size_t index = b * sampleSize + f * spatialSize + i;
+
+                normalized[index] = (inputs[index] - mean) * inverseDeviation[f];
+                outputs[index] = gamma[f] * (normalized[index] * correction[f] + shift[f]) + beta[f];
+            }
+        }
+    }
+
+    Activation(this);
+}
+
+void BatchNorm::BackPropogate()
+{
+    ActivationDerivative(this);
+
+    const bool propogateInput = PropogatesToPreviousLayer();
+
+    for (size_t f = 0; f < features; f++) {
+        const float* gradients = outputGradients.data() + f * spatialSize;
+        const float* values = normalized.data() + f * spatialSize;
+
+        float gammaGradient = 0.f, betaGradient = 0.f, normalizedSum = 0.f, productSum = 0.f;
+
+        for (size_t i = 0; i < spatialSize; i++) {
+            gammaGradient += gradients[i] * (values[i] * correction[f] + shift[f]);
+            betaGradient += gradients[i];
+
+            const float normalizedGradient = gradients[i] * gamma[f] * correction[f];
+            normalizedSum += normalizedGradient;
+            productSum += normalizedGradient * values[i];
+        }
+
+        if (propogateInput) {
+            float* inputGradients = previousLayer->outputGradients.data() + f * spatialSize;
+
+            //With batch statistics the mean and deviation depend on every input, otherwise they are constants.
+            if (batchStatistics) {
+                const float size = static_cast<float>(spatialSize);
 
-        for (const auto& weight : biasWeights)
-            file.write((const char*)&weight, sizeof(weight));
+                for (size_t i = 0; i < spatialSize; i++)
+                    inputGradients[i] = inverseDeviation[f] / size * (size * gradients[i] * gamma[f] * correction[f] - normalizedSum - values[i] * productSum);
+            }
+            else {
+                for (size_t i = 0; i < spatialSize; i++)
+                    inputGradients[i] = gradients[i] * gamma[f] * inverseDeviation[f];
+            }
+        }
+
+        if (accumulateGradients) {
+            gammaGradients[f] += gammaGradient;
+            betaGradients[f] += betaGradient;
+        }
+        else {
+            gamma[f] -= learningRate * gammaGradient;
+            beta[f] -= learningRate * betaGradient;
+        }
+    }
+}
+
+size_t BatchNorm::PrintStats() const
+{
+    size_t params = gamma.size() + beta.size();
+
+    std::cout << std::format("BatchNorm [{}] {}\n", features, params);
+
+    return params;
+}
+
+LayerCost BatchNorm::Cost() const
+{
+    const size_t outputSize = outputWidth * outputHeight * outputChannels;
+
+    //Normalizing, scaling and shifting, and for the gradients the sums over the features and the input gradients.
+    return EstimateCost(2 * outputSize, 2 * outputSize, 3 * outputSize, (gamma.size() + beta.size()) * sizeof(float));
+}
+
+void BatchNorm::SaveLayer(std::ofstream& file) const
+{
+    if (file.is_open()) {
+        NeuralLayer::SaveLayer(file);
+
+        file << ActivationFunction << '\0';
+
+        file.write((const char*)&momentum, sizeof(momentum));
+        file.write((const char*)&features, sizeof(features));
+
+        for (const auto* values : { &gamma, &beta, &runningMean, &runningVariance })
+            file.write((const char*)values->data(), features * sizeof(float));
+    }
+}
+
+void BatchNorm::SetBatchSize(size_t batchSize)
+{
+    NeuralLayer::SetBatchSize(batchSize);
+
+    normalized.resize(outputs.size());
+}
+
+void BatchNorm::SetGradientAccumulation(bool accumulate)
+{
+    NeuralLayer::SetGradientAccumulation(accumulate);
+
+    std::fill(gammaGradients.begin(), gammaGradients.end(), 0.f);
+    std::fill(betaGradients.begin(), betaGradients.end(), 0.f);
+}
+
+void BatchNorm::ApplyGradients(float scale)
+{
+    const float step = learningRate * scale;
+
+    for (size_t f = 0; f < features; f++) {
+        gamma[f] -= step * gammaGradients[f];
+        beta[f] -= step * betaGradients[f];
+    }
+
+    std::fill(gammaGradients.begin(), gammaGradients.end(), 0.f);
+    std::fill(betaGradients.begin(), betaGradients.end(), 0.f);
+}
+
+std::vector<std::span<float>> BatchNorm::Parameters()
+{
+    return { gamma, beta };
+}
+
+std::vector<std::span<float>> BatchNorm::Gradients()
+{
+    return { gammaGradients, betaGradients };
+}
+
+bool BatchNorm::FoldIntoPreviousLayer() const
+{
+    if (previousLayer->ActivationFunction != "linear")
+        return false;
+
+    std::span<float> weights, bias;
+
+    if (previousLayer->layerType == LayerTypes::ConvolutionLayer) {
+        weights = static_cast<Convolution*>(previousLayer)->kernelWeights;
+        bias = static_cast<Convolution*>(previousLayer)->biasWeights;
+    }
+    else if (previousLayer->layerType == LayerTypes::FullyConnectedLayer) {
+        weights = static_cast<FullyConnected*>(previousLayer)->weights;
+        bias = static_cast<FullyConnected*>(previousLayer)->biasWeights;
+    }
+    else if (previousLayer->layerType == LayerTypes::DepthwiseConvolutionLayer) {
+        weights = static_cast<DepthwiseConvolution*>(previousLayer)->kernelWeights;
+        bias = static_cast<DepthwiseConvolution*>(previousLayer)->biasWeights;
+    }
+    else if (previousLayer->layerType == LayerTypes::PointwiseConvolutionLayer) {
+        weights = static_cast<PointwiseConvolution*>(previousLayer)->kernelWeights;
+        bias = static_cast<PointwiseConvolution*>(previousLayer)->biasWeights;
+    }
+    else {
+        return false;
     }
-}
\ No newline at end of file
+
+    //Every feature is an output channel of a convolution or an output of a FullyConnected layer, with its weights after each other.
+    const size_t weightsPerFeature = weights.size() / features;
+
+    for (size_t f = 0; f < features; f++) {
+        const float scale = gamma[f] / std::sqrt(runningVariance[f] + epsilon);
+
+        for (size_t i = 0; i < weightsPerFeature; i++)
+            weights[f * weightsPerFeature + i] *= scale;
+
+        bias[f] = (bias[f] - runningMean[f]) * scale + beta[f];
+    }
+
+    previousLayer->SetActivationFuction(ActivationFunction);
+
+    return true;
+}
@@ -3,8 +3,23 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <span>
 
-enum LayerTypes {BaseLayer, InputLayer, ConvolutionLayer, MaxPoolingLayer, FullyConnectedLayer};
+enum LayerTypes {BaseLayer, InputLayer, ConvolutionLayer, MaxPoolingLayer, FullyConnectedLayer, SparseFullyConnectedLayer, BatchNormLayer, DepthwiseConvolutionLayer, PointwiseConvolutionLayer, AveragePoolingLayer, GlobalAveragePoolingLayer};
+
+/*
+* The work and memory traffic of a layer for a single sample, comparisons and additions of pooling layers count as multiply adds.
+* The bytes assume every input, output, gradient and weight is moved between the memory and the caches once per pass.
+*/
+struct LayerCost
+{
+    size_t forwardMACs = 0, backwardMACs = 0;
+    size_t forwardBytesRead = 0, forwardBytesWritten = 0;
+    size_t backwardBytesRead = 0, backwardBytesWritten = 0;
+
+    //The outputs and output gradients of a sample, and the weights of the layer without their gradients.
+    size_t activationMemory = 0, parameterMemory = 0;
+};
 
 class NeuralLayer
 {
@@ -18,6 +33,12 @@ public:
     virtual void BackPropogate() = 0;
     virtual void Create(NeuralLayer* previousLayer) = 0;
     virtual size_t PrintStats() const = 0;
+    virtual LayerCost Cost() const = 0;
+
+    /*
+    * Returns a copy of this layer including its weights and buffers, the previous layer still points to the original network.
+    */
+    virtual NeuralLayer* Clone() const = 0;
 
     void SetActivationFuction(std::string ActivationFunction);
 
@@ -30,20 +51,70 @@ public:
     static void SoftMax(NeuralLayer* NL);
     static void SoftMaxDerivative(NeuralLayer* NL);
 
+    //The "linear" activation leaves the outputs as they are, used before a BatchNorm layer.
+    static void Linear(NeuralLayer*) {}
+    static void LinearDerivative(NeuralLayer*) {}
+
     virtual void SaveLayer(std::ofstream& file) const;
 
+    /*
+    * Sets the amount of samples that are fed forward at once, the outputs of the samples are stored after each other.
+    * Backpropogation always uses a batch size of 1. Shrinking the batch size never allocates memory.
+    */
+    virtual void SetBatchSize(size_t batchSize);
+
+    /*
+    * While the gradients are accumulated, BackPropogate adds the gradients of the weights to the gradient buffers instead of updating the weights.
+    * ApplyGradients then updates the weights with the accumulated gradients times the scale, and resets the gradients.
+    * Used by data parallel training, which averages the accumulated gradients over all processes before they are applied.
+    */
+    virtual void SetGradientAccumulation(bool accumulate);
+    virtual void ApplyGradients(float) {}
+
+    //The trainable weights of the layer and their gradients, in the same order.
+    virtual std::vector<std::span<float>> Parameters() { return {}; }
+    virtual std::vector<std::span<float>> Gradients() { return {}; }
+
+    /*
+    * Layers that can feed forward with several algorithms, which compute the same outputs up to rounding, are tuned by NeuralNetwork::Tune.
+    * The fastest algorithm depends on the shape of the layer and the processor, the tuning key describes the shape and the batch size.
+    */
+    virtual size_t AlgorithmCount() const { return 1; }
+    virtual std::string AlgorithmName(size_t) const { return "default"; }
+    virtual void SetAlgorithm(size_t) {}
+    virtual std::string TuningKey() const { return {}; }
+
+    //The gradients of the outputs of the previous layer are not needed when it is the input, or when it is frozen.
+    bool PropogatesToPreviousLayer() const { return previousLayer->layerType != LayerTypes::InputLayer && !previousLayer->frozen; }
+
     NeuralLayer(size_t width, size_t height, size_t channels) :
         outputWidth(width), outputHeight(height), outputChannels(channels) {}
     NeuralLayer() :
         outputWidth(0), outputHeight(0), outputChannels(0) { }
+    virtual ~NeuralLayer() = default;
 
     void (*Activation)(NeuralLayer*) = nullptr;
     void (*ActivationDerivative)(NeuralLayer*) = nullptr;
 
     float learningRate = 0.000015f;
+    size_t batchSize = 1;
+    bool accumulateGradients = false;
+
+    //Frozen layers are not trained, see NeuralNetwork::SetFrozen.
+    bool frozen = false;
+
+    //Set while the network is trained, layers such as BatchNorm behave differently during training and inference.
+    bool training = false;
 
     uint8_t layerType = BaseLayer;
     std::string ActivationFunction;
+
+protected:
+    /*
+    * Fills in the bytes that are moved and the memory from the multiply adds and the size of the weights of the layer.
+    * The input gradients are only counted when they are propogated to the previous layer.
+    */
+    LayerCost EstimateCost(size_t forwardMACs, size_t weightGradientMACs, size_t inputGradientMACs, size_t parameterBytes) const;
 };
 
 class Input : public NeuralLayer
@@ -56,6 +127,8 @@ public:
     void BackPropogate() {};
     void Create(NeuralLayer* previousLayer) { outputGradients.assign(outputWidth * outputHeight * outputChannels, 0.0f); };
     size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new Input(*this); }
 };
 
 class Convolution : public NeuralLayer
@@ -76,46 +149,191 @@ public:
     */
     std::vector<float> biasWeights, biasGradients;
 
+    /*
+    * Direct computes every output separately, Unrolled adds every kernel weight to a row of outputs at once,
+    * and Lowered copies the windows of the input to the columns of a matrix and multiplies the kernels with it.
+    */
+    enum Algorithm : size_t { Direct, Unrolled, Lowered, AlgorithmAmount };
+
     Convolution(size_t amount, size_t kernelSize, size_t padding = 0, size_t stride = 1, std::string ActivationFunction = "relu");
-    Convolution(std::ifstream& file);
+    Convolution(std::ifstream& file, size_t version);
 
     void FeedForward();
     void BackPropogate();
     void Create(NeuralLayer* previousLayer);
     size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new Convolution(*this); }
 
     void SaveLayer(std::ofstream& file) const;
 
+    void SetGradientAccumulation(bool accumulate);
+    void ApplyGradients(float scale);
+    std::vector<std::span<float>> Parameters();
+    std::vector<std::span<float>> Gradients();
+
+    size_t AlgorithmCount() const { return AlgorithmAmount; }
+    std::string AlgorithmName(size_t algorithm) const;
+    void SetAlgorithm(size_t algorithm);
+    std::string TuningKey() const;
+
 private:
-    float CrossCorrelation(size_t beginX, size_t beginY, size_t kernel = 0) const;
+    void FeedForwardDirect();
+    void FeedForwardUnrolled();
+    void FeedForwardLowered();
+
+    float CrossCorrelation(size_t beginX, size_t beginY, size_t kernel, size_t sample) const;
     float WeightGradient(size_t beginX, size_t beginY, size_t kernel, size_t channel) const;
-    inline float CalculateInputGradient(size_t c, size_t x, size_t y) const;
-    inline float GetOutputGradientForBackPropogate(size_t x, size_t y) const;
+    void InputGradients();
+
+    size_t algorithm = Direct;
+
+    //The lowered input of a single sample, channels * kernelSize * kernelSize rows of all the output positions. Only allocated for the Lowered algorithm.
+    std::vector<float> loweredInputs;
+};
+
+/*
+* Convolves every channel with its own kernel, instead of combining all channels like a Convolution does.
+* Followed by a PointwiseConvolution it forms a depthwise separable convolution, which needs channels * K * K + channels * kernels
+* multiply adds per output position instead of the channels * kernels * K * K of a Convolution.
+*/
+class DepthwiseConvolution : public NeuralLayer
+{
+public:
+    size_t kernelSize, padding, stride;
+
+    //The kernel of every channel after each other, stored in rows.
+    std::vector<float> kernelWeights, kernelGradients;
+    std::vector<float> biasWeights, biasGradients;
+
+    DepthwiseConvolution(size_t kernelSize, size_t padding = 0, size_t stride = 1, std::string ActivationFunction = "relu");
+    DepthwiseConvolution(std::ifstream& file);
+
+    void FeedForward();
+    void BackPropogate();
+    void Create(NeuralLayer* previousLayer);
+    size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new DepthwiseConvolution(*this); }
+
+    void SaveLayer(std::ofstream& file) const;
+
+    void SetGradientAccumulation(bool accumulate);
+    void ApplyGradients(float scale);
+    std::vector<std::span<float>> Parameters();
+    std::vector<std::span<float>> Gradients();
+};
+
+/*
+* A 1x1 convolution, which combines the channels at every position. It is computed as a matrix multiplication of the
+* kernels x channels weights with the channels x positions inputs.
+*/
+class PointwiseConvolution : public NeuralLayer
+{
+public:
+    size_t kernelAmount;
+
+    //The weights of every kernel for all the channels after each other.
+    std::vector<float> kernelWeights, kernelGradients;
+    std::vector<float> biasWeights, biasGradients;
+
+    PointwiseConvolution(size_t amount, std::string ActivationFunction = "relu");
+    PointwiseConvolution(std::ifstream& file);
+
+    void FeedForward();
+    void BackPropogate();
+    void Create(NeuralLayer* previousLayer);
+    size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new PointwiseConvolution(*this); }
+
+    void SaveLayer(std::ofstream& file) const;
+
+    void SetGradientAccumulation(bool accumulate);
+    void ApplyGradients(float scale);
+    std::vector<std::span<float>> Parameters();
+    std::vector<std::span<float>> Gradients();
 };
 
 class MaxPooling : public NeuralLayer
 {
 public:
-    size_t poolingSize;
+    size_t poolingSize, stride;
 
-    MaxPooling(size_t poolSize = 2);
-    MaxPooling(std::ifstream& file);
+    /*
+    * A stride of 0 uses the pooling size as stride, which gives non overlapping windows.
+    */
+    MaxPooling(size_t poolSize = 2, size_t stride = 0);
+    MaxPooling(std::ifstream& file, size_t version);
 
     void FeedForward();
     void BackPropogate();
     void Create(NeuralLayer* previousLayer);
     size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new MaxPooling(*this); }
 
     void SaveLayer(std::ofstream& file) const;
+    void SetBatchSize(size_t batchSize);
 
 private:
-    void Max(size_t i, size_t j, size_t k);
+    void Max(size_t i, size_t j, size_t k, size_t sample);
 
     /*
-    * Is a vector with the same dimensions as the output, for every output it contains the 
-    * index for the max input given, thus this index can be used in the previous layer's output.
+    * Is a vector with the same dimensions as the output, for every output it contains the offset of the max input
+    * inside its pooling window, stored as y * poolingSize + x. Thus the pooling size can be at most 16.
     */
-    std::vector<size_t> maxIndexes;
+    std::vector<uint8_t> maxOffsets;
+};
+
+/*
+* Averages the inputs in every window, windows may overlap and the input may be padded. Padded positions are not counted in the average.
+*/
+class AveragePooling : public NeuralLayer
+{
+public:
+    size_t poolingSize, stride, padding;
+
+    /*
+    * A stride of 0 uses the pooling size as stride, which gives non overlapping windows.
+    */
+    AveragePooling(size_t poolSize = 2, size_t stride = 0, size_t padding = 0);
+    AveragePooling(std::ifstream& file);
+
+    void FeedForward();
+    void BackPropogate();
+    void Create(NeuralLayer* previousLayer);
+    size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new AveragePooling(*this); }
+
+    void SaveLayer(std::ofstream& file) const;
+
+private:
+    void CountWindows();
+
+    //The size of the input is stored, so the amount of inputs in every window is known without the previous layer.
+    size_t inputWidth = 0, inputHeight = 0;
+
+    //The inverse of the amount of rows and columns of the input that fall inside the windows of every output row and column.
+    std::vector<float> inverseRowCounts, inverseColumnCounts;
+};
+
+/*
+* Averages every channel to a single value, which replaces flattening the channels into a large FullyConnected layer.
+*/
+class GlobalAveragePooling : public NeuralLayer
+{
+public:
+    GlobalAveragePooling();
+    GlobalAveragePooling(std::ifstream& file);
+
+    void FeedForward();
+    void BackPropogate();
+    void Create(NeuralLayer* previousLayer);
+    size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new GlobalAveragePooling(*this); }
 };
 
 class FullyConnected : public NeuralLayer
@@ -125,9 +343,18 @@ public:
     * Contains all the weights for this connected layer, all the weights used by the first output
     * neuron are at the front of this vector. After that all the weights used by the second output neuron follow it.
     */
-    std::vector<float> weights, weightGradients;
+    std::vector<float> weights;
     std::vector<float> biasWeights, biasGradients;
 
+    //Only allocated while the gradients are accumulated.
+    std::vector<float> weightGradients;
+
+    /*
+    * Once the layer is pruned, contains a 1 for every weight that is kept and a 0 for every pruned weight.
+    * The pruned weights stay zero while training continues. Is empty when the layer is not pruned.
+    */
+    std::vector<uint8_t> mask;
+
     FullyConnected(size_t outputSize, std::string ActivationFunction = "relu");
     FullyConnected(std::ifstream& file, NeuralLayer* previousLayer);
 
@@ -135,9 +362,135 @@ public:
     void BackPropogate();
     void Create(NeuralLayer* previousLayer);
     size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new FullyConnected(*this); }
 
     void SaveLayer(std::ofstream& file) const;
 
+    void SetGradientAccumulation(bool accumulate);
+    void ApplyGradients(float scale);
+    std::vector<std::span<float>> Parameters();
+    std::vector<std::span<float>> Gradients();
+
+    /*
+    * Sets the given fraction of the weights with the smallest magnitude to zero, and keeps them zero from then on.
+    */
+    void Prune(float sparsity);
+
+    size_t InputSize() const { return sizePreviousLayer; }
+
+    /*
+    * Direct computes the dot product of every output and sample with a single sum, Unrolled uses independent partial sums so the
+    * dot products are vectorized, and BatchTiled computes four samples at once so every row of weights is read once for four samples.
+    */
+    enum Algorithm : size_t { Direct, Unrolled, BatchTiled, AlgorithmAmount };
+
+    size_t AlgorithmCount() const { return AlgorithmAmount; }
+    std::string AlgorithmName(size_t algorithm) const;
+    void SetAlgorithm(size_t algorithm) { this->algorithm = algorithm; }
+    std::string TuningKey() const;
+
 private:
+    //Feeds forward the outputs [firstOutput, lastOutput) of all the samples.
+    void FeedForward(size_t firstOutput, size_t lastOutput);
+
     size_t sizePreviousLayer = 0;
-};
\ No newline at end of file
+    size_t algorithm = Direct;
+
+    /*
+    * The amount of inputs handled per tile in the fused backpropogation, 
+    * so the input gradients and inputs of one tile fit in the L1 cache.
+    */
+    static constexpr size_t backPropogateTileSize = 1024;
+};
+
+/*
+* A fully connected layer that only stores its non zero weights, in compressed sparse row format.
+* It is created from a pruned FullyConnected layer, and skips all the pruned weights when feeding forward and backpropogating.
+*/
+class SparseFullyConnected : public NeuralLayer
+{
+public:
+    /*
+    * The non zero weights of all the output neurons after each other, for every weight the index of its input is stored in columns.
+    * The weights of output neuron k are at [rowOffsets[k], rowOffsets[k + 1]).
+    */
+    std::vector<float> weights;
+    std::vector<uint32_t> columns, rowOffsets;
+    std::vector<float> biasWeights, biasGradients;
+
+    //Only allocated while the gradients are accumulated.
+    std::vector<float> weightGradients;
+
+    SparseFullyConnected(const FullyConnected& layer);
+    SparseFullyConnected(std::ifstream& file);
+
+    void FeedForward();
+    void BackPropogate();
+    void Create(NeuralLayer* previousLayer);
+    size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new SparseFullyConnected(*this); }
+
+    void SaveLayer(std::ofstream& file) const;
+
+    void SetGradientAccumulation(bool accumulate);
+    void ApplyGradients(float scale);
+    std::vector<std::span<float>> Parameters();
+    std::vector<std::span<float>> Gradients();
+
+private:
+    size_t sizePreviousLayer = 0;
+};
+
+/*
+* Normalizes every feature with its mean and variance, and then scales it by gamma and shifts it by beta which are trained.
+* The features are the channels when the previous layer has channels, and the outputs of the previous layer otherwise.
+* While training, the statistics of the values of a feature in the batch are used together with the batch renormalization correction,
+* so the outputs are the same as with the running averages that are used for inference. When a feature only has a single value in the batch,
+* the running averages are used directly. This is always the case after a FullyConnected layer in Fit, which trains one sample at a time:
+* such a layer never sees batch statistics, it normalizes every sample with the averages of the samples before it, which every sample updates,
+* and no gradient flows through the statistics. It then only trains gamma and beta on top of a standardization, use it after a convolution
+* to get batch normalization while training. For inference the layer is folded into the weights of the previous layer, see NeuralNetwork::FoldBatchNorm.
+*/
+class BatchNorm : public NeuralLayer
+{
+public:
+    std::vector<float> gamma, beta, gammaGradients, betaGradients;
+    std::vector<float> runningMean, runningVariance;
+    float momentum = 0.01f;
+
+    BatchNorm(std::string ActivationFunction = "relu", float momentum = 0.01f);
+    BatchNorm(std::ifstream& file);
+
+    void FeedForward();
+    void BackPropogate();
+    void Create(NeuralLayer* previousLayer);
+    size_t PrintStats() const;
+    LayerCost Cost() const;
+    NeuralLayer* Clone() const { return new BatchNorm(*this); }
+
+    void SaveLayer(std::ofstream& file) const;
+    void SetBatchSize(size_t batchSize);
+
+    void SetGradientAccumulation(bool accumulate);
+    void ApplyGradients(float scale);
+    std::vector<std::span<float>> Parameters();
+    std::vector<std::span<float>> Gradients();
+
+    /*
+    * Multiplies the weights and bias of every output of the previous convolution or FullyConnected layer by the scale of its feature,
+    * and adds the shift to the bias, so the previous layer computes the normalized outputs itself. Returns false when the layer can not be folded,
+    * which is the case when the previous layer is of another type or does not have a linear activation.
+    */
+    bool FoldIntoPreviousLayer() const;
+
+private:
+    static constexpr float epsilon = 1E-5f, maxCorrection = 3.f, maxShift = 5.f;
+
+    //The normalized values before the correction, and for every feature the correction and the inverse of the deviation they were normalized with.
+    std::vector<float> normalized, correction, shift, inverseDeviation;
+    size_t features = 0, spatialSize = 1;
+    bool batchStatistics = false;
+};
+
@@ -5,58 +5,944 @@
 #include <fstream>
 #include <ranges>
 #include <chrono>
+#include <algorithm>
+#include <future>
+#include <format>
+#include <filesystem>
+#include <limits>
+
+#include "AllocationCounter.h"
+#include "DataParallel.h"
+#include "DatasetCache.h"
+#include "MachineProfile.h"
+#include "TuningCache.h"
+#include "Telemetry.h"
+
+NeuralNetwork::NeuralNetwork() {}
+NeuralNetwork::NeuralNetwork(std::vector<NeuralLayer*> layer) {}
+
+NeuralNetwork::NeuralNetwork(const NeuralNetwork& other) :
+	learningRate(other.learningRate), decayRate(other.decayRate), verbose(other.verbose), tuningCacheFile(other.tuningCacheFile),
+	tunedAlgorithms(other.tunedAlgorithms), exitThreshold(other.exitThreshold)
+{
+	NeuralLayer* previousLayer = nullptr;
+	for (const auto& layer : other.Layers)
+	{
+		NeuralLayer* clone = layer->Clone();
+		clone->previousLayer = previousLayer;
+		previousLayer = clone;
+
+		Layers.push_back(clone);
+	}
+
+	for (const auto& head : other.exitHeads) {
+		auto* classifier = static_cast<FullyConnected*>(head.classifier->Clone());
+		classifier->previousLayer = Layers[head.layer];
+
+		exitHeads.push_back({ head.layer, classifier, head.layerGradients });
+	}
+}
+
+NeuralNetwork::~NeuralNetwork()
+{
+	//The gradient all reduce refers to the gradients of the layers, so it is stopped first.
+	gradientAllReduce.reset();
+
+	for (auto& layer : Layers)
+		delete layer;
+
+	for (auto& head : exitHeads)
+		delete head.classifier;
+}
 
 void NeuralNetwork::AddLayer(NeuralLayer* layer)
 {
 	Layers.push_back(layer);
 }
 
-std::vector<float> NeuralNetwork::Predict(const std::vector<float>& Input)
+const std::vector<float>& NeuralNetwork::Predict(std::span<const float> Input)
+{
+	if (Input.size() != (Layers[0]->outputChannels * Layers[0]->outputHeight * Layers[0]->outputWidth)) {
+		std::cout << "Error Predict(), Given input is not the same size as the expected output!\n";
+		exit(1);
+	}
+
+	if (Layers[0]->batchSize != 1)
+		SetBatchSize(1);
+
+	std::ranges::copy(Input, Layers[0]->outputs.begin());
+
+	if (exitThreshold > 0.f && !exitHeads.empty()) {
+		size_t exitTaken = 0;
+		return FeedForwardCascade(exitTaken);
+	}
+
+	FeedForward();
+
+	return Layers.back()->outputs;
+}
+
+const std::vector<float>& NeuralNetwork::PredictBatch(const float* inputs, size_t batchSize)
+{
+	if (Layers[0]->batchSize != batchSize)
+		SetBatchSize(batchSize);
+
+	std::copy(inputs, inputs + Layers[0]->outputs.size(), Layers[0]->outputs.begin());
+
+	FeedForward();
+
+	return Layers.back()->outputs;
+}
+
+size_t NeuralNetwork::InputSize() const
+{
+	return Layers.front()->outputWidth * Layers.front()->outputHeight * Layers.front()->outputChannels;
+}
+
+size_t NeuralNetwork::OutputSize() const
+{
+	return Layers.back()->outputWidth * Layers.back()->outputHeight * Layers.back()->outputChannels;
+}
+
+/*
+* Layers have the same shape when the weights of one fit the other and they compute their outputs in the same way, thus besides the
+* output shape the settings that are not part of it are compared, and the sizes of the weights.
+*/
+static bool SameLayerShape(const NeuralLayer* layer, const NeuralLayer* other)
+{
+	if (layer->layerType != other->layerType || layer->outputWidth != other->outputWidth || layer->outputHeight != other->outputHeight ||
+		layer->outputChannels != other->outputChannels || layer->ActivationFunction != other->ActivationFunction)
+		return false;
+
+	//Parameters is not const, as the spans are also used to update the weights.
+	const auto parameters = const_cast<NeuralLayer*>(layer)->Parameters(), otherParameters = const_cast<NeuralLayer*>(other)->Parameters();
+
+	if (!std::ranges::equal(parameters, otherParameters, [](std::span<float> a, std::span<float> b) { return a.size() == b.size(); }))
+		return false;
+
+	switch (layer->layerType)
+	{
+	case ConvolutionLayer: {
+		const auto* a = static_cast<const Convolution*>(layer), * b = static_cast<const Convolution*>(other);
+		return a->kernelSize == b->kernelSize && a->padding == b->padding && a->stride == b->stride;
+	}
+	case DepthwiseConvolutionLayer: {
+		const auto* a = static_cast<const DepthwiseConvolution*>(layer), * b = static_cast<const DepthwiseConvolution*>(other);
+		return a->kernelSize == b->kernelSize && a->padding == b->padding && a->stride == b->stride;
+	}
+	case MaxPoolingLayer: {
+		const auto* a = static_cast<const MaxPooling*>(layer), * b = static_cast<const MaxPooling*>(other);
+		return a->poolingSize == b->poolingSize && a->stride == b->stride;
+	}
+	case AveragePoolingLayer: {
+		const auto* a = static_cast<const AveragePooling*>(layer), * b = static_cast<const AveragePooling*>(other);
+		return a->poolingSize == b->poolingSize && a->stride == b->stride && a->padding == b->padding;
+	}
+	case SparseFullyConnectedLayer: {
+		const auto* a = static_cast<const SparseFullyConnected*>(layer), * b = static_cast<const SparseFullyConnected*>(other);
+		return a->columns == b->columns && a->rowOffsets == b->rowOffsets;
+	}
+	default:
+		return true;
+	}
+}
+
+/*
+* Layers are identical when they compute the same outputs from the same inputs, thus they have the same shape and the same weights.
+* For BatchNorm the running averages are compared as well, as those are used for inference.
+*/
+static bool IdenticalLayer(const NeuralLayer* layer, const NeuralLayer* other)
+{
+	if (!SameLayerShape(layer, other))
+		return false;
+
+	const auto parameters = const_cast<NeuralLayer*>(layer)->Parameters(), otherParameters = const_cast<NeuralLayer*>(other)->Parameters();
+
+	if (!std::ranges::equal(parameters, otherParameters, [](std::span<float> a, std::span<float> b) { return std::ranges::equal(a, b); }))
+		return false;
+
+	if (layer->layerType == BatchNormLayer) {
+		const auto* a = static_cast<const BatchNorm*>(layer), * b = static_cast<const BatchNorm*>(other);
+		return a->runningMean == b->runningMean && a->runningVariance == b->runningVariance;
+	}
+
+	return true;
+}
+
+//Copies the weights of a layer with the same shape, and for BatchNorm the running averages.
+static void CopyLayerWeights(NeuralLayer* layer, NeuralLayer* source)
+{
+	const auto parameters = layer->Parameters(), sourceParameters = source->Parameters();
+
+	for (size_t i = 0; i < parameters.size(); i++)
+		std::ranges::copy(sourceParameters[i], parameters[i].begin());
+
+	if (layer->layerType == BatchNormLayer) {
+		static_cast<BatchNorm*>(layer)->runningMean = static_cast<BatchNorm*>(source)->runningMean;
+		static_cast<BatchNorm*>(layer)->runningVariance = static_cast<BatchNorm*>(source)->runningVariance;
+	}
+}
+
+size_t NeuralNetwork::LayerCount() const
+{
+	return Layers.size();
+}
+
+size_t NeuralNetwork::IdenticalLayers(const NeuralNetwork& other) const
+{
+	size_t layers = 0;
+
+	while (layers < Layers.size() && layers < other.Layers.size() && IdenticalLayer(Layers[layers], other.Layers[layers]))
+		layers++;
+
+	return layers;
+}
+
+void NeuralNetwork::ShareLayers(const NeuralNetwork& trunk, size_t layers)
+{
+	if (layers == 0 || layers >= Layers.size() || trunk.IdenticalLayers(*this) < layers) {
+		std::cout << "Error ShareLayers(), the network does not have " << layers << " leading layers identical to those of the trunk, followed by layers of its own\n";
+		exit(1);
+	}
+
+	Layers[layers]->previousLayer = trunk.Layers[layers - 1];
+}
+
+const std::vector<float>& NeuralNetwork::FeedForwardFrom(size_t firstLayer)
+{
+	FeedForward(firstLayer);
+
+	return Layers.back()->outputs;
+}
+
+size_t NeuralNetwork::ForwardMACs(size_t firstLayer) const
+{
+	size_t macs = 0;
+
+	for (size_t i = firstLayer; i < Layers.size(); i++)
+		macs += Layers[i]->Cost().forwardMACs;
+
+	return macs;
+}
+
+void NeuralNetwork::SetBatchSize(size_t batchSize)
+{
+	for (auto& layer : Layers)
+		layer->SetBatchSize(batchSize);
+
+	for (auto& head : exitHeads)
+		head.classifier->SetBatchSize(batchSize);
+
+	if (!tunedAlgorithms.empty())
+		Tune();
+}
+
+void NeuralNetwork::Create(float learningRate, float decayRate)
+{
+	NeuralLayer* previousLayer = nullptr;
+	for (auto& layer : Layers)
+	{
+		layer->Create(previousLayer);
+		previousLayer = layer;
+		layer->learningRate = learningRate;
+	}
+
+	this->learningRate = learningRate;
+	this->decayRate = decayRate;
+
+	if (!tuningCacheFile.empty())
+		Tune();
+}
+
+static std::string FormatCount(double count)
+{
+	if (count >= 1E9)
+		return std::format("{:.2f}G", count / 1E9);
+	if (count >= 1E6)
+		return std::format("{:.2f}M", count / 1E6);
+	if (count >= 1E3)
+		return std::format("{:.2f}K", count / 1E3);
+
+	return std::format("{}", count);
+}
+
+static std::string FormatBytes(double bytes)
+{
+	if (bytes >= 1024.0 * 1024.0)
+		return std::format("{:.2f} MB", bytes / (1024.0 * 1024.0));
+	if (bytes >= 1024.0)
+		return std::format("{:.2f} KB", bytes / 1024.0);
+
+	return std::format("{} B", bytes);
+}
+
+/*
+* The time of a pass is estimated with the roofline model, as the time of its operations at the peak throughput
+* or the time of its memory traffic at the bandwidth, whichever is longer.
+*/
+static void PrintRoofline(const char* pass, size_t macs, size_t bytes, const MachineProfile& machine)
+{
+	const double flops = 2.0 * macs, intensity = flops / std::max<double>(bytes, 1.0);
+	const double computeTime = flops / machine.peakFlops, memoryTime = bytes / machine.bandwidth;
+
+	std::cout << std::format("  {}: {:.2f} FLOP/byte, {:.1f} us per sample, {} bound\n", pass, intensity,
+		std::max(computeTime, memoryTime) * 1E6, computeTime >= memoryTime ? "compute" : "memory");
+}
+
+/*
+* Every layer prints its shape and amount of parameters, followed by its multiply adds, the bytes it moves and its memory for a single sample.
+* The totals are compared to the peak throughput and bandwidth of the machine, to show whether the network is compute or memory bound.
+*/
+void NeuralNetwork::PrintSummary() const
+{
+	size_t totalParams = 0;
+	LayerCost total;
+	const size_t frozenLayers = FrozenLayers();
+
+	for (size_t i = 0; i < Layers.size(); i++)
+	{
+		const NeuralLayer* layer = Layers[i];
+		totalParams += layer->PrintStats();
+
+		LayerCost cost = layer->Cost();
+
+		//The layers up to the last frozen layer are not backpropogated.
+		if (i < frozenLayers)
+			cost.backwardMACs = cost.backwardBytesRead = cost.backwardBytesWritten = 0;
+
+		if (layer->layerType != LayerTypes::InputLayer)
+			std::cout << std::format("    forward {} MACs, backward {} MACs, read {}, written {}, activations {}, parameters {}\n",
+				FormatCount(cost.forwardMACs), FormatCount(cost.backwardMACs), FormatBytes(cost.forwardBytesRead + cost.backwardBytesRead),
+				FormatBytes(cost.forwardBytesWritten + cost.backwardBytesWritten), FormatBytes(cost.activationMemory), FormatBytes(cost.parameterMemory));
+
+		total.forwardMACs += cost.forwardMACs;
+		total.backwardMACs += cost.backwardMACs;
+		total.forwardBytesRead += cost.forwardBytesRead;
+		total.forwardBytesWritten += cost.forwardBytesWritten;
+		total.backwardBytesRead += cost.backwardBytesRead;
+		total.backwardBytesWritten += cost.backwardBytesWritten;
+		total.activationMemory += cost.activationMemory;
+		total.parameterMemory += cost.parameterMemory;
+	}
+
+	//The exit heads are not part of the totals, as a sample only runs through the heads before the exit it takes.
+	for (const auto& head : exitHeads) {
+		std::cout << "Exit head after layer " << head.layer << ": ";
+		totalParams += head.classifier->PrintStats();
+	}
+
+	std::cout << "Total Trainable params: " << totalParams << '\n';
+
+	const size_t forwardBytes = total.forwardBytesRead + total.forwardBytesWritten;
+	const size_t backwardBytes = total.backwardBytesRead + total.backwardBytesWritten;
+
+	std::cout << std::format("Per sample: forward {} MACs, backward {} MACs, forward {} moved, backward {} moved, activations {}, parameters {}\n",
+		FormatCount(total.forwardMACs), FormatCount(total.backwardMACs), FormatBytes(forwardBytes), FormatBytes(backwardBytes),
+		FormatBytes(total.activationMemory), FormatBytes(total.parameterMemory));
+
+	const MachineProfile& machine = MachineProfile::Get();
+
+	std::cout << std::format("Roofline with {:.2f} GFLOP/s and {:.2f} GB/s, compute bound above {:.2f} FLOP/byte\n",
+		machine.peakFlops / 1E9, machine.bandwidth / 1E9, machine.peakFlops / machine.bandwidth);
+
+	PrintRoofline("Inference", total.forwardMACs, forwardBytes, machine);
+	PrintRoofline("Training", total.forwardMACs + total.backwardMACs, forwardBytes + backwardBytes, machine);
+}
+
+void NeuralNetwork::Fit(size_t epochs, const DataSet& dataSet)
+{
+	Fit(epochs, dataSet.trainInput, dataSet.trainLabels, dataSet.validationInput, dataSet.validationLabels);
+}
+
+void NeuralNetwork::Fit(size_t epochs, const SampleSet& trainInput, const std::vector<size_t>& trainLabels, const SampleSet& validationInput, const std::vector<size_t>& validationLabels)
+{
+	Train(0, epochs, trainInput, trainLabels, validationInput, validationLabels);
+}
+
+void NeuralNetwork::ResumeFit(const std::string& checkpointFile, size_t epochs, const DataSet& dataSet)
+{
+	ResumeFit(checkpointFile, epochs, dataSet.trainInput, dataSet.trainLabels, dataSet.validationInput, dataSet.validationLabels);
+}
+
+void NeuralNetwork::ResumeFit(const std::string& checkpointFile, size_t epochs, const SampleSet& trainInput, const std::vector<size_t>& trainLabels, const SampleSet& validationInput, const std::vector<size_t>& validationLabels)
+{
+	size_t firstEpoch = 0;
+
+	if (std::filesystem::exists(checkpointFile)) {
+		firstEpoch = LoadCheckpoint(checkpointFile);
+
+		if (firstEpoch >= epochs) {
+			std::cout << std::format("Checkpoint: {} is already trained for {} of {} epochs, nothing to resume\n", checkpointFile, firstEpoch, epochs);
+			return;
+		}
+
+		std::cout << std::format("Resuming from checkpoint: {} after epoch {}\n", checkpointFile, firstEpoch);
+	}
+
+	Train(firstEpoch, epochs, trainInput, trainLabels, validationInput, validationLabels);
+}
+
+void NeuralNetwork::SetDataParallel(RingAllReduce& ring, size_t localBatchSize)
+{
+	this->ring = &ring;
+	this->localBatchSize = std::max<size_t>(localBatchSize, 1);
+
+	//All processes start with the weights of rank 0.
+	for (auto& layer : Layers) {
+		layer->SetGradientAccumulation(true);
+
+		for (auto parameters : layer->Parameters())
+			ring.Broadcast(parameters);
+	}
+
+	gradientAllReduce = std::make_unique<GradientAllReduce>(ring, Layers);
+}
+
+void NeuralNetwork::SetCheckpoint(const std::string& fileName, size_t interval)
+{
+	checkpointFile = fileName;
+	checkpointInterval = interval;
+}
+
+void NeuralNetwork::SetAugmentation(const AugmentationSettings& settings, size_t threads)
+{
+	augment = true;
+	augmentation = settings;
+	augmentationThreads = threads;
+}
+
+void NeuralNetwork::SetFrozen(size_t layer, bool frozen)
+{
+	Layers[layer]->frozen = frozen;
+}
+
+void NeuralNetwork::SetFeatureCache(const std::string& directory)
+{
+	featureCacheDirectory = directory;
+}
+
+void NeuralNetwork::SetTelemetry(const std::string& fileName)
+{
+	telemetry.reset();
+
+	if (!fileName.empty())
+		telemetry = std::make_unique<TelemetryLog>(fileName);
+}
+
+bool NeuralNetwork::PlaceOnNode(size_t node, WeightPlacement placement)
+{
+	bool placed = PinThreadToNode(node);
+
+	for (auto& layer : Layers) {
+		placed &= MoveToNode(layer->outputs, node);
+		placed &= MoveToNode(layer->outputGradients, node);
+
+		for (auto& gradients : layer->Gradients())
+			placed &= MoveToNode(gradients, node);
+
+		for (auto& weights : layer->Parameters())
+			placed &= placement == WeightPlacement::Interleaved ? Interleave(weights) : MoveToNode(weights, node);
+	}
+
+	return placed;
+}
+
+void NeuralNetwork::PrintMemoryAccess(const SampleSet& inputs, const std::vector<size_t>& labels, size_t samples)
+{
+	NodeLoadCounter counter;
+
+	if (!counter.Available()) {
+		std::cout << "The node load counters are not available on this machine\n";
+		return;
+	}
+
+	std::vector<NodeLoadCounter::Counts> forward(Layers.size()), backward(Layers.size());
+	std::vector<float> expected(OutputSize());
+	std::vector<bool> accumulating;
+	const size_t firstLayer = std::max<size_t>(FrozenLayers(), 1), batchSize = Layers[0]->batchSize;
+
+	auto measure = [&counter](NodeLoadCounter::Counts& total, auto&& work) {
+		const NodeLoadCounter::Counts before = counter.Read();
+		work();
+		const NodeLoadCounter::Counts after = counter.Read();
+
+		total.local += after.local - before.local;
+		total.remote += after.remote - before.remote;
+	};
+
+	//The gradients are accumulated and discarded afterwards, so the weights do not change.
+	for (auto& layer : Layers) {
+		accumulating.push_back(layer->accumulateGradients);
+		layer->SetGradientAccumulation(true);
+	}
+
+	SetBatchSize(1);
+
+	for (size_t n = 0; n < std::min(samples, inputs.size()); n++) {
+		std::ranges::copy(inputs[n], Layers[0]->outputs.begin());
+
+		for (size_t i = 1; i < Layers.size(); i++)
+			measure(forward[i], [&] { Layers[i]->FeedForward(); });
+
+		LabelToOneHotEncoding(labels[n], expected);
+
+		for (size_t i = 0; i < expected.size(); i++)
+			Layers.back()->outputGradients[i] = Layers.back()->outputs[i] - expected[i];
+
+		for (size_t i = Layers.size(); i-- > firstLayer;)
+			measure(backward[i], [&] { Layers[i]->BackPropogate(); });
+	}
+
+	for (size_t i = 0; i < Layers.size(); i++)
+		Layers[i]->SetGradientAccumulation(accumulating[i]);
+
+	SetBatchSize(batchSize);
+
+	auto remoteShare = [](const NodeLoadCounter::Counts& counts) {
+		return counts.local + counts.remote == 0 ? 0.0 : 100.0 * counts.remote / (counts.local + counts.remote);
+	};
+
+	for (size_t i = 1; i < Layers.size(); i++)
+		std::cout << std::format("Layer {} - forward {} node loads {:.1f}% remote, backward {} node loads {:.1f}% remote\n", i,
+			forward[i].local + forward[i].remote, remoteShare(forward[i]), backward[i].local + backward[i].remote, remoteShare(backward[i]));
+}
+
+NeuralNetwork::Throughput NeuralNetwork::MeasureThroughput(const SampleSet& inputs, const std::vector<size_t>& labels, size_t samples)
+{
+	samples = std::min(samples, inputs.size());
+
+	if (samples == 0 || !inputs.AllOfSize(InputSize())) {
+		std::cout << "Error MeasureThroughput(), Given input is empty or not the same size as the input layer\n";
+		exit(1);
+	}
+
+	std::vector<float> expected(OutputSize());
+	std::vector<bool> accumulating;
+	const size_t batchSize = Layers[0]->batchSize;
+
+	SetBatchSize(1);
+
+	const auto forwardStart = std::chrono::steady_clock::now();
+
+	for (size_t n = 0; n < samples; n++) {
+		std::ranges::copy(inputs[n], Layers[0]->outputs.begin());
+		FeedForward();
+	}
+
+	const std::chrono::duration<double> forwardTime = std::chrono::steady_clock::now() - forwardStart;
+
+	for (auto& layer : Layers) {
+		accumulating.push_back(layer->accumulateGradients);
+		layer->SetGradientAccumulation(true);
+	}
+
+	for (auto& head : exitHeads) {
+		accumulating.push_back(head.classifier->accumulateGradients);
+		head.classifier->SetGradientAccumulation(true);
+	}
+
+	//Training updates the running averages of the BatchNorm layers, they are restored afterwards as well.
+	std::vector<std::pair<std::vector<float>, std::vector<float>>> runningStatistics;
+
+	for (auto& layer : Layers) {
+		if (layer->layerType == LayerTypes::BatchNormLayer)
+			runningStatistics.emplace_back(static_cast<BatchNorm*>(layer)->runningMean, static_cast<BatchNorm*>(layer)->runningVariance);
+	}
+
+	SetTraining(true);
+
+	const auto forwardBackwardStart = std::chrono::steady_clock::now();
+
+	for (size_t n = 0; n < samples; n++) {
+		std::ranges::copy(inputs[n], Layers[0]->outputs.begin());
+		FeedForward();
+		FeedForwardExitHeads(0);
+
+		LabelToOneHotEncoding(labels[n], expected);
+		BackPropogate(expected);
+	}
+
+	const std::chrono::duration<double> forwardBackwardTime = std::chrono::steady_clock::now() - forwardBackwardStart;
+
+	SetTraining(false);
+
+	for (size_t i = 0; i < Layers.size(); i++)
+		Layers[i]->SetGradientAccumulation(accumulating[i]);
+
+	for (size_t i = 0; i < exitHeads.size(); i++)
+		exitHeads[i].classifier->SetGradientAccumulation(accumulating[Layers.size() + i]);
+
+	auto statistics = runningStatistics.begin();
+
+	for (auto& layer : Layers) {
+		if (layer->layerType == LayerTypes::BatchNormLayer) {
+			static_cast<BatchNorm*>(layer)->runningMean = std::move(statistics->first);
+			static_cast<BatchNorm*>(layer)->runningVariance = std::move(statistics->second);
+			++statistics;
+		}
+	}
+
+	SetBatchSize(batchSize);
+
+	return { static_cast<double>(samples) / forwardTime.count(), static_cast<double>(samples) / forwardBackwardTime.count() };
+}
+
+void NeuralNetwork::SetVerbose(bool verbose)
+{
+	this->verbose = verbose;
+}
+
+size_t NeuralNetwork::StepAllocations() const
+{
+	return stepAllocations;
+}
+
+void NeuralNetwork::SetAutoTuning(const std::string& cacheFile)
+{
+	tuningCacheFile = cacheFile;
+}
+
+/*
+* The fastest of a few rounds is used, so the timing is not disturbed by other work on the machine.
+*/
+static double TimeFeedForward(NeuralLayer* layer)
+{
+	layer->FeedForward();
+
+	double best = std::numeric_limits<double>::max();
+
+	for (size_t round = 0; round < 5; round++) {
+		const auto start = std::chrono::steady_clock::now();
+		size_t runs = 0;
+
+		do {
+			layer->FeedForward();
+			runs++;
+		} while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(2));
+
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs);
+	}
+
+	return best;
+}
+
+//Returns false when the layer has no algorithm with the name.
+static bool SetAlgorithmByName(NeuralLayer* layer, const std::string& name)
+{
+	for (size_t algorithm = 0; algorithm < layer->AlgorithmCount(); algorithm++) {
+		if (layer->AlgorithmName(algorithm) == name) {
+			layer->SetAlgorithm(algorithm);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void NeuralNetwork::Tune()
+{
+	//Shapes this network was tuned for before are set without reading the cache.
+	bool tuned = true;
+
+	for (size_t i = 1; i < Layers.size(); i++) {
+		if (Layers[i]->AlgorithmCount() < 2)
+			continue;
+
+		const auto found = tunedAlgorithms.find(Layers[i]->TuningKey());
+		tuned = found != tunedAlgorithms.end() && SetAlgorithmByName(Layers[i], found->second) && tuned;
+	}
+
+	if (tuned && !tunedAlgorithms.empty())
+		return;
+
+	TuningCache cache(tuningCacheFile);
+
+	for (size_t i = 1; i < Layers.size(); i++) {
+		NeuralLayer* layer = Layers[i];
+
+		if (layer->AlgorithmCount() < 2)
+			continue;
+
+		const std::string key = layer->TuningKey(), stored = cache.Find(key);
+
+		if (!stored.empty() && SetAlgorithmByName(layer, stored)) {
+			tunedAlgorithms[key] = stored;
+			continue;
+		}
+
+		size_t best = 0;
+
+		double bestTime = std::numeric_limits<double>::max();
+
+		for (size_t algorithm = 0; algorithm < layer->AlgorithmCount(); algorithm++) {
+			layer->SetAlgorithm(algorithm);
+			const double time = TimeFeedForward(layer);
+
+			if (time < bestTime) {
+				bestTime = time;
+				best = algorithm;
+			}
+		}
+
+		layer->SetAlgorithm(best);
+		cache.Store(key, layer->AlgorithmName(best));
+		tunedAlgorithms[key] = layer->AlgorithmName(best);
+
+		std::cout << std::format("Tuned {} - {} {:.1f} us\n", key, layer->AlgorithmName(best), bestTime * 1E6);
+	}
+
+	cache.Save();
+}
+
+void NeuralNetwork::SetTraining(bool training)
+{
+	const size_t frozenLayers = FrozenLayers();
+
+	for (size_t i = 0; i < Layers.size(); i++)
+		Layers[i]->training = training && i >= frozenLayers;
+
+	for (auto& head : exitHeads)
+		head.classifier->training = training;
+}
+
+size_t NeuralNetwork::FrozenLayers() const
+{
+	for (size_t i = Layers.size(); i-- > 0;) {
+		if (Layers[i]->frozen)
+			return i + 1;
+	}
+
+	return 0;
+}
+
+/*
+* Feeds every sample forward through the frozen layers, and stores the outputs of the last frozen layer.
+*/
+SampleSet NeuralNetwork::ComputeFeatures(size_t frozenLayers, const SampleSet& inputs, const std::vector<size_t>& labels, const std::string& name, std::vector<std::vector<float>>& features, std::unique_ptr<DatasetCache>& cache)
+{
+	const NeuralLayer* lastFrozen = Layers[frozenLayers - 1];
+
+	auto compute = [&](size_t n, float* feature) {
+		std::ranges::copy(inputs[n], Layers.front()->outputs.begin());
+
+		for (size_t i = 1; i < frozenLayers; i++)
+			Layers[i]->FeedForward();
+
+		std::ranges::copy(lastFrozen->outputs, feature);
+	};
+
+	if (featureCacheDirectory.empty()) {
+		features.assign(inputs.size(), std::vector<float>(lastFrozen->outputs.size()));
+
+		for (size_t n = 0; n < inputs.size(); n++)
+			compute(n, features[n].data());
+
+		return features;
+	}
+
+	const std::string directory = (std::filesystem::path(featureCacheDirectory) / name).string();
+
+	DatasetCache::Write(directory, lastFrozen->outputWidth, lastFrozen->outputHeight, lastFrozen->outputChannels, labels, compute);
+	cache = std::make_unique<DatasetCache>(directory);
+
+	return *cache;
+}
+
+void NeuralNetwork::SetPruning(float targetSparsity, size_t rampEpochs)
+{
+	pruningSparsity = targetSparsity;
+	pruningRampEpochs = std::max<size_t>(rampEpochs, 1);
+}
+
+void NeuralNetwork::ConvertToSparse(float minimumSparsity)
+{
+	for (size_t i = 0; i < Layers.size(); i++) {
+		if (Layers[i]->layerType != LayerTypes::FullyConnectedLayer)
+			continue;
+
+		const auto* layer = static_cast<FullyConnected*>(Layers[i]);
+		const size_t zeros = std::ranges::count(layer->weights, 0.f);
+
+		if (static_cast<float>(zeros) < minimumSparsity * static_cast<float>(layer->weights.size()))
+			continue;
+
+		Layers[i] = new SparseFullyConnected(*layer);
+		delete layer;
+
+		if (i + 1 < Layers.size())
+			Layers[i + 1]->previousLayer = Layers[i];
+
+		for (auto& head : exitHeads) {
+			if (head.layer == i)
+				head.classifier->previousLayer = Layers[i];
+		}
+	}
+}
+
+void NeuralNetwork::AddExitHead(size_t layer)
 {
-	if (Input.size() != (Layers[0]->outputChannels * Layers[0]->outputHeight * Layers[0]->outputWidth)) {
-		std::cout << "Error Predict(), Given input is not the same size as the expected output!\n";
+	if (layer == 0 || layer + 1 >= Layers.size() || Layers.back()->outputs.empty()) {
+		std::cout << "Error AddExitHead(), layer " << layer << " is not an intermediate layer of a created network\n";
 		exit(1);
 	}
 
-	Layers[0]->outputs = Input;
+	if (std::ranges::any_of(exitHeads, [layer](const ExitHead& head) { return head.layer == layer; })) {
+		std::cout << "Error AddExitHead(), layer " << layer << " already has an exit head\n";
+		exit(1);
+	}
 
-	FeedForward();
+	auto* classifier = new FullyConnected(OutputSize(), "softmax");
+	classifier->Create(Layers[layer]);
+	classifier->learningRate = learningRate;
+	classifier->SetBatchSize(Layers[layer]->batchSize);
 
-	return Layers.back()->outputs;
+	const auto position = std::ranges::find_if(exitHeads, [layer](const ExitHead& head) { return head.layer > layer; });
+	exitHeads.insert(position, { layer, classifier, std::vector<float>(Layers[layer]->outputGradients.size()) });
 }
 
-void NeuralNetwork::Create(float learningRate, float decayRate)
+void NeuralNetwork::SetExitThreshold(float threshold)
 {
-	NeuralLayer* previousLayer = nullptr;
-	for (auto& layer : Layers)
-	{
-		layer->Create(previousLayer);
-		previousLayer = layer;
-		layer->learningRate = learningRate;
+	exitThreshold = threshold;
+}
+
+/*
+* The multiply adds of a sample are those of the layers up to its exit, and of every head it passed including the one it left at.
+* They are compared to the multiply adds of the network without any exit heads.
+*/
+void NeuralNetwork::PrintExitTradeoff(const SampleSet& inputs, const std::vector<size_t>& labels, const std::vector<float>& thresholds)
+{
+	if (inputs.empty() || inputs.size() != labels.size() || !inputs.AllOfSize(InputSize())) {
+		std::cout << "Error PrintExitTradeoff(), Given input is empty, not the same size as the input layer or does not match the labels\n";
+		exit(1);
 	}
 
-	this->learningRate = learningRate;
-	this->decayRate = decayRate;
+	std::vector<size_t> layerMACs(Layers.size(), 0);
+	for (size_t i = 1; i < Layers.size(); i++)
+		layerMACs[i] = layerMACs[i - 1] + Layers[i]->Cost().forwardMACs;
+
+	const double fullMACs = static_cast<double>(layerMACs.back());
+
+	//The multiply adds of a sample that leaves at the given exit, the last exit is the output of the network.
+	std::vector<size_t> exitMACs;
+	size_t headMACs = 0;
+
+	for (const auto& head : exitHeads) {
+		headMACs += head.classifier->Cost().forwardMACs;
+		exitMACs.push_back(layerMACs[head.layer] + headMACs);
+	}
+
+	exitMACs.push_back(layerMACs.back() + headMACs);
+
+	const float threshold = exitThreshold;
+	exitThreshold = 0.f;
+
+	std::cout << std::format("Full network - Accuracy : {:.2f} % - {} MACs\n", Accuracy(inputs, labels) * 100.f, FormatCount(fullMACs));
+
+	std::vector<size_t> exits(exitMACs.size());
+
+	if (Layers[0]->batchSize != 1)
+		SetBatchSize(1);
+
+	for (float candidate : thresholds) {
+		exitThreshold = candidate;
+		std::ranges::fill(exits, 0);
+
+		size_t correct = 0;
+		double totalMACs = 0.0;
+
+		for (size_t n = 0; n < inputs.size(); n++) {
+			std::ranges::copy(inputs[n], Layers[0]->outputs.begin());
+
+			size_t exitTaken = 0;
+			const auto& prediction = FeedForwardCascade(exitTaken);
+
+			if (std::distance(prediction.begin(), std::ranges::max_element(prediction)) == labels[n])
+				correct++;
+
+			exits[exitTaken]++;
+			totalMACs += static_cast<double>(exitMACs[exitTaken]);
+		}
+
+		const double samples = static_cast<double>(inputs.size());
+		std::string shares;
+
+		for (size_t i = 0; i < exits.size(); i++)
+			shares += std::format("{}{:.1f} %", i == 0 ? "" : " / ", 100.0 * exits[i] / samples);
+
+		std::cout << std::format("Threshold {:.3f} - Accuracy : {:.2f} % - {} MACs ({:.1f} % of the full network) - Exits : {}\n", candidate,
+			100.0 * correct / samples, FormatCount(totalMACs / samples), 100.0 * totalMACs / samples / std::max(fullMACs, 1.0), shares);
+	}
+
+	exitThreshold = threshold;
 }
 
-void NeuralNetwork::PrintSummary() const
+void NeuralNetwork::FoldBatchNorm()
 {
-	size_t totalParams = 0;
+	for (size_t i = 1; i < Layers.size(); i++) {
+		//Folding changes the outputs of the layer before the BatchNorm layer, which an exit head may be classifying.
+		const bool headBefore = std::ranges::any_of(exitHeads, [i](const ExitHead& head) { return head.layer == i - 1; });
 
-	for (auto& layer : Layers)
-	{
-		totalParams += layer->PrintStats();
+		if (Layers[i]->layerType != LayerTypes::BatchNormLayer || headBefore || !static_cast<BatchNorm*>(Layers[i])->FoldIntoPreviousLayer())
+			continue;
+
+		delete Layers[i];
+		Layers.erase(Layers.begin() + i);
+
+		if (i < Layers.size())
+			Layers[i]->previousLayer = Layers[i - 1];
+
+		//The folded layer now computes the outputs of the removed BatchNorm layer.
+		for (auto& head : exitHeads) {
+			if (head.layer >= i) {
+				head.layer--;
+				head.classifier->previousLayer = Layers[head.layer];
+			}
+		}
+
+		i--;
 	}
+}
 
-	std::cout << "Total Trainable params: " << totalParams << '\n';
+float NeuralNetwork::Sparsity() const
+{
+	size_t zeros = 0, total = 0;
+
+	for (const auto& layer : Layers) {
+		if (layer->layerType == LayerTypes::FullyConnectedLayer) {
+			const auto& weights = static_cast<const FullyConnected*>(layer)->weights;
+
+			zeros += std::ranges::count(weights, 0.f);
+			total += weights.size();
+		}
+		else if (layer->layerType == LayerTypes::SparseFullyConnectedLayer) {
+			const size_t dense = layer->outputHeight * layer->previousLayer->outputs.size() / layer->previousLayer->batchSize;
+
+			zeros += dense - static_cast<const SparseFullyConnected*>(layer)->weights.size();
+			total += dense;
+		}
+	}
+
+	return total == 0 ? 0.f : static_cast<float>(zeros) / static_cast<float>(total);
 }
 
-void NeuralNetwork::Fit(size_t epochs, const DataSet& dataSet)
+float NeuralNetwork::Accuracy(const SampleSet& inputs, const std::vector<size_t>& labels)
 {
-	Fit(epochs, dataSet.trainInput, dataSet.trainLabels, dataSet.validationInput, dataSet.validationLabels);
+	size_t correct = 0;
+
+	for (size_t n = 0; n < inputs.size(); n++) {
+		const auto& prediction = Predict(inputs[n]);
+
+		if (std::distance(prediction.begin(), std::ranges::max_element(prediction)) == labels[n])
+			correct++;
+	}
+
+	return inputs.empty() ? 0.f : static_cast<float>(correct) / static_cast<float>(inputs.size());
 }
 
-void NeuralNetwork::Fit(size_t epochs, const std::vector<std::vector<float>>& trainInput, const std::vector<size_t>& trainLabels, const std::vector<std::vector<float>>& validationInput, const std::vector<size_t>& validationLabels)
+/*
+* Trains the epochs [firstEpoch, epochs), the first epoch is larger than 0 when training is resumed from a checkpoint.
+*/
+void NeuralNetwork::Train(size_t firstEpoch, size_t epochs, const SampleSet& trainInput, const std::vector<size_t>& trainLabels, const SampleSet& validationInput, const std::vector<size_t>& validationLabels)
 {
 	//set input to data
 	//feed forward through all the layers
@@ -73,59 +959,265 @@ void NeuralNetwork::Fit(size_t epochs, const std::vector<std::vector<float>>& tr
 		exit(1);
 	}
 
-	for (size_t epoch = 0; epoch < epochs; epoch++) {
-		float totalLoss = 0.f, totalValidationLoss = 0.f;
+	//The exit heads add their gradients to the layers before the gradients are handed to the all reduce, which does not know about the heads.
+	if (ring && !exitHeads.empty()) {
+		std::cout << "Error Fit(), exit heads can not be trained data parallel\n";
+		exit(1);
+	}
+
+	//Training feeds forward a single sample at a time.
+	SetBatchSize(1);
+	stepAllocations = 0;
+
+	const size_t inputSize = Layers.front()->outputs.size();
+
+	if (!trainInput.AllOfSize(inputSize) || !validationInput.AllOfSize(inputSize)) {
+		std::cout << "Error Fit(), Given input is not the same size as the input layer\n";
+		exit(1);
+	}
+
+	//Allocated once, so the training steps themselves never allocate memory.
+	std::vector<float> expectedOutput(Layers.back()->outputHeight, 0.f);
+
+	/*
+	* The validation and checkpoint of an epoch run on a background thread, using a snapshot of the network taken at the end of the epoch.
+	* Meanwhile training continues with the next epoch. Only one validation runs at a time, so at most one snapshot exists.
+	* The background work does not stop the program itself, it returns an error message which the training thread reports before it exits.
+	* Waiting with get also rethrows the exceptions of the background thread on the training thread.
+	*/
+	std::future<std::string> validation;
+
+	auto finishValidation = [&validation]() {
+		if (!validation.valid())
+			return;
+
+		const std::string error = validation.get();
+
+		if (!error.empty()) {
+			std::cout << error;
+			exit(1);
+		}
+	};
+
+	/*
+	* With data parallel training every process trains on its own shard of the training set, which are all the same size.
+	* Thus every process synchronizes its gradients equally often. Only rank 0 reports, validates and writes checkpoints.
+	*/
+	const size_t rank = ring ? ring->rank : 0, worldSize = ring ? ring->worldSize : 1;
+	const size_t shardSize = trainInput.size() / worldSize;
+
+	std::unique_ptr<AugmentationPipeline> pipeline;
+
+	/*
+	* The outputs of the frozen layers do not change while training, so they are computed once and the epochs start at the first layer that is not frozen.
+	* Augmented samples are different every epoch, so their features can not be cached.
+	*/
+	const size_t frozenLayers = augment ? 0 : FrozenLayers();
+	const size_t inputLayer = frozenLayers > 1 ? frozenLayers - 1 : 0;
+
+	std::vector<std::vector<float>> trainFeatureMemory, validationFeatureMemory;
+	std::unique_ptr<DatasetCache> trainFeatureCache, validationFeatureCache;
+	SampleSet trainSamples = trainInput, validationSamples = validationInput;
+
+	if (inputLayer != 0) {
+		const auto startTime = std::chrono::steady_clock::now();
+
+		trainSamples = ComputeFeatures(frozenLayers, trainInput, trainLabels, "train", trainFeatureMemory, trainFeatureCache);
+		validationSamples = ComputeFeatures(frozenLayers, validationInput, validationLabels, "validation", validationFeatureMemory, validationFeatureCache);
+
+		const std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - startTime;
+
+		if (rank == 0 && verbose)
+			std::cout << std::format("Cached the features of the {} frozen layers in {}\n", frozenLayers, elapsedTime);
+	}
+
+	SetTraining(true);
+
+	//The inputs of the exit heads on the frozen layers before the cached features are not computed, so those heads are not trained.
+	for (auto& head : exitHeads)
+		head.classifier->training = head.layer >= inputLayer;
+
+	if (augment)
+		pipeline = std::make_unique<AugmentationPipeline>(trainInput, Layers.front()->outputWidth, Layers.front()->outputHeight, Layers.front()->outputChannels, augmentation, augmentationThreads);
+
+	for (size_t epoch = firstEpoch; epoch < epochs; epoch++) {
+		float totalLoss = 0.f;
 		size_t NaNs = 0;
 
-		size_t trainCorrect = 0, validationCorrect = 0;
+		size_t trainCorrect = 0;
+
+		if (pruningSparsity > 0.f) {
+			const float sparsity = pruningSparsity * std::min(1.f, static_cast<float>(epoch + 1) / static_cast<float>(pruningRampEpochs));
+
+			//The frozen layers are not pruned, as they are not trained.
+			for (size_t i = FrozenLayers(); i < Layers.size(); i++) {
+				if (Layers[i]->layerType == LayerTypes::FullyConnectedLayer)
+					static_cast<FullyConnected*>(Layers[i])->Prune(sparsity);
+			}
+		}
 
-		std::cout << "Epoch " << epoch + 1 << "/" << epochs << " - Learning Rate: " << learningRate << '\n';
+		if (rank == 0 && verbose)
+			std::cout << std::format("Epoch {}/{} - Learning Rate: {}\n", epoch + 1, epochs, learningRate);
 		const auto startTime = std::chrono::steady_clock::now();
 
-		for (size_t n = 0; n < trainInput.size(); n++) {
-			Layers.front()->outputs = trainInput[n];
-			FeedForward();
+		size_t allocations = 0;
+
+		if (pipeline)
+			pipeline->Start(epoch, rank, worldSize, shardSize);
+
+		for (size_t step = 0; step < shardSize; step++) {
+			const size_t n = step * worldSize + rank;
+
+			//The first step is the warm up, after it no step should allocate any memory.
+			const size_t allocationsBefore = GetAllocationCount();
+
+			if (pipeline)
+				pipeline->Next(Layers.front()->outputs);
+			else
+				std::ranges::copy(trainSamples[n], Layers[inputLayer]->outputs.begin());
+
+			FeedForward(inputLayer + 1);
+			FeedForwardExitHeads(inputLayer);
+
+			LabelToOneHotEncoding(trainLabels[n], expectedOutput);
 
-			auto expectedOutput = LabelToOneHotEncoding(trainLabels[n], Layers.back()->outputHeight);
+			const bool correct = std::distance(Layers.back()->outputs.begin(), std::ranges::max_element(Layers.back()->outputs)) == trainLabels[n];
 
-			if (std::distance(Layers.back()->outputs.begin(), std::ranges::max_element(Layers.back()->outputs)) == trainLabels[n])
+			if (correct)
 				trainCorrect++;
 
+			//The accumulated gradients are averaged over all processes every localBatchSize steps, and at the end of the shard.
+			const bool synchronize = ring && ((step + 1) % localBatchSize == 0 || step + 1 == shardSize);
+
 			float loss = CrossEntropyLoss(expectedOutput, Layers.back()->outputs);
+
+			//Only rank 0 records, the other ranks train on a shard of the same distribution.
+			if (telemetry && rank == 0) {
+				TelemetryRecord record;
+				record.step = step;
+				record.epoch = static_cast<uint32_t>(epoch);
+				record.loss = loss;
+				record.learningRate = learningRate;
+				record.flags = (std::isnan(loss) ? TelemetryRecord::NaN : 0) | (correct ? TelemetryRecord::Correct : 0);
+
+				float squaredNorm = 0.f;
+				for (size_t i = 0; i < expectedOutput.size(); i++)
+					squaredNorm += (Layers.back()->outputs[i] - expectedOutput[i]) * (Layers.back()->outputs[i] - expectedOutput[i]);
+
+				record.gradientNorm = std::sqrt(squaredNorm);
+				telemetry->Push(record);
+			}
+
 			if (!std::isnan(loss)) {
-				BackPropogate(expectedOutput);
+				BackPropogate(expectedOutput, synchronize);
 
 				totalLoss += loss;
 			}
-			else
+			else {
 				NaNs++;
+
+				//The other processes still wait for the gradients of this process.
+				for (size_t i = Layers.size(); synchronize && i-- > 0;)
+					gradientAllReduce->LayerDone(i);
+			}
+
+			if (synchronize) {
+				gradientAllReduce->Wait();
+
+				const size_t samples = worldSize * (step % localBatchSize + 1);
+
+				for (auto& layer : Layers)
+					layer->ApplyGradients(1.f / static_cast<float>(samples));
+			}
+
+			if (epoch > firstEpoch || step > 0)
+				allocations += GetAllocationCount() - allocationsBefore;
 		}
 
 		const auto endTime = std::chrono::steady_clock::now();
 		const std::chrono::duration<double> elapsedTime = endTime - startTime;
 
-		std::cout << "  Fitting " << elapsedTime << " - Loss: " << totalLoss / static_cast<float>(trainInput.size()) << " - Accuracy : " << (static_cast<float>(trainCorrect) / static_cast<float>(trainInput.size())) * 100.f << " % - NaNs : " << NaNs << "\n";
+		if (rank == 0 && verbose)
+			std::cout << std::format("  Fitting {} - Loss: {} - Accuracy : {} % - NaNs : {}\n", elapsedTime, totalLoss / static_cast<float>(shardSize), (static_cast<float>(trainCorrect) / static_cast<float>(shardSize)) * 100.f, NaNs);
 
-		for (size_t n = 0; n < validationInput.size(); n++) {
-			auto prediction = Predict(validationInput[n]);
-			auto expectedOutput = LabelToOneHotEncoding(validationLabels[n], Layers.back()->outputHeight);
+		if (rank == 0 && verbose && pruningSparsity > 0.f)
+			std::cout << std::format("  Sparsity: {:.1f} %\n", Sparsity() * 100.f);
 
-			if (std::distance(Layers.back()->outputs.begin(), std::ranges::max_element(Layers.back()->outputs)) == validationLabels[n])
-				validationCorrect++;
+		stepAllocations += allocations;
 
-			float loss = CrossEntropyLoss(expectedOutput, prediction);
+		//Update learning rate based on the decay rate, before the snapshot so a checkpoint contains the rate of the next epoch.
 
-			totalValidationLoss += loss;
-		}
+		learningRate /= (1.f + decayRate);
+		SetLearningRate(learningRate, decayRate);
 
-		std::cout << "  Validation - Loss: " << totalValidationLoss / static_cast<float>(validationInput.size()) << " - Accuracy : " << (static_cast<float>(validationCorrect) / static_cast<float>(validationInput.size())) * 100.f << " % \n";
+		if (rank != 0)
+			continue;
 
+		const bool checkpoint = !checkpointFile.empty() && ((epoch + 1) % checkpointInterval == 0 || epoch + 1 == epochs);
 
-		//Update learning rate based on the decay rate
+		//Without validation samples or a checkpoint to write, no snapshot is needed.
+		if (validationSamples.empty() && !checkpoint)
+			continue;
 
-		learningRate /= (1.f + decayRate);
-		SetLearningRate(learningRate, decayRate);
+		finishValidation();
+
+		auto snapshot = std::make_shared<NeuralNetwork>(*this);
+		snapshot->SetTraining(false);
+
+		validation = std::async(std::launch::async, [snapshot, epoch, checkpoint, fileName = checkpointFile, &validationSamples, &validationLabels, inputLayer]() {
+			if (checkpoint) {
+				std::string error = snapshot->SaveCheckpoint(fileName, epoch + 1);
+
+				if (!error.empty())
+					return error;
+			}
+
+			if (!validationSamples.empty())
+				snapshot->Validate(epoch, validationSamples, validationLabels, inputLayer);
+
+			return std::string();
+		});
+	}
+
+	finishValidation();
+
+	SetTraining(false);
+}
+
+/*
+* Runs the validation set through the network and reports the loss and accuracy of the given epoch.
+* The report is written with a single write, because it is printed from a background thread while the next epoch is trained.
+* When the first layer is not 0, the validation inputs are the cached outputs of the layer before it.
+*/
+void NeuralNetwork::Validate(size_t epoch, const SampleSet& validationInput, const std::vector<size_t>& validationLabels, size_t firstLayer)
+{
+	float totalValidationLoss = 0.f;
+	size_t validationCorrect = 0;
+
+	std::vector<float> expectedOutput(Layers.back()->outputHeight, 0.f);
+
+	if (Layers[0]->batchSize != 1)
+		SetBatchSize(1);
+
+	const auto& prediction = Layers.back()->outputs;
+
+	for (size_t n = 0; n < validationInput.size(); n++) {
+		std::ranges::copy(validationInput[n], Layers[firstLayer]->outputs.begin());
+		FeedForward(firstLayer + 1);
+
+		LabelToOneHotEncoding(validationLabels[n], expectedOutput);
+
+		if (std::distance(prediction.begin(), std::ranges::max_element(prediction)) == validationLabels[n])
+			validationCorrect++;
+
+		float loss = CrossEntropyLoss(expectedOutput, prediction);
+
+		totalValidationLoss += loss;
 	}
+
+	if (verbose)
+		std::cout << std::format("  Validation epoch {} - Loss: {} - Accuracy : {} % \n", epoch + 1, totalValidationLoss / static_cast<float>(validationInput.size()), (static_cast<float>(validationCorrect) / static_cast<float>(validationInput.size())) * 100.f);
+
 }
 
 void NeuralNetwork::SetLearningRate(float learningRate, float decayRate)
@@ -135,25 +1227,23 @@ void NeuralNetwork::SetLearningRate(float learningRate, float decayRate)
 
 	for (auto& layer : Layers)
 		layer->learningRate = learningRate;
+
+	for (auto& head : exitHeads)
+		head.classifier->learningRate = learningRate;
 }
 
 void NeuralNetwork::SaveModel(const std::string& fileName) const
 {
-	std::ofstream file(fileName, std::ios::binary | std::fstream::out);
+	std::ofstream file = OpenTemporaryFile(fileName);
 
-	if (file.is_open()) {
-		size_t size =  Layers.size();
-		file.write((const char*)&size, sizeof(size));
+	WriteModel(file);
 
-		for (const auto& layer : Layers)
-			layer->SaveLayer(file);
-	} 
-	else {
-		std::cout << "Error, could not create file named: " << fileName;
+	const std::string error = CommitTemporaryFile(file, fileName);
+
+	if (!error.empty()) {
+		std::cout << error;
 		exit(1);
 	}
-
-	file.close();
 }
 
 void NeuralNetwork::LoadModel(const std::string& fileName)
@@ -161,58 +1251,280 @@ void NeuralNetwork::LoadModel(const std::string& fileName)
 	std::ifstream file(fileName, std::ios::binary | std::fstream::in);
 
 	if (file.is_open()) {
-		size_t size = 0;
+		ReadModel(file, fileName);
+
+		if (!tuningCacheFile.empty())
+			Tune();
+	}
+	else {
+		std::cout << "Error, could not open file named: " << fileName;
+	}
+}
+
+/*
+* A checkpoint is a saved model followed by the state needed to continue training it. Thus a checkpoint can also be loaded as a model.
+* The network is trained with plain SGD without shuffling, so the learning rate, decay rate and epoch are the complete training state.
+*/
+std::string NeuralNetwork::SaveCheckpoint(const std::string& fileName, size_t epoch) const
+{
+	std::ofstream file = OpenTemporaryFile(fileName);
+
+	WriteModel(file);
+
+	file.write((const char*)&checkpointMagic, sizeof(checkpointMagic));
+	file.write((const char*)&epoch, sizeof(epoch));
+	file.write((const char*)&learningRate, sizeof(learningRate));
+	file.write((const char*)&decayRate, sizeof(decayRate));
+
+	return CommitTemporaryFile(file, fileName);
+}
+
+/*
+* Copies the weights stored in the checkpoint into the layers of the network, and returns the amount of epochs it was trained for.
+* The layers themselves are kept, so the frozen layers, the data parallel gradients and the tuned algorithms stay as they were set.
+* Thus the network has to have the same layers and exit heads as the checkpoint.
+*/
+size_t NeuralNetwork::LoadCheckpoint(const std::string& fileName)
+{
+	std::ifstream file(fileName, std::ios::binary | std::fstream::in);
+
+	if (!file.is_open()) {
+		std::cout << "Error, could not open file named: " << fileName << '\n';
+		exit(1);
+	}
+
+	NeuralNetwork checkpoint;
+	checkpoint.ReadModel(file, fileName);
+
+	size_t magic = 0, epoch = 0;
+	float learningRate = 0.f, decayRate = 0.f;
+
+	file.read((char*)&magic, sizeof(magic));
+	file.read((char*)&epoch, sizeof(epoch));
+	file.read((char*)&learningRate, sizeof(learningRate));
+	file.read((char*)&decayRate, sizeof(decayRate));
+
+	if (!file || magic != checkpointMagic) {
+		std::cout << "Error, file: " << fileName << " is not a checkpoint\n";
+		exit(1);
+	}
+
+	bool sameLayers = Layers.size() == checkpoint.Layers.size() && exitHeads.size() == checkpoint.exitHeads.size();
+
+	for (size_t i = 0; i < Layers.size() && sameLayers; i++)
+		sameLayers = SameLayerShape(Layers[i], checkpoint.Layers[i]);
+
+	for (size_t i = 0; i < exitHeads.size() && sameLayers; i++)
+		sameLayers = exitHeads[i].layer == checkpoint.exitHeads[i].layer && SameLayerShape(exitHeads[i].classifier, checkpoint.exitHeads[i].classifier);
+
+	if (!sameLayers) {
+		std::cout << "Error LoadCheckpoint(), the layers of checkpoint: " << fileName << " differ from those of the network\n";
+		exit(1);
+	}
+
+	for (size_t i = 0; i < Layers.size(); i++)
+		CopyLayerWeights(Layers[i], checkpoint.Layers[i]);
+
+	for (size_t i = 0; i < exitHeads.size(); i++)
+		CopyLayerWeights(exitHeads[i].classifier, checkpoint.exitHeads[i].classifier);
+
+	SetLearningRate(learningRate, decayRate);
+
+	return epoch;
+}
+
+void NeuralNetwork::WriteModel(std::ofstream& file) const
+{
+	file.write((const char*)&modelFileMagic, sizeof(modelFileMagic));
+	file.write((const char*)&modelFileVersion, sizeof(modelFileVersion));
+
+	size_t size = Layers.size();
+	file.write((const char*)&size, sizeof(size));
+
+	for (const auto& layer : Layers)
+		layer->SaveLayer(file);
+
+	size = exitHeads.size();
+	file.write((const char*)&size, sizeof(size));
+
+	for (const auto& head : exitHeads) {
+		file.write((const char*)&head.layer, sizeof(head.layer));
+		head.classifier->SaveLayer(file);
+	}
+}
+
+void NeuralNetwork::ReadModel(std::ifstream& file, const std::string& fileName)
+{
+	size_t size = 0, version = 0;
+	file.read((char*)&size, sizeof(size));
+
+	//Files without the magic value are from before the format was versioned, and directly start with the amount of layers.
+	if (size == modelFileMagic) {
+		file.read((char*)&version, sizeof(version));
 		file.read((char*)&size, sizeof(size));
+	}
 
-		for (int i = 0; i < size; i++) {
-			uint8_t layerType;
-
-			file.read((char*)&layerType, sizeof(layerType));
-
-			switch (layerType)
-			{
-			case InputLayer:
-				this->AddLayer(new Input(file));
-				break;
-			case ConvolutionLayer:
-				this->AddLayer(new Convolution(file));
-				break;
-			case MaxPoolingLayer:
-				this->AddLayer(new MaxPooling(file));
-				break;
-			case FullyConnectedLayer:
-				this->AddLayer(new FullyConnected(file, Layers[i - 1]));
-				break;
-			};
-					
-		}
+	if (version > modelFileVersion) {
+		std::cout << "Error, model file: " << fileName << " has version " << version << " which is newer than the supported version " << modelFileVersion << '\n';
+		exit(1);
+	}
 
-		NeuralLayer* previousLayer = nullptr;
-		for (auto& layer : Layers)
+	for (int i = 0; i < size; i++) {
+		uint8_t layerType;
+
+		file.read((char*)&layerType, sizeof(layerType));
+
+		switch (layerType)
 		{
-			layer->previousLayer = previousLayer;
-			previousLayer = layer;
-		}
+		case InputLayer:
+			this->AddLayer(new Input(file));
+			break;
+		case ConvolutionLayer:
+			this->AddLayer(new Convolution(file, version));
+			break;
+		case MaxPoolingLayer:
+			this->AddLayer(new MaxPooling(file, version));
+			break;
+		case FullyConnectedLayer:
+			this->AddLayer(new FullyConnected(file, Layers[i - 1]));
+			break;
+		case SparseFullyConnectedLayer:
+			this->AddLayer(new SparseFullyConnected(file));
+			break;
+		case BatchNormLayer:
+			this->AddLayer(new BatchNorm(file));
+			break;
+		case DepthwiseConvolutionLayer:
+			this->AddLayer(new DepthwiseConvolution(file));
+			break;
+		case PointwiseConvolutionLayer:
+			this->AddLayer(new PointwiseConvolution(file));
+			break;
+		case AveragePoolingLayer:
+			this->AddLayer(new AveragePooling(file));
+			break;
+		case GlobalAveragePoolingLayer:
+			this->AddLayer(new GlobalAveragePooling(file));
+			break;
+		};
+				
 	}
-	else {
-		std::cout << "Error, could not open file named: " << fileName;
+
+	NeuralLayer* previousLayer = nullptr;
+	for (auto& layer : Layers)
+	{
+		layer->previousLayer = previousLayer;
+		previousLayer = layer;
+	}
+
+	if (version < 7)
+		return;
+
+	size_t heads = 0;
+	file.read((char*)&heads, sizeof(heads));
+
+	for (size_t i = 0; i < heads; i++) {
+		size_t layer = 0;
+		uint8_t layerType = 0;
+
+		file.read((char*)&layer, sizeof(layer));
+		file.read((char*)&layerType, sizeof(layerType));
+
+		if (!file || layerType != FullyConnectedLayer || layer == 0 || layer + 1 >= Layers.size()) {
+			std::cout << "Error, model file: " << fileName << " contains an invalid exit head\n";
+			exit(1);
+		}
+
+		auto* classifier = new FullyConnected(file, Layers[layer]);
+		classifier->previousLayer = Layers[layer];
+
+		exitHeads.push_back({ layer, classifier, std::vector<float>(Layers[layer]->outputGradients.size()) });
 	}
 }
 
-void NeuralNetwork::BackPropogate(const std::vector<float>& expected)
+/*
+* When the gradients are synchronized, the gradients of every layer are handed to the gradient all reduce as soon as the layer is done,
+* so they are averaged over the other processes while the earlier layers are still backpropogating.
+*/
+void NeuralNetwork::BackPropogate(const std::vector<float>& expected, bool synchronize)
 {
 	for (size_t i = 0; i < expected.size(); i++)
 		Layers.back()->outputGradients[i] = Layers.back()->outputs[i] - expected[i];
 
-	for (auto& layer : std::views::reverse(Layers)) {
-		layer->BackPropogate();
+	//Backpropogation stops at the last frozen layer, the frozen layers are still reported as done so the all reduce of their buckets does not wait for them.
+	const size_t frozenLayers = FrozenLayers();
+
+	for (size_t i = Layers.size(); i-- > 0;) {
+		BackPropogateExitHeads(i, expected);
+
+		if (i >= frozenLayers)
+			Layers[i]->BackPropogate();
+
+		if (synchronize)
+			gradientAllReduce->LayerDone(i);
 	}
 }
 
-inline void NeuralNetwork::FeedForward()
+/*
+* The gradients of the layers after the given layer are already in its output gradients, but a FullyConnected layer overwrites
+* the output gradients of the layer before it. So they are set aside while the head backpropogates, and added to its gradients afterwards.
+*/
+void NeuralNetwork::BackPropogateExitHeads(size_t layer, const std::vector<float>& expected)
 {
-	for (auto& layer : Layers)
+	for (auto& head : exitHeads) {
+		if (head.layer != layer || !head.classifier->training)
+			continue;
+
+		FullyConnected* classifier = head.classifier;
+		std::vector<float>& layerGradients = Layers[layer]->outputGradients;
+
+		std::ranges::copy(layerGradients, head.layerGradients.begin());
+
+		for (size_t i = 0; i < expected.size(); i++)
+			classifier->outputGradients[i] = classifier->outputs[i] - expected[i];
+
+		classifier->BackPropogate();
+
+		for (size_t i = 0; i < layerGradients.size(); i++)
+			layerGradients[i] += head.layerGradients[i];
+	}
+}
+
+inline void NeuralNetwork::FeedForward(size_t firstLayer)
+{
+	for (size_t i = firstLayer; i < Layers.size(); i++)
 	{
-		layer->FeedForward();
+		Layers[i]->FeedForward();
 	}
 }
+
+void NeuralNetwork::FeedForwardExitHeads(size_t firstLayer)
+{
+	for (auto& head : exitHeads) {
+		if (head.layer >= firstLayer)
+			head.classifier->FeedForward();
+	}
+}
+
+const std::vector<float>& NeuralNetwork::FeedForwardCascade(size_t& exitTaken)
+{
+	size_t next = 0;
+
+	for (size_t i = 1; i < Layers.size(); i++) {
+		Layers[i]->FeedForward();
+
+		for (; next < exitHeads.size() && exitHeads[next].layer == i; next++) {
+			FullyConnected* classifier = exitHeads[next].classifier;
+			classifier->FeedForward();
+
+			if (*std::ranges::max_element(classifier->outputs) >= exitThreshold) {
+				exitTaken = next;
+				return classifier->outputs;
+			}
+		}
+	}
+
+	exitTaken = exitHeads.size();
+
+	return Layers.back()->outputs;
+}
@@ -2,37 +2,302 @@
 
 #include <vector>
 #include <memory>
+#include <string>
+#include <fstream>
+#include <map>
 
 #include "NeuralLayer.h"
+#include "Augmentation.h"
+#include "Numa.h"
 #include "common.h"
 
+class RingAllReduce;
+class GradientAllReduce;
+class TelemetryLog;
+
 class NeuralNetwork
 {
 private:
     std::vector<NeuralLayer*> Layers;
     float learningRate{};
     float decayRate{};
+
+    //Fit reports the progress of every epoch, unless it is disabled because many networks train at once.
+    bool verbose = true;
+
+    //The heap allocations done by the training steps of the last Fit, see StepAllocations.
+    size_t stepAllocations = 0;
+
+    /*
+    * Saved models start with the magic value "CNNMODEL" followed by the version of the file format.
+    * Version 1 added the stride of the MaxPooling layer, version 2 added the SparseFullyConnected layer, version 3 the BatchNorm layer
+    * version 4 the DepthwiseConvolution and PointwiseConvolution layers, version 5 the AveragePooling and GlobalAveragePooling layers,
+    * version 6 the stride of the Convolution layer and version 7 the exit heads, which are stored after the layers.
+    */
+    static constexpr size_t modelFileMagic = 0x4C45444F4D4E4E43;
+    static constexpr size_t modelFileVersion = 7;
+
+    //Marks the start of the training state in a checkpoint, "CNNSTATE".
+    static constexpr size_t checkpointMagic = 0x45544154534E4E43;
+
+    //Fit writes a checkpoint every checkpointInterval epochs, when a checkpoint file is set.
+    std::string checkpointFile;
+    size_t checkpointInterval = 1;
+
+    //Only set for data parallel training.
+    RingAllReduce* ring = nullptr;
+    std::unique_ptr<GradientAllReduce> gradientAllReduce;
+    size_t localBatchSize = 1;
+
+    //Fit prunes the FullyConnected layers at the start of every epoch, when the target sparsity is set.
+    float pruningSparsity = 0.f;
+    size_t pruningRampEpochs = 1;
+
+    //Fit augments the training samples on augmentationThreads worker threads, when augmentation is enabled.
+    bool augment = false;
+    AugmentationSettings augmentation;
+    size_t augmentationThreads = 0;
+
+    //Fit stores the features of the frozen layers in this directory when it is set, and in memory otherwise.
+    std::string featureCacheDirectory;
+
+    //Create and LoadModel tune the layers with this tuning cache, when it is set.
+    std::string tuningCacheFile;
+
+    //The algorithm Tune chose for every tuning key, so switching back to a batch size that was tuned before does not read the cache again.
+    std::map<std::string, std::string> tunedAlgorithms;
+
+    //Fit pushes the metrics of every training step to this log, when it is set.
+    std::unique_ptr<TelemetryLog> telemetry;
+
+    //A softmax classifier on the outputs of an intermediate layer, sorted by layer.
+    struct ExitHead
+    {
+        size_t layer;
+        FullyConnected* classifier;
+
+        //Holds the output gradients of the layer from the layers after it, while the gradients of the head are added to them.
+        std::vector<float> layerGradients;
+    };
+
+    std::vector<ExitHead> exitHeads;
+
+    //Predict stops at the first exit head with a highest output of at least the threshold, 0 disables the early exits.
+    float exitThreshold = 0.f;
     
 public:
-    NeuralNetwork() {}
-    NeuralNetwork(std::vector<NeuralLayer*> layer) {}
+    NeuralNetwork();
+    NeuralNetwork(std::vector<NeuralLayer*> layer);
+
+    /*
+    * Copies the network including all of its layers and weights. The network owns its layers, and deletes them when it is destroyed.
+    */
+    NeuralNetwork(const NeuralNetwork& other);
+    NeuralNetwork& operator=(const NeuralNetwork&) = delete;
+    ~NeuralNetwork();
 
     void AddLayer(NeuralLayer* layer);
 
-    std::vector<float> Predict(const std::vector<float> &Input);
+    /*
+    * The returned reference is the output of the last layer, which stays valid until the next call.
+    */
+    const std::vector<float>& Predict(std::span<const float> Input);
+
+    /*
+    * Predicts a batch of samples at once, the inputs and the returned outputs of the samples are stored after each other.
+    * Feeding forward a batch reads every weight only once for all the samples.
+    */
+    const std::vector<float>& PredictBatch(const float* inputs, size_t batchSize);
+    void SetBatchSize(size_t batchSize);
+
+    //The amount of values in a single sample of the input and output of the network.
+    size_t InputSize() const;
+    size_t OutputSize() const;
+
+    //The amount of layers, the input layer included.
+    size_t LayerCount() const;
+
+    //The amount of leading layers that have the same type, shape and weights as those of the other network, the input layer included.
+    size_t IdenticalLayers(const NeuralNetwork& other) const;
+
+    /*
+    * Makes the layer after the given amount of leading layers read the outputs of the trunk network, which has to have the same leading layers.
+    * Thus this network no longer computes them itself, FeedForwardFrom then feeds forward its own layers after the trunk has been fed forward.
+    * Afterwards the network can only be fed forward in this way, with the same batch size as the trunk. Used by Ensemble.
+    */
+    void ShareLayers(const NeuralNetwork& trunk, size_t layers);
+    const std::vector<float>& FeedForwardFrom(size_t firstLayer);
+
+    //The multiply adds of feeding a single sample forward through the layers from the given layer on.
+    size_t ForwardMACs(size_t firstLayer = 0) const;
 
     void Create(float learningRate = 0.000015f, float decayRate = 0.f);
     void PrintSummary() const;
+
+    //Trains one sample at a time, so BatchNorm layers after a FullyConnected layer do not normalize with batch statistics, see BatchNorm.
     void Fit(size_t epochs, const struct DataSet& dataSet);
-    void Fit(size_t epochs, const std::vector<std::vector<float>>& trainInput, const std::vector<size_t>& trainLabels, const std::vector<std::vector<float>>& validationInput, const std::vector<size_t>& validationLabels);
+    void Fit(size_t epochs, const SampleSet& trainInput, const std::vector<size_t>& trainLabels, const SampleSet& validationInput, const std::vector<size_t>& validationLabels);
 
     void SetLearningRate(float learningRate, float decayRate = 0.f);
+    void SetVerbose(bool verbose);
+
+    /*
+    * The amount of heap allocations done by the training steps of the last Fit, the first step of the first epoch excluded as it warms up.
+    * Only counted when the program is built with CNN_COUNT_ALLOCATIONS, see AllocationTest.cpp, otherwise it is always 0.
+    */
+    size_t StepAllocations() const;
+
+    /*
+    * Makes Fit write a checkpoint of the network and its training state every interval epochs, and after the last epoch.
+    * The checkpoint is written on a background thread from a snapshot of the network, and replaces the previous one atomically.
+    */
+    void SetCheckpoint(const std::string& fileName, size_t interval = 1);
+
+    /*
+    * Makes Fit train data parallel with the other processes in the ring, each process trains on its own shard of the training set.
+    * The gradients are accumulated for localBatchSize samples, and then averaged over all processes before they are applied.
+    * Has to be called after Create, the weights of rank 0 are copied to all other processes.
+    */
+    void SetDataParallel(RingAllReduce& ring, size_t localBatchSize = 32);
+
+    /*
+    * Makes Fit train on randomly shifted, rotated, distorted and noisy versions of the training samples, which are augmented while training.
+    * With 0 threads, one thread less than the amount of cores is used.
+    */
+    void SetAugmentation(const AugmentationSettings& settings, size_t threads = 0);
+
+    /*
+    * Frozen layers are not trained, backpropogation stops at the last frozen layer so all layers before it are not trained either.
+    * Fit computes the outputs of the frozen layers, the features, once for every sample and trains the other layers starting from them.
+    */
+    void SetFrozen(size_t layer, bool frozen = true);
+
+    /*
+    * Makes Fit store the features of the frozen layers in a dataset cache in the given directory, instead of in memory.
+    */
+    void SetFeatureCache(const std::string& directory);
+
+    /*
+    * Makes Fit record the loss, gradient norm, learning rate and NaNs of every training step in the given metrics file, see TelemetryLog.
+    * The records of all later calls to Fit go to the same file, an empty file name stops recording and closes the file.
+    */
+    void SetTelemetry(const std::string& fileName);
+
+    /*
+    * Makes Create and LoadModel tune the layers, the tuned algorithms are stored in the given tuning cache so later runs only look them up.
+    */
+    void SetAutoTuning(const std::string& cacheFile = "tuning.cache");
+
+    /*
+    * Times all the algorithms of the layers that can feed forward in several ways at the current batch size, and uses the fastest.
+    * Shapes that are in the tuning cache for this processor are not timed again. Once a network is tuned, SetBatchSize tunes it again
+    * for every new batch size, as the fastest algorithm depends on it.
+    */
+    void Tune();
+
+    /*
+    * Pins the calling thread to the node and moves the outputs, gradients and weights of all layers to the memory of the node, or spreads the weights
+    * over all nodes with the Interleaved placement. Call it from the thread that trains the network. Returns false when the pages could not be moved,
+    * a network that is created or loaded after this call is placed on the node anyway because memory is placed on the node that touches it first.
+    */
+    bool PlaceOnNode(size_t node, WeightPlacement placement = WeightPlacement::Local);
+
+    /*
+    * Feeds forward and backpropogates the given samples without changing the weights, and prints for every layer how many of the loads
+    * that missed the caches were served by the memory of a remote node. Only the calling thread is counted.
+    */
+    void PrintMemoryAccess(const SampleSet& inputs, const std::vector<size_t>& labels, size_t samples = 256);
+
+    //Samples per second of the forward pass alone, and of the forward and backward pass without updating the weights.
+    struct Throughput
+    {
+        double forward = 0.0;
+        double forwardBackward = 0.0;
+    };
+
+    /*
+    * Measures the throughput of a single sample at a time, as used by Fit and Predict, over the first samples of the given set.
+    * The weights and the running averages of BatchNorm layers do not change, the gradients are accumulated and discarded afterwards.
+    */
+    Throughput MeasureThroughput(const SampleSet& inputs, const std::vector<size_t>& labels, size_t samples = 1000);
+
+    /*
+    * Makes Fit prune the smallest weights of every FullyConnected layer at the start of every epoch, pruned weights stay zero while training.
+    * The sparsity increases linearly over the first rampEpochs epochs until it reaches the target sparsity.
+    */
+    void SetPruning(float targetSparsity, size_t rampEpochs = 1);
+
+    /*
+    * Replaces every FullyConnected layer with at least the given fraction of zero weights by a SparseFullyConnected layer,
+    * which only stores and computes the non zero weights.
+    */
+    void ConvertToSparse(float minimumSparsity = 0.5f);
+
+    /*
+    * Attaches a FullyConnected softmax head to the outputs of the given intermediate layer, which Fit trains together with the network.
+    * The gradients of the head are added to those of the layers after it. Has to be called after Create or LoadModel.
+    */
+    void AddExitHead(size_t layer);
+
+    /*
+    * Makes Predict feed forward one layer at a time, and return the outputs of the first exit head whose highest output reaches the threshold.
+    * Samples that no head is confident enough about run through the whole network. 0 disables the early exits, which is the default.
+    * PredictBatch always runs the whole network.
+    */
+    void SetExitThreshold(float threshold);
+
+    //Prints the accuracy, the average multiply adds and the share of the samples that leave at every exit, for each of the thresholds.
+    void PrintExitTradeoff(const SampleSet& inputs, const std::vector<size_t>& labels, const std::vector<float>& thresholds);
+
+    /*
+    * Folds every BatchNorm layer into the convolution or FullyConnected layer before it and removes it, so it costs nothing during inference.
+    * BatchNorm layers that follow another type of layer, or a layer with a non linear activation, are kept.
+    */
+    void FoldBatchNorm();
+
+    //The fraction of the weights of the (Sparse)FullyConnected layers that is zero.
+    float Sparsity() const;
+
+    //The fraction of the given samples that is classified correctly.
+    float Accuracy(const SampleSet& inputs, const std::vector<size_t>& labels);
+
+    /*
+    * Continues training from the given checkpoint until the network has been trained for the given amount of epochs in total.
+    * When the checkpoint does not exist yet, training starts at the first epoch with the current network.
+    * When the checkpoint is already trained for that many epochs, it is loaded and nothing is trained, which is reported.
+    * The network has to be built like the one in the checkpoint, only the weights are loaded, so frozen layers and other settings are kept.
+    */
+    void ResumeFit(const std::string& checkpointFile, size_t epochs, const DataSet& dataSet);
+    void ResumeFit(const std::string& checkpointFile, size_t epochs, const SampleSet& trainInput, const std::vector<size_t>& trainLabels, const SampleSet& validationInput, const std::vector<size_t>& validationLabels);
 
     void SaveModel(const std::string& fileName) const;
     void LoadModel(const std::string& fileName);
 
+    //Returns an error message when the checkpoint could not be written, or an empty string. It does not exit, as Fit writes checkpoints on a background thread.
+    std::string SaveCheckpoint(const std::string& fileName, size_t epoch) const;
+
+    //Copies the weights of the checkpoint into the network, which has to have the same layers, and returns the epoch of the checkpoint.
+    size_t LoadCheckpoint(const std::string& fileName);
+
 private:
-    void BackPropogate(const std::vector<float>& expected);
-    inline void FeedForward();
+    void BackPropogate(const std::vector<float>& expected, bool synchronize = false);
+    void Train(size_t firstEpoch, size_t epochs, const SampleSet& trainInput, const std::vector<size_t>& trainLabels, const SampleSet& validationInput, const std::vector<size_t>& validationLabels);
+    void Validate(size_t epoch, const SampleSet& validationInput, const std::vector<size_t>& validationLabels, size_t firstLayer = 0);
+    inline void FeedForward(size_t firstLayer = 0);
+
+    //Feeds forward the layers after the input, stopping at the first confident exit head. Sets exitTaken to the index of that head, or the amount of heads.
+    const std::vector<float>& FeedForwardCascade(size_t& exitTaken);
+    void FeedForwardExitHeads(size_t firstLayer);
+    void BackPropogateExitHeads(size_t layer, const std::vector<float>& expected);
+
+    //Sets the training flag of all layers that are not frozen.
+    void SetTraining(bool training);
+
+    //The amount of layers up to and including the last frozen layer.
+    size_t FrozenLayers() const;
+    SampleSet ComputeFeatures(size_t frozenLayers, const SampleSet& inputs, const std::vector<size_t>& labels, const std::string& name, std::vector<std::vector<float>>& features, std::unique_ptr<DatasetCache>& cache);
+
+    void WriteModel(std::ofstream& file) const;
+    void ReadModel(std::ifstream& file, const std::string& fileName);
 };
  
@@ -0,0 +1,218 @@
+#include "Numa.h"
+
+#include <string>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <filesystem>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+
+size_t NumaNodeCount()
+{
+    ULONG highestNode = 0;
+
+    return GetNumaHighestNodeNumber(&highestNode) ? highestNode + 1 : 1;
+}
+
+std::vector<size_t> NumaNodeProcessors(size_t node)
+{
+    GROUP_AFFINITY affinity{};
+    std::vector<size_t> processors;
+
+    if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity))
+        return processors;
+
+    for (size_t i = 0; i < 64; i++) {
+        if (affinity.Mask & (KAFFINITY(1) << i))
+            processors.push_back(affinity.Group * 64 + i);
+    }
+
+    return processors;
+}
+
+bool PinThreadToNode(size_t node)
+{
+    GROUP_AFFINITY affinity{};
+
+    return GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) && SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+}
+
+bool PinThreadToProcessor(size_t processor)
+{
+    GROUP_AFFINITY affinity{};
+    affinity.Group = static_cast<WORD>(processor / 64);
+    affinity.Mask = KAFFINITY(1) << (processor % 64);
+
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+}
+
+//Windows has no call that moves the pages of an existing allocation.
+bool MoveToNode(std::span<float>, size_t)
+{
+    return false;
+}
+
+bool Interleave(std::span<float>)
+{
+    return false;
+}
+
+NodeLoadCounter::NodeLoadCounter() {}
+NodeLoadCounter::~NodeLoadCounter() {}
+
+NodeLoadCounter::Counts NodeLoadCounter::Read() const
+{
+    return {};
+}
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+//The memory policies of mbind, from linux/mempolicy.h.
+static constexpr int preferredPolicy = 1, interleavePolicy = 3, movePages = 1 << 1;
+
+//Parses a list of processors such as "0-3,8-11".
+static std::vector<size_t> ParseProcessorList(const std::string& list)
+{
+    std::vector<size_t> processors;
+    size_t position = 0;
+
+    while (position < list.size() && std::isdigit(static_cast<unsigned char>(list[position]))) {
+        size_t end = 0;
+        const size_t first = std::stoull(list.substr(position), &end);
+        size_t last = first;
+        position += end;
+
+        if (position < list.size() && list[position] == '-') {
+            last = std::stoull(list.substr(position + 1), &end);
+            position += end + 1;
+        }
+
+        for (size_t processor = first; processor <= last; processor++)
+            processors.push_back(processor);
+
+        if (position < list.size() && list[position] == ',')
+            position++;
+    }
+
+    return processors;
+}
+
+size_t NumaNodeCount()
+{
+    size_t nodes = 0;
+
+    while (std::filesystem::exists("/sys/devices/system/node/node" + std::to_string(nodes)))
+        nodes++;
+
+    return std::max<size_t>(nodes, 1);
+}
+
+std::vector<size_t> NumaNodeProcessors(size_t node)
+{
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+
+    if (!std::getline(file, list)) {
+        //Without NUMA support all processors are on node 0.
+        std::vector<size_t> processors;
+
+        for (long i = 0; node == 0 && i < sysconf(_SC_NPROCESSORS_ONLN); i++)
+            processors.push_back(static_cast<size_t>(i));
+
+        return processors;
+    }
+
+    return ParseProcessorList(list);
+}
+
+static bool PinThread(const std::vector<size_t>& processors)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (size_t processor : processors) {
+        if (processor < CPU_SETSIZE)
+            CPU_SET(processor, &set);
+    }
+
+    return !processors.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool PinThreadToNode(size_t node)
+{
+    return PinThread(NumaNodeProcessors(node));
+}
+
+bool PinThreadToProcessor(size_t processor)
+{
+    return PinThread({ processor });
+}
+
+//Nodes are given as a bit mask, which supports up to 64 nodes.
+static bool Bind(std::span<float> buffer, int policy, unsigned long nodes)
+{
+    const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t begin = (reinterpret_cast<uintptr_t>(buffer.data()) + pageSize - 1) & ~(pageSize - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(buffer.data() + buffer.size()) & ~(pageSize - 1);
+
+    if (end <= begin)
+        return true;
+
+    return syscall(SYS_mbind, begin, end - begin, policy, &nodes, sizeof(nodes) * 8 + 1, movePages) == 0;
+}
+
+bool MoveToNode(std::span<float> buffer, size_t node)
+{
+    return node < 64 && Bind(buffer, preferredPolicy, 1ul << node);
+}
+
+bool Interleave(std::span<float> buffer)
+{
+    const size_t nodes = std::min<size_t>(NumaNodeCount(), 64);
+
+    return Bind(buffer, interleavePolicy, nodes == 64 ? ~0ul : (1ul << nodes) - 1);
+}
+
+static intptr_t OpenNodeCounter(uint64_t result)
+{
+    perf_event_attr attributes{};
+    attributes.type = PERF_TYPE_HW_CACHE;
+    attributes.size = sizeof(attributes);
+    attributes.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    //Counts the calling thread on any processor.
+    return syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+NodeLoadCounter::NodeLoadCounter() :
+    loads(OpenNodeCounter(PERF_COUNT_HW_CACHE_RESULT_ACCESS)), remoteLoads(OpenNodeCounter(PERF_COUNT_HW_CACHE_RESULT_MISS))
+{
+}
+
+NodeLoadCounter::~NodeLoadCounter()
+{
+    if (loads != -1)
+        close(static_cast<int>(loads));
+    if (remoteLoads != -1)
+        close(static_cast<int>(remoteLoads));
+}
+
+NodeLoadCounter::Counts NodeLoadCounter::Read() const
+{
+    uint64_t all = 0, remote = 0;
+
+    if (!Available() || read(static_cast<int>(loads), &all, sizeof(all)) != sizeof(all) || read(static_cast<int>(remoteLoads), &remote, sizeof(remote)) != sizeof(remote))
+        return {};
+
+    return { all - std::min(all, remote), remote };
+}
+#endif
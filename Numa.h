@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <cstdint>
+
+/*
+* Places threads and their memory on the NUMA nodes of the machine. Memory is placed on the node of the thread that touches it first,
+* so a network that is created or loaded by a pinned thread is already local. The pages of existing buffers can only be moved on Linux,
+* on other systems MoveToNode and Interleave return false. Machines without NUMA have a single node.
+*
+* Local places the weights of a network on the node of its thread, so every data parallel process that runs on its own node trains on its own replica.
+* Interleaved spreads the pages of the weights over all nodes, for when the threads of a single network run on several nodes.
+*/
+enum class WeightPlacement { Local, Interleaved };
+
+size_t NumaNodeCount();
+std::vector<size_t> NumaNodeProcessors(size_t node);
+
+//Restricts the calling thread to the processors of the node, or to a single processor.
+bool PinThreadToNode(size_t node);
+bool PinThreadToProcessor(size_t processor);
+
+//Moves the pages that lie completely inside the buffer to the node, or spreads them over all nodes.
+bool MoveToNode(std::span<float> buffer, size_t node);
+bool Interleave(std::span<float> buffer);
+
+/*
+* Counts the loads of the calling thread that missed the caches and were served by memory, split into loads from the memory of
+* the node of the thread and loads from a remote node. Uses the node-loads and node-load-misses hardware events of Linux,
+* which are not available on every processor or when the performance counters are restricted.
+*/
+class NodeLoadCounter
+{
+public:
+    struct Counts
+    {
+        uint64_t local = 0, remote = 0;
+    };
+
+    NodeLoadCounter();
+    NodeLoadCounter(const NodeLoadCounter&) = delete;
+    NodeLoadCounter& operator=(const NodeLoadCounter&) = delete;
+    ~NodeLoadCounter();
+
+    bool Available() const { return loads != -1 && remoteLoads != -1; }
+
+    //The counts since the counter was created.
+    Counts Read() const;
+
+private:
+    intptr_t loads = -1, remoteLoads = -1;
+};
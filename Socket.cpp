@@ -0,0 +1,184 @@
+#include "Socket.h"
+
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+
+using NativeSocket = SOCKET;
+
+static void CloseNativeSocket(NativeSocket socket) { closesocket(socket); }
+static constexpr int sendFlags = 0, shutdownBoth = SD_BOTH;
+
+//Winsock has to be started once before any socket is used.
+static void InitializeSockets()
+{
+    static const bool initialized = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+
+    if (!initialized) {
+        std::cout << "Error, could not initialize Winsock\n";
+        exit(1);
+    }
+}
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+using NativeSocket = int;
+
+static void CloseNativeSocket(NativeSocket socket) { close(socket); }
+//A closed connection is reported by send, instead of by raising SIGPIPE.
+static constexpr int sendFlags = MSG_NOSIGNAL, shutdownBoth = SHUT_RDWR;
+static void InitializeSockets() {}
+#endif
+
+//Send and recv take the size as an int, so large buffers are transferred in chunks.
+static constexpr size_t maxChunk = 1 << 30;
+
+Socket::Socket(Socket&& other) noexcept :
+    handle(std::exchange(other.handle, invalidHandle))
+{
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+    if (this != &other) {
+        Close();
+        handle = std::exchange(other.handle, invalidHandle);
+    }
+
+    return *this;
+}
+
+Socket::~Socket()
+{
+    Close();
+}
+
+Socket Socket::Listen(uint16_t port, bool local)
+{
+    InitializeSockets();
+
+    NativeSocket native = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    int reuse = 1;
+    setsockopt(native, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(local ? INADDR_LOOPBACK : INADDR_ANY);
+
+    if (bind(native, (const sockaddr*)&address, sizeof(address)) != 0 || listen(native, SOMAXCONN) != 0) {
+        std::cout << "Error, could not listen on port: " << port << '\n';
+        exit(1);
+    }
+
+    return Socket(static_cast<intptr_t>(native));
+}
+
+Socket Socket::Connect(const std::string& host, uint16_t port, std::chrono::milliseconds timeout)
+{
+    InitializeSockets();
+
+    addrinfo hints{}, *result = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0)
+        return Socket();
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    do {
+        NativeSocket native = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+        if (connect(native, result->ai_addr, static_cast<int>(result->ai_addrlen)) == 0) {
+            //Requests and gradients are small messages that have to go out directly.
+            int noDelay = 1;
+            setsockopt(native, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+            freeaddrinfo(result);
+            return Socket(static_cast<intptr_t>(native));
+        }
+
+        CloseNativeSocket(native);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    } while (std::chrono::steady_clock::now() < deadline);
+
+    freeaddrinfo(result);
+    return Socket();
+}
+
+Socket Socket::Accept() const
+{
+    NativeSocket native = accept(static_cast<NativeSocket>(handle), nullptr, nullptr);
+
+    if (static_cast<intptr_t>(native) == invalidHandle)
+        return Socket();
+
+    int noDelay = 1;
+    setsockopt(native, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+    return Socket(static_cast<intptr_t>(native));
+}
+
+bool Socket::Send(const void* data, size_t size) const
+{
+    const char* bytes = static_cast<const char*>(data);
+
+    while (size > 0) {
+        const auto sent = send(static_cast<NativeSocket>(handle), bytes, static_cast<int>(std::min(size, maxChunk)), sendFlags);
+
+        if (sent <= 0)
+            return false;
+
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+
+    return true;
+}
+
+bool Socket::Receive(void* data, size_t size) const
+{
+    char* bytes = static_cast<char*>(data);
+
+    while (size > 0) {
+        const auto received = recv(static_cast<NativeSocket>(handle), bytes, static_cast<int>(std::min(size, maxChunk)), 0);
+
+        if (received <= 0)
+            return false;
+
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+
+    return true;
+}
+
+void Socket::Shutdown() const
+{
+    if (handle != invalidHandle)
+        shutdown(static_cast<NativeSocket>(handle), shutdownBoth);
+}
+
+void Socket::Close()
+{
+    if (handle != invalidHandle) {
+        CloseNativeSocket(static_cast<NativeSocket>(handle));
+        handle = invalidHandle;
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <chrono>
+
+/*
+* A blocking TCP socket, used for the local inference server and for communication between training processes.
+* The connection is closed when the socket is destroyed.
+*/
+class Socket
+{
+public:
+    Socket() = default;
+    Socket(Socket&& other) noexcept;
+    Socket& operator=(Socket&& other) noexcept;
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    ~Socket();
+
+    /*
+    * Creates a socket listening on the given port of the loopback interface, or on all interfaces when local is false.
+    */
+    static Socket Listen(uint16_t port, bool local = true);
+
+    /*
+    * Connects to the given host and port, connecting is retried until the timeout passes so the other side can still be starting.
+    * Returns an invalid socket when no connection could be made.
+    */
+    static Socket Connect(const std::string& host, uint16_t port, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    Socket Accept() const;
+
+    /*
+    * Sends or receives exactly the given amount of bytes, returns false when the connection is closed or broken.
+    */
+    bool Send(const void* data, size_t size) const;
+    bool Receive(void* data, size_t size) const;
+
+    bool IsValid() const { return handle != invalidHandle; }
+
+    //Ends the connection in both directions without closing the socket, so a Send or Receive that blocks on another thread returns false.
+    void Shutdown() const;
+    void Close();
+
+private:
+    static constexpr intptr_t invalidHandle = -1;
+
+    explicit Socket(intptr_t handle) : handle(handle) {}
+
+    intptr_t handle = invalidHandle;
+};
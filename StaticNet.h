@@ -0,0 +1,415 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <span>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <utility>
+
+#include "NeuralLayer.h"
+
+/*
+* Networks with an architecture that is fixed at compile time, for deployed models. The network is declared as a type:
+*
+*   using Model = StaticNet<Static::Input<28, 28, 1>, Static::Conv<8, 5>, Static::MaxPool<2>, Static::FC<10, Static::Softmax>>;
+*
+* Every size and loop bound is a constant, and all weights and outputs are std::arrays in the network itself, so inference never allocates
+* and the compiler can inline and unroll the whole forward pass. The weights are loaded from a .model file saved by NeuralNetwork,
+* which has to have exactly the same layers. Large models should be created with std::make_unique, as their weights are members.
+*/
+namespace Static
+{
+    enum Activation { ReLU, LeakyReLU, Linear, Softmax };
+
+    namespace detail
+    {
+        //The name of the activation function as stored in the model files.
+        constexpr const char* ActivationName(Activation activation)
+        {
+            switch (activation) {
+            case ReLU: return "relu";
+            case LeakyReLU: return "leakyrelu";
+            case Softmax: return "softmax";
+            default: return "linear";
+            }
+        }
+
+        //The same activation functions as NeuralLayer, so a static network gives the same outputs as the network it was saved from.
+        template <Activation activation, size_t size>
+        inline void Activate(float* outputs)
+        {
+            if constexpr (activation == ReLU) {
+                for (size_t i = 0; i < size; i++)
+                    outputs[i] = std::max(0.f, outputs[i]);
+            }
+            else if constexpr (activation == LeakyReLU) {
+                for (size_t i = 0; i < size; i++)
+                    outputs[i] = std::max(0.1f * outputs[i], outputs[i]);
+            }
+            else if constexpr (activation == Softmax) {
+                const float max = *std::max_element(outputs, outputs + size);
+                float sum = 0.f;
+
+                for (size_t i = 0; i < size; i++) {
+                    outputs[i] = std::clamp(outputs[i] - max, -80.f, 50.f);
+                    sum += std::exp(outputs[i]);
+                }
+
+                sum = std::max(sum, 1E-12f);
+
+                for (size_t i = 0; i < size; i++)
+                    outputs[i] = std::exp(outputs[i]) / sum;
+            }
+        }
+
+        //Reads the layers of a model file one at a time, and checks that they are the layers of the static network.
+        class ModelReader
+        {
+        public:
+            explicit ModelReader(const std::string& fileName) : file(fileName, std::ios::binary), fileName(fileName)
+            {
+                if (!file.is_open())
+                    Fail("could not be opened");
+
+                size_t size = 0;
+                file.read((char*)&size, sizeof(size));
+
+                //Files without the magic value are from before the format was versioned, and directly start with the amount of layers.
+                if (size == 0x4C45444F4D4E4E43) {
+                    file.read((char*)&version, sizeof(version));
+                    file.read((char*)&size, sizeof(size));
+                }
+
+                layers = size;
+            }
+
+            void ExpectLayers(size_t amount)
+            {
+                if (layers != amount)
+                    Fail(std::to_string(layers) + " layers instead of " + std::to_string(amount));
+            }
+
+            void ExpectLayer(LayerTypes type, size_t width, size_t height, size_t channels)
+            {
+                uint8_t layerType = 0;
+                size_t outputChannels = 0, outputHeight = 0, outputWidth = 0;
+
+                file.read((char*)&layerType, sizeof(layerType));
+                file.read((char*)&outputChannels, sizeof(outputChannels));
+                file.read((char*)&outputHeight, sizeof(outputHeight));
+                file.read((char*)&outputWidth, sizeof(outputWidth));
+
+                if (layerType != type || outputWidth != width || outputHeight != height || outputChannels != channels)
+                    Fail("a layer of another type or shape at layer " + std::to_string(layer));
+
+                layer++;
+            }
+
+            void ExpectActivation(Activation activation)
+            {
+                std::string name;
+                std::getline(file, name, '\0');
+
+                if (name != ActivationName(activation))
+                    Fail("the activation " + name + " instead of " + ActivationName(activation));
+            }
+
+            void Expect(bool matches, const char* name)
+            {
+                if (!matches)
+                    Fail(std::string("another ") + name + " at layer " + std::to_string(layer - 1));
+            }
+
+            void ExpectValue(size_t expected, const char* name)
+            {
+                Expect(Read() == expected, name);
+            }
+
+            template <size_t size>
+            void ReadWeights(std::array<float, size>& weights)
+            {
+                ExpectValue(size, "amount of weights");
+                file.read((char*)weights.data(), size * sizeof(float));
+
+                if (!file)
+                    Fail("is incomplete");
+            }
+
+            size_t Read()
+            {
+                size_t value = 0;
+                file.read((char*)&value, sizeof(value));
+
+                return value;
+            }
+
+            size_t Version() const { return version; }
+
+        private:
+            [[noreturn]] void Fail(const std::string& reason) const
+            {
+                std::cout << "Error StaticNet::Load(), model file: " << fileName << " has " << reason << '\n';
+                exit(1);
+            }
+
+            std::ifstream file;
+            const std::string fileName;
+            size_t version = 0, layers = 0, layer = 0;
+        };
+    }
+
+    template <size_t W, size_t H, size_t C>
+    struct Input
+    {
+        static constexpr size_t width = W, height = H, channels = C, outputSize = W * H * C;
+    };
+
+    //A Convolution with kernels of kernelSize by kernelSize, every kernel covers all input channels.
+    template <size_t kernels, size_t kernelSize, size_t padding = 0, size_t stride = 1, Activation activation = ReLU>
+    struct Conv
+    {
+        template <size_t inputWidth, size_t inputHeight, size_t inputChannels>
+        struct Layer
+        {
+            static_assert(inputWidth + 2 * padding >= kernelSize && inputHeight + 2 * padding >= kernelSize, "The kernel is larger than the padded input");
+
+            static constexpr size_t width = (inputWidth + 2 * padding - kernelSize) / stride + 1;
+            static constexpr size_t height = (inputHeight + 2 * padding - kernelSize) / stride + 1;
+            static constexpr size_t channels = kernels, outputSize = width * height * channels;
+
+            struct Weights
+            {
+                std::array<float, kernels * inputChannels * kernelSize * kernelSize> kernelWeights;
+                std::array<float, kernels> biasWeights;
+            };
+
+            static void Forward(const Weights& weights, const float* inputs, float* outputs)
+            {
+                for (size_t k = 0; k < kernels; k++) {
+                    for (size_t j = 0; j < height; j++) {
+                        //The parts of the window in the padding are skipped.
+                        const size_t windowY = j * stride, firstY = padding > windowY ? padding - windowY : 0;
+                        const size_t lastY = std::min(kernelSize, inputHeight + padding - windowY);
+
+                        for (size_t i = 0; i < width; i++) {
+                            const size_t windowX = i * stride, firstX = padding > windowX ? padding - windowX : 0;
+                            const size_t lastX = std::min(kernelSize, inputWidth + padding - windowX);
+
+                            float sum = weights.biasWeights[k];
+
+                            for (size_t c = 0; c < inputChannels; c++) {
+                                const float* kernel = weights.kernelWeights.data() + (k * inputChannels + c) * kernelSize * kernelSize;
+                                const float* channel = inputs + c * inputWidth * inputHeight;
+
+                                for (size_t y = firstY; y < lastY; y++)
+                                    for (size_t x = firstX; x < lastX; x++)
+                                        sum += channel[(windowY + y - padding) * inputWidth + windowX + x - padding] * kernel[y * kernelSize + x];
+                            }
+
+                            outputs[(k * height + j) * width + i] = sum;
+                        }
+                    }
+                }
+
+                detail::Activate<activation, outputSize>(outputs);
+            }
+
+            static void Load(detail::ModelReader& reader, Weights& weights)
+            {
+                reader.ExpectLayer(ConvolutionLayer, width, height, channels);
+                reader.ExpectActivation(activation);
+                reader.ExpectValue(kernelSize, "kernel size");
+                reader.ExpectValue(kernels, "amount of kernels");
+                reader.ExpectValue(padding, "padding");
+
+                //Models saved before the stride was stored always have a stride of 1.
+                const size_t savedStride = reader.Version() >= 6 ? reader.Read() : 1;
+                reader.Expect(savedStride == stride, "stride");
+
+                reader.ReadWeights(weights.kernelWeights);
+                reader.ReadWeights(weights.biasWeights);
+            }
+        };
+    };
+
+    template <size_t poolSize, size_t stride = poolSize>
+    struct MaxPool
+    {
+        template <size_t inputWidth, size_t inputHeight, size_t inputChannels>
+        struct Layer
+        {
+            static_assert(inputWidth >= poolSize && inputHeight >= poolSize, "The pooling window is larger than the input");
+
+            static constexpr size_t width = (inputWidth - poolSize) / stride + 1;
+            static constexpr size_t height = (inputHeight - poolSize) / stride + 1;
+            static constexpr size_t channels = inputChannels, outputSize = width * height * channels;
+
+            struct Weights {};
+
+            static void Forward(const Weights&, const float* inputs, float* outputs)
+            {
+                for (size_t k = 0; k < channels; k++) {
+                    const float* channel = inputs + k * inputWidth * inputHeight;
+
+                    for (size_t j = 0; j < height; j++) {
+                        for (size_t i = 0; i < width; i++) {
+                            float max = std::numeric_limits<float>::lowest();
+
+                            for (size_t y = 0; y < poolSize; y++)
+                                for (size_t x = 0; x < poolSize; x++)
+                                    max = std::max(max, channel[(j * stride + y) * inputWidth + i * stride + x]);
+
+                            outputs[(k * height + j) * width + i] = max;
+                        }
+                    }
+                }
+            }
+
+            static void Load(detail::ModelReader& reader, Weights&)
+            {
+                reader.ExpectLayer(MaxPoolingLayer, width, height, channels);
+                reader.ExpectValue(poolSize, "pooling size");
+
+                //Models saved before the stride was stored always have a stride equal to the pooling size.
+                const size_t savedStride = reader.Version() >= 1 ? reader.Read() : poolSize;
+                reader.Expect(savedStride == stride, "stride");
+            }
+        };
+    };
+
+    template <size_t outputs, Activation activation = ReLU>
+    struct FC
+    {
+        template <size_t inputWidth, size_t inputHeight, size_t inputChannels>
+        struct Layer
+        {
+            static constexpr size_t inputSize = inputWidth * inputHeight * inputChannels;
+            static constexpr size_t width = 1, height = outputs, channels = 1, outputSize = outputs;
+
+            struct Weights
+            {
+                std::array<float, outputs * inputSize> weights;
+                std::array<float, outputs> biasWeights;
+            };
+
+            static void Forward(const Weights& weights, const float* inputs, float* result)
+            {
+                for (size_t k = 0; k < outputs; k++) {
+                    const float* row = weights.weights.data() + k * inputSize;
+                    float Z = 0.f;
+
+                    for (size_t j = 0; j < inputSize; j++)
+                        Z += inputs[j] * row[j];
+
+                    result[k] = Z + weights.biasWeights[k];
+                }
+
+                detail::Activate<activation, outputSize>(result);
+            }
+
+            static void Load(detail::ModelReader& reader, Weights& weights)
+            {
+                reader.ExpectLayer(FullyConnectedLayer, width, height, channels);
+                reader.ExpectActivation(activation);
+                reader.ReadWeights(weights.weights);
+                reader.ReadWeights(weights.biasWeights);
+            }
+        };
+    };
+
+    namespace detail
+    {
+        //The layers with the shapes of their inputs filled in, each layer takes the output shape of the one before it.
+        template <size_t width, size_t height, size_t channels, class... Specs>
+        struct Chain
+        {
+            using type = std::tuple<>;
+        };
+
+        template <size_t width, size_t height, size_t channels, class Spec, class... Specs>
+        struct Chain<width, height, channels, Spec, Specs...>
+        {
+            using Layer = typename Spec::template Layer<width, height, channels>;
+            using type = decltype(std::tuple_cat(std::tuple<Layer>{}, typename Chain<Layer::width, Layer::height, Layer::channels, Specs...>::type{}));
+        };
+
+        template <class Layers>
+        struct Buffers;
+
+        //All weights and outputs of the network in a single struct.
+        template <class... Layers>
+        struct Buffers<std::tuple<Layers...>>
+        {
+            std::tuple<typename Layers::Weights...> weights;
+            std::tuple<std::array<float, Layers::outputSize>...> outputs;
+        };
+    }
+}
+
+template <class InputSpec, class... Specs>
+class StaticNet
+{
+public:
+    using Layers = typename Static::detail::Chain<InputSpec::width, InputSpec::height, InputSpec::channels, Specs...>::type;
+
+    static constexpr size_t layerCount = sizeof...(Specs);
+    static constexpr size_t inputSize = InputSpec::outputSize;
+    static constexpr size_t outputSize = std::tuple_element_t<layerCount - 1, Layers>::outputSize;
+
+    static_assert(layerCount > 0, "A static network needs at least one layer after the input");
+
+    //Loads the weights of a model file with the same layers, a file with other layers is an error.
+    void Load(const std::string& fileName)
+    {
+        Static::detail::ModelReader reader(fileName);
+
+        reader.ExpectLayers(layerCount + 1);
+        reader.ExpectLayer(InputLayer, InputSpec::width, InputSpec::height, InputSpec::channels);
+
+        LoadLayers(reader, std::make_index_sequence<layerCount>{});
+    }
+
+    //The returned outputs stay valid until the next call.
+    const std::array<float, outputSize>& Predict(std::span<const float> input)
+    {
+        if (input.size() != inputSize) {
+            std::cout << "Error StaticNet::Predict(), Given input is not the same size as the input layer!\n";
+            exit(1);
+        }
+
+        FeedForward(input.data(), std::make_index_sequence<layerCount>{});
+
+        return std::get<layerCount - 1>(buffers.outputs);
+    }
+
+private:
+    template <size_t... layers>
+    void LoadLayers(Static::detail::ModelReader& reader, std::index_sequence<layers...>)
+    {
+        (std::tuple_element_t<layers, Layers>::Load(reader, std::get<layers>(buffers.weights)), ...);
+    }
+
+    template <size_t... layers>
+    void FeedForward(const float* input, std::index_sequence<layers...>)
+    {
+        (FeedForwardLayer<layers>(input), ...);
+    }
+
+    template <size_t layer>
+    void FeedForwardLayer(const float* input)
+    {
+        const float* inputs = input;
+
+        if constexpr (layer > 0)
+            inputs = std::get<layer - 1>(buffers.outputs).data();
+
+        std::tuple_element_t<layer, Layers>::Forward(std::get<layer>(buffers.weights), inputs, std::get<layer>(buffers.outputs).data());
+    }
+
+    Static::detail::Buffers<Layers> buffers;
+};
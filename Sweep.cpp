@@ -0,0 +1,290 @@
+#include "Sweep.h"
+#include "NeuralNetwork.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <format>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+//An optional value at the end of a line keeps its default when it is left out.
+template <typename T>
+static bool ReadOptional(std::istringstream& values, T& value)
+{
+    return (values >> std::ws).eof() || static_cast<bool>(values >> value);
+}
+
+SweepSpace SweepSpace::Read(const std::string& fileName)
+{
+    std::ifstream file(fileName);
+
+    if (!file.is_open()) {
+        std::cout << "Error, could not open the given file: " << fileName << '\n';
+        exit(1);
+    }
+
+    SweepSpace space;
+    std::string line;
+
+    while (std::getline(file, line)) {
+        std::istringstream values(line);
+        std::string setting;
+
+        if (!(values >> setting) || setting.front() == '#')
+            continue;
+
+        bool valid = true;
+
+        if (setting == "architecture") {
+            for (std::string architecture; values >> architecture;)
+                space.architectures.push_back(architecture);
+        }
+        else if (setting == "learningRate") {
+            for (float rate; values >> rate;)
+                space.learningRates.push_back(rate);
+        }
+        else if (setting == "decayRate") {
+            for (float rate; values >> rate;)
+                space.decayRates.push_back(rate);
+        }
+        else if (setting == "search") {
+            std::string search;
+            values >> search;
+
+            if (search == "random")
+                valid = values >> space.randomConfigurations && space.randomConfigurations != 0 && ReadOptional(values, space.seed);
+            else {
+                valid = search == "grid";
+                space.randomConfigurations = 0;
+            }
+        }
+        else if (setting == "input")
+            valid = static_cast<bool>(values >> space.width >> space.height >> space.channels);
+        else if (setting == "epochs")
+            valid = values >> space.maxEpochs && ReadOptional(values, space.minEpochs);
+        else if (setting == "eta")
+            valid = static_cast<bool>(values >> space.eta);
+        else if (setting == "threads")
+            valid = static_cast<bool>(values >> space.threads);
+        else if (setting == "target")
+            valid = static_cast<bool>(values >> space.targetAccuracy);
+        else {
+            std::cout << "Error SweepSpace::Read(), unknown setting: " << setting << '\n';
+            exit(1);
+        }
+
+        //A value that can not be read stops the reading before the end of the line, so anything left on the line is invalid as well.
+        if (!valid || !(values >> std::ws).eof()) {
+            std::cout << "Error SweepSpace::Read(), invalid value for " << setting << '\n';
+            exit(1);
+        }
+    }
+
+    if (space.architectures.empty() || space.learningRates.empty()) {
+        std::cout << "Error SweepSpace::Read(), " << fileName << " needs at least one architecture and learning rate\n";
+        exit(1);
+    }
+
+    if (space.decayRates.empty())
+        space.decayRates.push_back(0.f);
+
+    space.minEpochs = std::clamp<size_t>(space.minEpochs, 1, std::max<size_t>(space.maxEpochs, 1));
+    space.eta = std::max<size_t>(space.eta, 2);
+
+    return space;
+}
+
+std::vector<SweepConfiguration> SweepSpace::Configurations() const
+{
+    std::vector<SweepConfiguration> configurations;
+
+    if (randomConfigurations == 0) {
+        for (const auto& architecture : architectures)
+            for (float learningRate : learningRates)
+                for (float decayRate : decayRates)
+                    configurations.push_back({ architecture, learningRate, decayRate });
+
+        return configurations;
+    }
+
+    std::mt19937_64 generator(seed);
+
+    const auto [minRate, maxRate] = std::ranges::minmax(learningRates);
+    const auto [minDecay, maxDecay] = std::ranges::minmax(decayRates);
+
+    std::uniform_int_distribution<size_t> architecture(0, architectures.size() - 1);
+    std::uniform_real_distribution<float> logRate(std::log(minRate), std::log(maxRate));
+    std::uniform_real_distribution<float> decay(minDecay, maxDecay);
+
+    for (size_t i = 0; i < randomConfigurations; i++)
+        configurations.push_back({ architectures[architecture(generator)], std::exp(logRate(generator)), decay(generator) });
+
+    return configurations;
+}
+
+Sweep::Sweep(const DataSet& dataSet, const SweepSpace& space) : dataSet(dataSet), space(space)
+{
+    if (dataSet.trainInput.empty() || dataSet.validationInput.empty()) {
+        std::cout << "Error Sweep(), the data set needs training and validation samples\n";
+        exit(1);
+    }
+
+    classes = *std::ranges::max_element(dataSet.trainLabels) + 1;
+
+    for (const auto& configuration : space.Configurations())
+        trials.push_back({ configuration, std::unique_ptr<NeuralNetwork>(Build(configuration)) });
+}
+
+Sweep::~Sweep() = default;
+
+NeuralNetwork* Sweep::Build(const SweepConfiguration& configuration) const
+{
+    auto network = std::make_unique<NeuralNetwork>();
+    network->AddLayer(new Input(space.width, space.height, space.channels));
+
+    std::istringstream layers(configuration.architecture);
+
+    for (std::string layer; std::getline(layers, layer, '-');) {
+        const size_t size = layer.size() > 1 ? std::stoull(layer.substr(1)) : 0;
+
+        if (size == 0) {
+            std::cout << "Error Sweep(), invalid layer " << layer << " in architecture " << configuration.architecture << '\n';
+            exit(1);
+        }
+
+        switch (layer.front()) {
+        case 'c':
+            network->AddLayer(new Convolution(size, 3, 1));
+            break;
+        case 'p':
+            network->AddLayer(new MaxPooling(size));
+            break;
+        case 'f':
+            network->AddLayer(new FullyConnected(size, "relu"));
+            break;
+        default:
+            std::cout << "Error Sweep(), invalid layer " << layer << " in architecture " << configuration.architecture << '\n';
+            exit(1);
+        }
+    }
+
+    network->AddLayer(new FullyConnected(classes, "softmax"));
+    network->Create(configuration.learningRate, configuration.decayRate);
+
+    //The networks train at the same time, so their progress is reported by the sweep.
+    network->SetVerbose(false);
+
+    if (network->InputSize() != dataSet.trainInput.front().size()) {
+        std::cout << "Error Sweep(), the input of the networks is not the same size as the samples\n";
+        exit(1);
+    }
+
+    return network.release();
+}
+
+/*
+* Fits a single epoch without validation samples, so the network does not validate on a background thread.
+* The learning rate of the network decays every epoch, so fitting epoch by epoch gives the same schedule as fitting them at once.
+*/
+void Sweep::TrainEpoch(Trial& trial)
+{
+    static const std::vector<std::vector<float>> noSamples;
+    static const std::vector<size_t> noLabels;
+
+    const auto startTime = std::chrono::steady_clock::now();
+    trial.network->Fit(1, dataSet.trainInput, dataSet.trainLabels, noSamples, noLabels);
+    const std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - startTime;
+
+    trial.seconds.push_back((trial.seconds.empty() ? 0.0 : trial.seconds.back()) + elapsedTime.count());
+    trial.accuracies.push_back(trial.network->Accuracy(dataSet.validationInput, dataSet.validationLabels));
+}
+
+void Sweep::Train(const std::vector<Trial*>& trials, size_t epochs)
+{
+    const size_t threadCount = std::min<size_t>(space.threads != 0 ? space.threads : std::max(std::thread::hardware_concurrency(), 1u), trials.size());
+
+    //Every thread takes the next trial that has not been started, so a thread that finished early takes over the remaining work.
+    std::atomic<size_t> next{ 0 };
+
+    auto work = [&]() {
+        for (size_t i = next++; i < trials.size(); i = next++) {
+            while (trials[i]->accuracies.size() < epochs)
+                TrainEpoch(*trials[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; i++)
+        threads.emplace_back(work);
+
+    work();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void Sweep::Run()
+{
+    std::vector<Trial*> remaining;
+    for (auto& trial : trials)
+        remaining.push_back(&trial);
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    for (size_t epochs = space.minEpochs; !remaining.empty(); epochs = std::min(epochs * space.eta, space.maxEpochs)) {
+        Train(remaining, epochs);
+
+        const std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - startTime;
+        std::cout << std::format("Rung of {} epochs - {} configurations - {:.1f}s\n", epochs, remaining.size(), elapsedTime.count());
+
+        if (epochs >= space.maxEpochs)
+            break;
+
+        //The best 1/eta continue, at least one configuration always reaches the maximum amount of epochs.
+        std::ranges::stable_sort(remaining, std::greater{}, [](const Trial* trial) { return trial->accuracies.back(); });
+        remaining.resize(std::max<size_t>((remaining.size() + space.eta - 1) / space.eta, 1));
+
+        //The stopped networks are not needed anymore, only their results.
+        for (auto& trial : trials) {
+            if (std::ranges::find(remaining, &trial) == remaining.end())
+                trial.network.reset();
+        }
+    }
+}
+
+void Sweep::PrintResults() const
+{
+    std::vector<const Trial*> ranking;
+    for (const auto& trial : trials)
+        ranking.push_back(&trial);
+
+    //Configurations that trained longer rank above the ones that were stopped, as their accuracies are not comparable.
+    std::ranges::stable_sort(ranking, [](const Trial* a, const Trial* b) {
+        if (a->accuracies.size() != b->accuracies.size())
+            return a->accuracies.size() > b->accuracies.size();
+
+        return a->accuracies.back() > b->accuracies.back();
+    });
+
+    std::cout << std::format("{:<24} {:>10} {:>8} {:>7} {:>9} {:>9} {:>11} {:>10}\n", "Architecture", "Rate", "Decay", "Epochs", "Accuracy", "Best", "Train time", std::format("To {:.1f} %", space.targetAccuracy * 100.f));
+
+    for (const Trial* trial : ranking) {
+        const auto& configuration = trial->configuration;
+
+        if (trial->accuracies.empty()) {
+            std::cout << std::format("{:<24} {:>10.3g} {:>8.3g} {:>7}\n", configuration.architecture, configuration.learningRate, configuration.decayRate, 0);
+            continue;
+        }
+
+        const auto reached = std::ranges::find_if(trial->accuracies, [this](float accuracy) { return accuracy >= space.targetAccuracy; });
+        const std::string timeToAccuracy = reached == trial->accuracies.end() ? "-" : std::format("{:.1f}s", trial->seconds[reached - trial->accuracies.begin()]);
+
+        std::cout << std::format("{:<24} {:>10.3g} {:>8.3g} {:>7} {:>8.2f}% {:>8.2f}% {:>10.1f}s {:>10}\n", configuration.architecture, configuration.learningRate, configuration.decayRate,
+            trial->accuracies.size(), trial->accuracies.back() * 100.f, std::ranges::max(trial->accuracies) * 100.f, trial->seconds.back(), timeToAccuracy);
+    }
+}
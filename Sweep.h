@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "common.h"
+
+class NeuralNetwork;
+
+/*
+* A single configuration of a sweep. The architecture lists the layers between the input and the softmax output, separated by '-':
+* c<n> is a 3x3 Convolution with n kernels and padding 1, p<n> a MaxPooling of n by n and f<n> a FullyConnected layer with n outputs.
+* For example c8-p2-f64 or f128-f64.
+*/
+struct SweepConfiguration
+{
+    std::string architecture;
+    float learningRate = 1E-3f;
+    float decayRate = 0.f;
+};
+
+/*
+* The search space of a sweep, read from a text file with one setting and its values per line:
+*   architecture <architecture> ...
+*   learningRate <rate> ...
+*   decayRate <rate> ...
+*   search grid | random <configurations> [seed]
+*   input <width> <height> <channels>
+*   epochs <max epochs> [min epochs]
+*   eta <factor>
+*   threads <threads>
+*   target <accuracy>
+* A grid search trains every combination, a random search draws the learning rate log uniformly and the decay rate uniformly
+* between the smallest and largest given value. Values that can not be read are an error, and a random search needs at least one configuration.
+*/
+struct SweepSpace
+{
+    static SweepSpace Read(const std::string& fileName);
+
+    std::vector<SweepConfiguration> Configurations() const;
+
+    std::vector<std::string> architectures;
+    std::vector<float> learningRates, decayRates;
+
+    //0 is a grid search.
+    size_t randomConfigurations = 0;
+    uint64_t seed = 0;
+
+    size_t width = 28, height = 28, channels = 1;
+    size_t maxEpochs = 9, minEpochs = 1, eta = 3;
+
+    //0 uses all cores.
+    size_t threads = 0;
+
+    //The validation accuracy that the time to accuracy is measured for.
+    float targetAccuracy = 0.97f;
+};
+
+/*
+* Trains the configurations of a search space concurrently in one process, each network on its own thread, all reading the same data set.
+* Poor configurations are stopped early by successive halving: every rung trains the remaining configurations up to the epochs of the rung,
+* after which only the best 1/eta of them by validation accuracy continue with eta times as many epochs, until the maximum is reached.
+*/
+class Sweep
+{
+public:
+    //The data set is not copied, so it has to outlive the sweep.
+    Sweep(const DataSet& dataSet, const SweepSpace& space);
+    ~Sweep();
+
+    void Run();
+    void PrintResults() const;
+
+private:
+    struct Trial
+    {
+        SweepConfiguration configuration;
+        std::unique_ptr<NeuralNetwork> network;
+
+        //The validation accuracy and the total training time after every epoch.
+        std::vector<float> accuracies;
+        std::vector<double> seconds;
+    };
+
+    //Trains every trial up to the given amount of epochs, the trials are divided over the threads.
+    void Train(const std::vector<Trial*>& trials, size_t epochs);
+    void TrainEpoch(Trial& trial);
+
+    NeuralNetwork* Build(const SweepConfiguration& configuration) const;
+
+    const DataSet& dataSet;
+    const SweepSpace space;
+    size_t classes = 0;
+
+    std::vector<Trial> trials;
+};
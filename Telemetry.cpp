@@ -0,0 +1,119 @@
+#include "Telemetry.h"
+
+#include <iostream>
+#include <format>
+#include <chrono>
+#include <bit>
+#include <algorithm>
+
+TelemetryRing::TelemetryRing(size_t capacity) :
+    records(std::make_unique<TelemetryRecord[]>(std::bit_ceil(std::max<size_t>(capacity, 2)))), mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1)
+{
+}
+
+bool TelemetryRing::Push(const TelemetryRecord& record)
+{
+    const size_t position = head.load(std::memory_order_relaxed);
+
+    if (position - cachedTail > mask) {
+        cachedTail = tail.load(std::memory_order_acquire);
+
+        if (position - cachedTail > mask)
+            return false;
+    }
+
+    records[position & mask] = record;
+    head.store(position + 1, std::memory_order_release);
+
+    return true;
+}
+
+size_t TelemetryRing::Pop(TelemetryRecord* destination, size_t maximum)
+{
+    const size_t position = tail.load(std::memory_order_relaxed);
+
+    if (position == cachedHead) {
+        cachedHead = head.load(std::memory_order_acquire);
+
+        if (position == cachedHead)
+            return 0;
+    }
+
+    const size_t count = std::min(maximum, cachedHead - position);
+
+    for (size_t i = 0; i < count; i++)
+        destination[i] = records[(position + i) & mask];
+
+    tail.store(position + count, std::memory_order_release);
+
+    return count;
+}
+
+TelemetryLog::TelemetryLog(const std::string& fileName, size_t capacity) :
+    ring(capacity), csv(fileName.ends_with(".csv"))
+{
+    file.open(fileName, csv ? std::ios::out : std::ios::binary);
+
+    if (!file.is_open()) {
+        std::cout << "Error, could not open the metrics file: " << fileName << '\n';
+        exit(1);
+    }
+
+    if (csv) {
+        file << "epoch,step,loss,gradientNorm,learningRate,nan,correct\n";
+    }
+    else {
+        file.write((const char*)&fileMagic, sizeof(fileMagic));
+        file.write((const char*)&fileVersion, sizeof(fileVersion));
+    }
+
+    writer = std::thread(&TelemetryLog::Run, this);
+}
+
+TelemetryLog::~TelemetryLog()
+{
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+
+    if (dropped != 0)
+        std::cout << "Warning, " << dropped << " training metrics were dropped because the metrics file could not keep up\n";
+}
+
+/*
+* Polls the ring instead of being woken by the training loop, so pushing a record never makes a system call.
+* A poll every millisecond is often enough for a ring that holds tens of thousands of steps.
+*/
+void TelemetryLog::Run()
+{
+    TelemetryRecord buffer[256];
+
+    while (true) {
+        const bool last = stopping.load(std::memory_order_acquire);
+
+        //After stopping is seen, everything the producer pushed before it is in the ring.
+        while (const size_t count = ring.Pop(buffer, std::size(buffer)))
+            Write(buffer, count);
+
+        if (last)
+            break;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    file.flush();
+}
+
+void TelemetryLog::Write(const TelemetryRecord* records, size_t count)
+{
+    if (!csv) {
+        file.write((const char*)records, count * sizeof(TelemetryRecord));
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const auto& record = records[i];
+
+        file << std::format("{},{},{},{},{},{},{}\n", record.epoch, record.step, record.loss, record.gradientNorm, record.learningRate,
+            (record.flags & TelemetryRecord::NaN) ? 1 : 0, (record.flags & TelemetryRecord::Correct) ? 1 : 0);
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+//The metrics of a single training step, written to the metrics file as is.
+struct TelemetryRecord
+{
+    uint64_t step = 0;
+    uint32_t epoch = 0;
+    uint32_t flags = 0;
+    float loss = 0.f;
+
+    //The L2 norm of the gradient of the loss with respect to the outputs of the network, which is what is backpropogated.
+    float gradientNorm = 0.f;
+    float learningRate = 0.f;
+    float padding = 0.f;
+
+    static constexpr uint32_t NaN = 1;
+    static constexpr uint32_t Correct = 2;
+};
+
+/*
+* A lock free ring of records for a single producer and a single consumer. Both sides only write their own index, and keep a cached copy
+* of the index of the other side so they only read the shared cache line when the ring looks full or empty.
+*/
+class TelemetryRing
+{
+public:
+    //The capacity is rounded up to a power of two.
+    explicit TelemetryRing(size_t capacity);
+
+    //Returns false without waiting when the ring is full.
+    bool Push(const TelemetryRecord& record);
+
+    //Copies up to maximum records to the destination, and returns the amount that was copied.
+    size_t Pop(TelemetryRecord* destination, size_t maximum);
+
+private:
+    std::unique_ptr<TelemetryRecord[]> records;
+    const size_t mask;
+
+    alignas(64) std::atomic<size_t> head{ 0 };
+    size_t cachedTail = 0;
+
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    size_t cachedHead = 0;
+};
+
+/*
+* Writes the records that the training loop pushes to a metrics file on a background thread. The training loop never waits on the file,
+* when the writer falls behind and the ring is full the record is dropped and counted instead.
+* A file name ending in .csv gives a CSV file with a header line, any other name a binary file which starts with the magic value "CNNSTEPS"
+* and the version of the format, followed by the records.
+*/
+class TelemetryLog
+{
+public:
+    explicit TelemetryLog(const std::string& fileName, size_t capacity = 1 << 16);
+    TelemetryLog(const TelemetryLog&) = delete;
+    TelemetryLog& operator=(const TelemetryLog&) = delete;
+
+    //Writes the remaining records and closes the file.
+    ~TelemetryLog();
+
+    void Push(const TelemetryRecord& record)
+    {
+        if (!ring.Push(record))
+            dropped++;
+    }
+
+    //The amount of records that were dropped because the ring was full, only read it from the producing thread.
+    size_t Dropped() const { return dropped; }
+
+private:
+    void Run();
+    void Write(const TelemetryRecord* records, size_t count);
+
+    static constexpr uint64_t fileMagic = 0x53504554534E4E43;
+    static constexpr uint64_t fileVersion = 1;
+
+    TelemetryRing ring;
+    std::ofstream file;
+    bool csv = false;
+    size_t dropped = 0;
+
+    std::atomic<bool> stopping{ false };
+    std::thread writer;
+};
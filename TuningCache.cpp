@@ -0,0 +1,74 @@
+#include "TuningCache.h"
+#include "MachineProfile.h"
+#include "common.h"
+
+#include <iostream>
+#include <fstream>
+
+TuningCache::TuningCache(const std::string& fileName) :
+    fileName(fileName), processor(MachineProfile::ProcessorName())
+{
+    std::ifstream file(fileName, std::ios::binary);
+
+    if (!file.is_open())
+        return;
+
+    size_t magic = 0, version = 0, size = 0;
+    file.read((char*)&magic, sizeof(magic));
+    file.read((char*)&version, sizeof(version));
+    file.read((char*)&size, sizeof(size));
+
+    //An unreadable cache is ignored, the layers are tuned again and the cache is replaced.
+    if (!file || magic != fileMagic || version > fileVersion) {
+        std::cout << "Warning, ignoring the tuning cache: " << fileName << " which is invalid or of a newer version\n";
+        return;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        std::string entryProcessor, key, algorithm;
+
+        std::getline(file, entryProcessor, '\0');
+        std::getline(file, key, '\0');
+        std::getline(file, algorithm, '\0');
+
+        if (!file)
+            break;
+
+        entries[{ entryProcessor, key }] = algorithm;
+    }
+}
+
+std::string TuningCache::Find(const std::string& key) const
+{
+    const auto entry = entries.find({ processor, key });
+
+    return entry == entries.end() ? std::string() : entry->second;
+}
+
+void TuningCache::Store(const std::string& key, const std::string& algorithm)
+{
+    entries[{ processor, key }] = algorithm;
+    changed = true;
+}
+
+void TuningCache::Save() const
+{
+    if (!changed || fileName.empty())
+        return;
+
+    std::ofstream file = OpenTemporaryFile(fileName);
+    const size_t size = entries.size();
+
+    file.write((const char*)&fileMagic, sizeof(fileMagic));
+    file.write((const char*)&fileVersion, sizeof(fileVersion));
+    file.write((const char*)&size, sizeof(size));
+
+    for (const auto& [key, algorithm] : entries)
+        file << key.first << '\0' << key.second << '\0' << algorithm << '\0';
+
+    //A tuning cache that can not be written is not fatal, the layers are tuned again by the next run.
+    const std::string error = CommitTemporaryFile(file, fileName);
+
+    if (!error.empty())
+        std::cout << error;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+
+/*
+* Stores for every layer shape the algorithm that was the fastest on a processor, so the layers are only timed once.
+* The file starts with "CNNTUNE" and the version of the format, followed by the amount of entries and for every entry the processor name,
+* the tuning key of the layer and the name of the algorithm, as strings terminated by '\0'. Entries of other processors are kept.
+*/
+class TuningCache
+{
+public:
+    //Reads the cache when the file exists, a cache without a file name is never saved.
+    explicit TuningCache(const std::string& fileName);
+
+    //Returns the name of the algorithm stored for the key on this processor, or an empty string when the key was not tuned yet.
+    std::string Find(const std::string& key) const;
+    void Store(const std::string& key, const std::string& algorithm);
+
+    //Writes the cache when an entry was stored, the file is replaced atomically.
+    void Save() const;
+
+private:
+    //"CNNTUNE\0"
+    static constexpr size_t fileMagic = 0x00454E55544E4E43;
+    static constexpr size_t fileVersion = 1;
+
+    std::string fileName, processor;
+
+    //The algorithm for every processor and tuning key.
+    std::map<std::pair<std::string, std::string>, std::string> entries;
+    bool changed = false;
+};
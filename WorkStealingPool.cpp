@@ -0,0 +1,142 @@
+#include "WorkStealingPool.h"
+#include "Numa.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+std::unique_ptr<WorkStealingPool> WorkStealingPool::pool;
+
+//Set on the workers, and on the calling thread while it runs a range, so nested calls run on the thread itself.
+static thread_local bool insideRange = false;
+
+void WorkStealingPool::SetThreads(size_t threads, const std::vector<size_t>& processors)
+{
+    pool.reset();
+
+    if (threads > 1)
+        pool.reset(new WorkStealingPool(threads, processors));
+}
+
+size_t WorkStealingPool::Threads()
+{
+    return pool ? pool->threadCount : 1;
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads, const std::vector<size_t>& processors) :
+    threadCount(threads), chunks(new Chunks[threads])
+{
+    //Workers that are not pinned get SIZE_MAX as processor.
+    for (size_t i = 1; i < threadCount; i++)
+        workers.emplace_back(&WorkStealingPool::Worker, this, i, processors.empty() ? SIZE_MAX : processors[(i - 1) % processors.size()]);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    started.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+bool WorkStealingPool::Run(size_t count, size_t workPerItem, Function function, const void* context)
+{
+    bool expected = false;
+
+    if (insideRange || !busy.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        return false;
+
+    //Chunks are at least a quarter of the minimum work, and there are at most chunksPerThread chunks per thread.
+    const size_t minimumChunk = std::max<size_t>((minimumWork / 4 + workPerItem - 1) / std::max<size_t>(workPerItem, 1), 1);
+    const size_t maximumChunks = threadCount * chunksPerThread;
+
+    this->chunkSize = std::max(minimumChunk, (count + maximumChunks - 1) / maximumChunks);
+    this->function = function;
+    this->context = context;
+    this->count = count;
+
+    const size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    participants = std::min(threadCount, chunkCount);
+
+    for (size_t p = 0; p < participants; p++) {
+        chunks[p].next.store(p * chunkCount / participants, std::memory_order_relaxed);
+        chunks[p].end = (p + 1) * chunkCount / participants;
+    }
+
+    remaining.store(workers.size(), std::memory_order_relaxed);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+
+    started.notify_all();
+
+    insideRange = true;
+    Work(0);
+    insideRange = false;
+
+    //Every worker acknowledges every range, so no worker misses the next one.
+    while (remaining.load(std::memory_order_acquire) != 0)
+        std::this_thread::yield();
+
+    busy.store(false, std::memory_order_release);
+
+    return true;
+}
+
+void WorkStealingPool::Work(size_t participant)
+{
+    auto runChunks = [this](Chunks& owner) {
+        for (size_t chunk = owner.next.fetch_add(1, std::memory_order_relaxed); chunk < owner.end; chunk = owner.next.fetch_add(1, std::memory_order_relaxed))
+            function(context, chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+    };
+
+    runChunks(chunks[participant]);
+
+    //Steals the chunks that the other threads did not take yet.
+    for (size_t i = 1; i < participants; i++)
+        runChunks(chunks[(participant + i) % participants]);
+}
+
+/*
+* After a range the workers spin for a short while before they sleep, because the layers of a network start their ranges right after each other.
+*/
+void WorkStealingPool::Worker(size_t participant, size_t processor)
+{
+    insideRange = true;
+
+    if (processor != SIZE_MAX)
+        PinThreadToProcessor(processor);
+
+    size_t seen = 0;
+
+    while (true) {
+        const auto spinStart = std::chrono::steady_clock::now();
+
+        while (generation.load(std::memory_order_acquire) == seen && !stopping.load(std::memory_order_relaxed)) {
+            if (std::chrono::steady_clock::now() - spinStart < std::chrono::microseconds(200)) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            started.wait(lock, [this, seen] { return generation.load(std::memory_order_relaxed) != seen || stopping.load(std::memory_order_relaxed); });
+        }
+
+        if (stopping.load(std::memory_order_relaxed))
+            return;
+
+        seen = generation.load(std::memory_order_acquire);
+
+        if (participant < participants)
+            Work(participant);
+
+        remaining.fetch_sub(1, std::memory_order_release);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+/*
+* Splits the work of a single layer over the cores, for the latency of single samples where there is no batch to divide.
+* ParallelFor divides a range in chunks which are dealt out evenly to the threads, a thread that finished its own chunks steals the remaining
+* chunks of the other threads. The calling thread works along. Calls from inside a chunk, or while another call is running, run on the calling thread alone.
+* Work that is too small to pay for waking the threads is not split, so small layers are not slowed down.
+*/
+class WorkStealingPool
+{
+public:
+    /*
+    * Sets the amount of threads that work on a layer, including the calling thread. 1 disables the pool, which is the default.
+    * When processors are given, the workers are pinned to them in turn, see NumaNodeProcessors. The calling thread is not pinned.
+    */
+    static void SetThreads(size_t threads, const std::vector<size_t>& processors = {});
+    static size_t Threads();
+
+    /*
+    * Calls body(begin, end) for disjoint ranges which together cover [0, count). workPerItem is about the amount of multiply adds of a single item,
+    * the range is only split when the total work is large enough. Does not allocate memory.
+    */
+    template <class Body>
+    static void ParallelFor(size_t count, size_t workPerItem, const Body& body);
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    ~WorkStealingPool();
+
+private:
+    using Function = void (*)(const void* context, size_t begin, size_t end);
+
+    //The chunks [next, end) of a thread which have not been taken yet, on their own cache line so the threads do not slow each other down.
+    struct alignas(64) Chunks
+    {
+        std::atomic<size_t> next{ 0 };
+        size_t end = 0;
+    };
+
+    WorkStealingPool(size_t threads, const std::vector<size_t>& processors);
+
+    //Returns false when the range has to run on the calling thread.
+    bool Run(size_t count, size_t workPerItem, Function function, const void* context);
+    void Work(size_t participant);
+    void Worker(size_t participant, size_t processor);
+
+    //About 10 us of work on a single core, below it waking the threads costs more than it saves.
+    static constexpr size_t minimumWork = 1 << 15;
+
+    //The amount of chunks per thread, more chunks balance the work better when the threads do not run at the same speed.
+    static constexpr size_t chunksPerThread = 4;
+
+    static std::unique_ptr<WorkStealingPool> pool;
+
+    const size_t threadCount;
+    std::vector<std::thread> workers;
+    std::unique_ptr<Chunks[]> chunks;
+
+    //Only set by the one thread that runs a range, the workers read them after the generation changed.
+    Function function = nullptr;
+    const void* context = nullptr;
+    size_t count = 0, chunkSize = 1, participants = 1;
+
+    std::atomic<bool> busy{ false }, stopping{ false };
+    std::atomic<size_t> generation{ 0 }, remaining{ 0 };
+
+    std::mutex mutex;
+    std::condition_variable started;
+};
+
+template <class Body>
+void WorkStealingPool::ParallelFor(size_t count, size_t workPerItem, const Body& body)
+{
+    auto function = [](const void* context, size_t begin, size_t end) {
+        (*static_cast<const Body*>(context))(begin, end);
+    };
+
+    if (pool == nullptr || count < 2 || count * workPerItem < minimumWork || !pool->Run(count, workPerItem, function, &body))
+        body(0, count);
+}
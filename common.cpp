@@ -1,18 +1,34 @@
 #include "common.h"
+#include "DatasetCache.h"
 
 #include <random>
 #include <iostream>
+#include <algorithm>
+#include <filesystem>
 
-void InitWeights(std::vector<float>& weights, size_t amount, size_t fanIn)
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//Every thread has its own generator, so networks can be created on several threads at once.
+static thread_local std::mt19937 weightGenerator{ std::random_device{}() };
+
+void SeedWeights(uint64_t seed)
 {
-	std::random_device rd{};
-	std::mt19937 gen{ rd()};
+	weightGenerator.seed(static_cast<std::mt19937::result_type>(seed));
+}
 
+void InitWeights(std::vector<float>& weights, size_t amount, size_t fanIn)
+{
 	std::normal_distribution dis{ 0.f, std::sqrtf( 2.f / fanIn )};
 
 	for (size_t i = 0; i < amount; i++)
 	{
-		weights.push_back(dis(gen));
+		weights.push_back(dis(weightGenerator));
 	}
 }
 
@@ -53,3 +69,90 @@ std::vector<float> LabelToOneHotEncoding(size_t label, size_t outputSize)
 
 	return labels;
 }
+
+/*
+* Writes the one hot encoding into the given vector, which already has the size of the output. So no memory is allocated.
+*/
+void LabelToOneHotEncoding(size_t label, std::vector<float>& labels)
+{
+	std::fill(labels.begin(), labels.end(), 0.f);
+	labels[label] = 1.f;
+}
+
+/*
+* Returns the given percentile (between 0 and 100) of the values, the order of the values is changed.
+*/
+double Percentile(std::vector<double>& values, double percentile)
+{
+	if (values.empty())
+		return 0.0;
+
+	auto nth = values.begin() + static_cast<size_t>(percentile / 100.0 * static_cast<double>(values.size() - 1) + 0.5);
+	std::nth_element(values.begin(), nth, values.end());
+
+	return *nth;
+}
+
+std::span<const float> SampleSet::operator[](size_t n) const
+{
+	return samples ? std::span<const float>((*samples)[n]) : cache->Input(n);
+}
+
+size_t SampleSet::size() const
+{
+	return samples ? samples->size() : cache->Size();
+}
+
+bool SampleSet::AllOfSize(size_t size) const
+{
+	if (cache)
+		return cache->SampleSize() == size;
+
+	return std::ranges::all_of(*samples, [size](const auto& sample) { return sample.size() == size; });
+}
+
+std::ofstream OpenTemporaryFile(const std::string& fileName)
+{
+	return std::ofstream(fileName + ".tmp", std::ios::binary | std::fstream::out | std::fstream::trunc);
+}
+
+//Writes the data of a closed file that the operating system still caches to the disk.
+static bool SyncFile(const std::string& fileName)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	const bool synced = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+#else
+	const int file = open(fileName.c_str(), O_WRONLY);
+	if (file == -1)
+		return false;
+
+	const bool synced = fsync(file) == 0;
+	close(file);
+#endif
+
+	return synced;
+}
+
+std::string CommitTemporaryFile(std::ofstream& file, const std::string& fileName)
+{
+	if (!file.is_open())
+		return "Error, could not create file named: " + fileName + ".tmp\n";
+
+	file.close();
+
+	if (!file || !SyncFile(fileName + ".tmp"))
+		return "Error, could not write file named: " + fileName + ".tmp\n";
+
+	std::error_code error;
+	std::filesystem::rename(fileName + ".tmp", fileName, error);
+
+	if (error)
+		return "Error, could not replace file named: " + fileName + " - " + error.message() + '\n';
+
+	return {};
+}
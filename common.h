@@ -1,15 +1,56 @@
 #pragma once
 
 #include <vector>
+#include <span>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+class DatasetCache;
 
 void InitWeights(std::vector<float>& weights, size_t amount, size_t fanIn);
+
+//Makes the weights that InitWeights draws on the calling thread reproducible, they are random by default.
+void SeedWeights(uint64_t seed);
 void PrintVector(const std::vector<float>& vec);
 float CrossEntropyLoss(const std::vector<float>& expected, const std::vector<float>& output);
 std::vector<float> LabelToOneHotEncoding(size_t label, size_t outputSize);
+void LabelToOneHotEncoding(size_t label, std::vector<float>& labels);
+double Percentile(std::vector<double>& values, double percentile);
+
+/*
+* Files are first written to a temporary file next to the real one, which is flushed to the disk and renamed when it is complete.
+* Thus a crash while saving never leaves a partially written file behind. CommitTemporaryFile does not exit, so it can be used from
+* background threads, it returns an error message or an empty string when the file was replaced.
+*/
+std::ofstream OpenTemporaryFile(const std::string& fileName);
+std::string CommitTemporaryFile(std::ofstream& file, const std::string& fileName);
 
 struct DataSet {
     std::vector<std::vector<float>> trainInput;
     std::vector<size_t> trainLabels;
     std::vector<std::vector<float>> validationInput;
     std::vector<size_t> validationLabels;
-};
\ No newline at end of file
+};
+
+/*
+* A view of the input samples of a data set, which are either stored as separate vectors in memory or memory mapped from a dataset cache.
+* The samples are not copied, so the data set has to outlive the view.
+*/
+class SampleSet
+{
+public:
+    SampleSet(const std::vector<std::vector<float>>& samples) : samples(&samples) {}
+    SampleSet(const DatasetCache& cache) : cache(&cache) {}
+
+    std::span<const float> operator[](size_t n) const;
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+
+    //Whether every sample has the given amount of values.
+    bool AllOfSize(size_t size) const;
+
+private:
+    const std::vector<std::vector<float>>* samples = nullptr;
+    const DatasetCache* cache = nullptr;
+};